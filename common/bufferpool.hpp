@@ -0,0 +1,187 @@
+#ifndef BUFFERPOOL_HPP
+#define BUFFERPOOL_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+/* 	Per-thread memory for connections, header only so both servers can use it.
+	SlabPool hands out fixed size blocks carved from 64-block slabs, a freed block goes
+	on an intrusive free list, so steady state alloc/free is a pointer pop/push and never
+	reaches malloc. BufferPool keeps one size class per power of two: classes up to 64 KB
+	are slab backed, bigger ones are malloc'ed and a few of each are cached.
+	Pools are never destroyed: a block may be released by another thread after its owner
+	exited (server teardown joins the reactors first), it then simply joins that thread's
+	free list. */
+
+const size_t K_BUFFER_MIN_SHIFT = 12;																			// 	4 KB, the first size class
+const size_t K_BUFFER_SLAB_SHIFT = 16;																			// 	Classes up to 64 KB come from slabs
+const size_t K_BUFFER_MAX_SHIFT = 26;																			// 	64 MB, nothing bigger is pooled or allowed
+const size_t K_BUFFER_CACHED_LARGE = 4;																			// 	Free large blocks kept per class
+
+class SlabPool {
+public:
+	explicit SlabPool(size_t blockSize, size_t blocksPerSlab = 64)
+		: block_size_(blockSize < sizeof(void*) ? sizeof(void*) : blockSize), per_slab_(blocksPerSlab) {
+	}
+	SlabPool(const SlabPool&) = delete;
+	SlabPool& operator=(const SlabPool&) = delete;
+
+	void* alloc() {
+		if (!free_list_) { grow(); }
+		void* p = free_list_;
+		free_list_ = *(void**)p;																				// 	The first word of a free block points to the next one
+		return p;
+	}
+
+	void free(void* p) {
+		*(void**)p = free_list_;
+		free_list_ = p;
+	}
+
+private:
+	void grow() {
+		char* slab = (char*)malloc(block_size_ * per_slab_);
+		if (!slab) { throw std::bad_alloc(); }
+		for (size_t i = per_slab_; i-- > 0; ) {
+			free(slab + i * block_size_);
+		}
+	}
+
+	size_t block_size_;
+	size_t per_slab_;
+	void* free_list_ = nullptr;
+};
+
+class BufferPool {
+public:
+	static BufferPool& local() {
+		static thread_local BufferPool* pool = new BufferPool();												// 	Intentionally leaked, see above
+		return *pool;
+	}
+
+	static size_t classOf(size_t size) {
+		size_t shift = K_BUFFER_MIN_SHIFT;
+		while (((size_t)1 << shift) < size) { shift++; }
+		return shift;
+	}
+
+	uint8_t* acquire(size_t shift) {
+		if (shift <= K_BUFFER_SLAB_SHIFT) { return (uint8_t*)slabs_[shift - K_BUFFER_MIN_SHIFT]->alloc(); }
+		std::vector<uint8_t*>& cached = large_[shift - K_BUFFER_SLAB_SHIFT - 1];
+		if (!cached.empty()) {
+			uint8_t* p = cached.back();
+			cached.pop_back();
+			return p;
+		}
+		uint8_t* p = (uint8_t*)malloc((size_t)1 << shift);
+		if (!p) { throw std::bad_alloc(); }
+		return p;
+	}
+
+	void release(uint8_t* p, size_t shift) {
+		if (shift <= K_BUFFER_SLAB_SHIFT) {
+			slabs_[shift - K_BUFFER_MIN_SHIFT]->free(p);
+			return;
+		}
+		std::vector<uint8_t*>& cached = large_[shift - K_BUFFER_SLAB_SHIFT - 1];
+		if (cached.size() < K_BUFFER_CACHED_LARGE) {
+			cached.push_back(p);
+		} else {
+			::free(p);
+		}
+	}
+
+private:
+	BufferPool() {
+		for (size_t shift = K_BUFFER_MIN_SHIFT; shift <= K_BUFFER_SLAB_SHIFT; shift++) {
+			size_t per_slab = shift <= 13 ? 64 : 8;																// 	Fewer blocks per slab for the bigger classes
+			slabs_[shift - K_BUFFER_MIN_SHIFT] = new SlabPool((size_t)1 << shift, per_slab);
+		}
+	}
+
+	SlabPool* slabs_[K_BUFFER_SLAB_SHIFT - K_BUFFER_MIN_SHIFT + 1];
+	std::vector<uint8_t*> large_[K_BUFFER_MAX_SHIFT - K_BUFFER_SLAB_SHIFT];
+};
+
+/* 	Growable byte buffer backed by the calling thread's BufferPool. It starts empty
+	(capacity 0), grows by size classes and can be given back whenever it holds nothing,
+	so an idle connection keeps no buffer memory at all. */
+class Buffer {
+public:
+	Buffer() = default;
+	~Buffer() { release(); }
+	Buffer(const Buffer&) = delete;
+	Buffer& operator=(const Buffer&) = delete;
+
+	uint8_t* data() { return data_; }
+	const uint8_t* data() const { return data_; }
+	size_t capacity() const { return data_ ? (size_t)1 << shift_ : 0; }
+
+	// Make room for need bytes keeping the first keep ones, false when need is above the largest class
+	bool reserve(size_t need, size_t keep) {
+		if (need <= capacity()) { return true; }
+		size_t shift = BufferPool::classOf(need);
+		if (shift > K_BUFFER_MAX_SHIFT) { return false; }
+		move_to(shift, keep);
+		return true;
+	}
+
+	// Drop to the smallest class that holds keep bytes (and min bytes), used after a burst
+	void shrink(size_t keep, size_t min = 0) {
+		if (!data_) { return; }
+		size_t shift = BufferPool::classOf(keep > min ? keep : min);
+		if (shift < shift_) { move_to(shift, keep); }
+	}
+
+	void release() {
+		if (!data_) { return; }
+		BufferPool::local().release(data_, shift_);
+		data_ = nullptr;
+		shift_ = 0;
+	}
+
+private:
+	void move_to(size_t shift, size_t keep) {
+		uint8_t* p = BufferPool::local().acquire(shift);
+		if (data_) {
+			if (keep) { memcpy(p, data_, keep); }
+			BufferPool::local().release(data_, shift_);
+		}
+		data_ = p;
+		shift_ = shift;
+	}
+
+	uint8_t* data_ = nullptr;
+	size_t shift_ = 0;
+};
+
+/* 	Object pool on top of SlabPool for the calling thread, used for Conn:
+	accepting a connection pops a block instead of calling operator new. */
+template <class T>
+class ObjectPool {
+public:
+	template <class... Args>
+	static T* create(Args&&... args) {
+		void* p = slab().alloc();
+		return new (p) T(static_cast<Args&&>(args)...);
+	}
+
+	static void destroy(T* obj) {
+		if (!obj) { return; }
+		obj->~T();
+		slab().free(obj);
+	}
+
+private:
+	static SlabPool& slab() {
+		static thread_local SlabPool* pool = new SlabPool(sizeof(T) < alignof(std::max_align_t) ? alignof(std::max_align_t)
+			: (sizeof(T) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t), 64);
+		return *pool;
+	}
+};
+
+#endif // BUFFERPOOL_HPP
@@ -0,0 +1,235 @@
+#ifndef LOG_HPP
+#define LOG_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+/* 	Asynchronous logger, header only so every server can include it.
+	LOG_TRACE..LOG_ERROR below LOG_LEVEL (a compile time constant, -DLOG_LEVEL=LOG_LEVEL_DEBUG)
+	are dead code: the arguments are not even evaluated. An enabled call formats on the
+	caller's stack and copies the line into the calling thread's ring buffer (single
+	producer, single consumer, two atomics, no lock); a background thread drains every ring
+	in batches with one write(2). When a ring is full the line is dropped and counted, the
+	hot path never waits for the terminal or the disk. Lines from one thread stay in order,
+	lines from different threads are merged per batch. */
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_OFF 5
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_AT(lvl, ...) do { if ((lvl) >= LOG_LEVEL && (lvl) >= Logger::instance().level()) { Logger::instance().write((lvl), __VA_ARGS__); } } while (0)
+#define LOG_TRACE(...) LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+const size_t K_LOG_RING_SIZE = 1 << 20;																			// 	Per thread, power of two
+const size_t K_LOG_MAX_LINE = 512;																				// 	Longer lines (payload dumps) are cut
+const int K_LOG_DRAIN_MS = 5;																					// 	Background thread period while there is nothing to write
+
+class Logger {
+public:
+	static Logger& instance() {
+		static Logger logger;																					// 	Destroyed at exit: stops the thread and writes what is left
+		return logger;
+	}
+
+	int level() const { return level_.load(std::memory_order_relaxed); }
+	void setLevel(int level) { level_.store(level, std::memory_order_relaxed); }							// 	Runtime threshold on top of LOG_LEVEL
+	void setFd(int fd) { fd_.store(fd, std::memory_order_relaxed); }											// 	Default stderr
+	uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+	__attribute__((format(printf, 3, 4)))
+	void write(int level, const char* fmt, ...) {
+		Record rec;
+		rec.level = (uint32_t)level;
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME_COARSE, &ts);																// 	vDSO, no syscall
+		rec.ns = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+		char line[K_LOG_MAX_LINE];
+		va_list args;
+		va_start(args, fmt);
+		int n = vsnprintf(line, sizeof(line), fmt, args);
+		va_end(args);
+		if (n < 0) { return; }
+		rec.len = (uint32_t)((size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1);
+		while (rec.len > 0 && line[rec.len - 1] == '\n') { rec.len--; }										// 	The drain adds the newline
+		if (!ring()->push(rec, line)) { dropped_.fetch_add(1, std::memory_order_relaxed); }
+	}
+
+	// Write everything logged so far, from any thread (die(), tests)
+	void flush() {
+		std::lock_guard<std::mutex> lock(drain_mutex_);
+		drain();
+	}
+
+private:
+	struct Record {
+		uint32_t len;
+		uint32_t level;
+		int64_t ns;
+	};
+
+	/* 	Byte ring of [Record][text] entries, 8 byte aligned. head is only written by the
+		owning thread, tail only by the drain: release/acquire on them is all the sync. */
+	struct Ring {
+		std::atomic<uint64_t> head{0};
+		std::atomic<uint64_t> tail{0};
+		int tid = 0;
+		char data[K_LOG_RING_SIZE];
+
+		static size_t entrySize(uint32_t len) { return (sizeof(Record) + len + 7) & ~(size_t)7; }
+
+		bool push(const Record& rec, const char* text) {
+			uint64_t h = head.load(std::memory_order_relaxed);
+			uint64_t t = tail.load(std::memory_order_acquire);
+			size_t size = entrySize(rec.len);
+			size_t offset = h & (K_LOG_RING_SIZE - 1);
+			size_t pad = K_LOG_RING_SIZE - offset < size ? K_LOG_RING_SIZE - offset : 0;					// 	Entries never wrap, skip the end of the ring instead
+			if (h + pad + size - t > K_LOG_RING_SIZE) { return false; }
+			if (pad) {
+				if (pad >= sizeof(uint32_t)) { uint32_t skip = UINT32_MAX; memcpy(data + offset, &skip, sizeof(skip)); }
+				h += pad;
+				offset = 0;
+			}
+			memcpy(data + offset, &rec, sizeof(rec));
+			memcpy(data + offset + sizeof(rec), text, rec.len);
+			head.store(h + size, std::memory_order_release);
+			return true;
+		}
+	};
+
+	Logger() : thread_([this] { run(); }) {
+	}
+
+	~Logger() {
+		{
+			std::lock_guard<std::mutex> lock(stop_mutex_);
+			stop_ = true;
+		}
+		stop_cv_.notify_one();
+		thread_.join();
+		flush();
+	}
+
+	Ring* ring() {
+		static thread_local Ring* ring = nullptr;
+		if (!ring) {
+			ring = new Ring();																					// 	Never freed: the drain may still read it after the thread exits
+			ring->tid = (int)syscall(SYS_gettid);
+			std::lock_guard<std::mutex> lock(rings_mutex_);
+			rings_.push_back(ring);
+		}
+		return ring;
+	}
+
+	void run() {
+		std::unique_lock<std::mutex> lock(stop_mutex_);
+		while (!stop_) {
+			lock.unlock();
+			bool wrote;
+			{
+				std::lock_guard<std::mutex> drain_lock(drain_mutex_);
+				wrote = drain();
+			}
+			lock.lock();
+			if (!wrote) { stop_cv_.wait_for(lock, std::chrono::milliseconds(K_LOG_DRAIN_MS)); }
+		}
+	}
+
+	// Move every complete entry of every ring to out_ and write it, true when something was written
+	bool drain() {
+		std::vector<Ring*> rings;
+		{
+			std::lock_guard<std::mutex> lock(rings_mutex_);
+			rings = rings_;
+		}
+		static const char* const K_NAMES[] = {"TRACE", "DEBUG", "INFO ", "WARN ", "ERROR"};
+		bool wrote = false;
+		for (Ring* ring : rings) {
+			uint64_t t = ring->tail.load(std::memory_order_relaxed);
+			uint64_t h = ring->head.load(std::memory_order_acquire);
+			while (t < h) {
+				size_t offset = t & (K_LOG_RING_SIZE - 1);
+				uint32_t len;
+				memcpy(&len, ring->data + offset, sizeof(len));
+				if (K_LOG_RING_SIZE - offset < sizeof(Record) || len == UINT32_MAX) {							// 	Padding up to the end of the ring
+					t += K_LOG_RING_SIZE - offset;
+					continue;
+				}
+				Record rec;
+				memcpy(&rec, ring->data + offset, sizeof(rec));
+				time_t secs = (time_t)(rec.ns / 1000000000);
+				struct tm tm;
+				localtime_r(&secs, &tm);
+				char prefix[64];
+				int n = snprintf(prefix, sizeof(prefix), "%02d:%02d:%02d.%06d %s [%d] ", tm.tm_hour, tm.tm_min, tm.tm_sec,
+					(int)(rec.ns % 1000000000 / 1000), K_NAMES[rec.level < 5 ? rec.level : 4], ring->tid);
+				if (out_.size() + n + rec.len + 1 > K_LOG_RING_SIZE) { writeOut(); }
+				out_.insert(out_.end(), prefix, prefix + n);
+				out_.insert(out_.end(), ring->data + offset + sizeof(rec), ring->data + offset + sizeof(rec) + rec.len);
+				out_.push_back('\n');
+				t += Ring::entrySize(rec.len);
+			}
+			ring->tail.store(t, std::memory_order_release);
+		}
+		uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+		if (dropped != reported_dropped_) {
+			char note[64];
+			int n = snprintf(note, sizeof(note), "log: %llu lines dropped\n", (unsigned long long)(dropped - reported_dropped_));
+			out_.insert(out_.end(), note, note + n);
+			reported_dropped_ = dropped;
+		}
+		if (!out_.empty()) {
+			writeOut();
+			wrote = true;
+		}
+		return wrote;
+	}
+
+	void writeOut() {
+		size_t off = 0;
+		int fd = fd_.load(std::memory_order_relaxed);
+		while (off < out_.size()) {
+			ssize_t rv = ::write(fd, out_.data() + off, out_.size() - off);
+			if (rv <= 0) { break; }																			// 	Nowhere to write, drop the batch
+			off += (size_t)rv;
+		}
+		out_.clear();
+	}
+
+	std::atomic<int> level_{LOG_LEVEL};
+	std::atomic<int> fd_{STDERR_FILENO};
+	std::atomic<uint64_t> dropped_{0};
+	uint64_t reported_dropped_ = 0;
+	std::mutex rings_mutex_;																					// 	Only taken when a thread logs for the first time
+	std::vector<Ring*> rings_;
+	std::mutex drain_mutex_;
+	std::vector<char> out_;
+	std::mutex stop_mutex_;
+	std::condition_variable stop_cv_;
+	bool stop_ = false;
+	std::thread thread_;																						// 	Last member, starts once the rest is built
+};
+
+#endif // LOG_HPP
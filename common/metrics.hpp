@@ -0,0 +1,211 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+/* 	Counters and latency histograms, header only so both servers can use it.
+	Every thread writes its own block (a plain load + store on relaxed atomics, no lock
+	prefix, no shared cache line); a scrape walks all the blocks and sums them, so the hot
+	path never synchronises with the reader. Histograms are HDR style: 32 linear sub-buckets
+	per power of two, about 3% relative error from 1 ns to 18 minutes in 9 KB. */
+
+enum MetricCounter {
+	M_ACCEPTS,
+	M_CLOSES,
+	M_TIMEOUTS,
+	M_READS,
+	M_BYTES_IN,
+	M_WRITES,
+	M_BYTES_OUT,
+	M_WRITE_STALLS,																								// 	Write that hit EAGAIN, the peer is slower than us
+	M_REQUESTS,
+	M_ERRORS,																									// 	Malformed requests
+	M_REJECTS,																									// 	Connections or requests shed by admission control
+	M_CACHE_HITS,																								// 	Responses served from the HTTP response cache (304s included)
+	M_CACHE_MISSES,
+	M_OFFLOADS,																									// 	Requests whose handler ran on the WorkerPool (blocking routes)
+	M_COUNTER_COUNT
+};
+
+enum MetricHistogram {
+	H_PARSE_NS,
+	H_HANDLER_NS,
+	H_READY_EVENTS,																								// 	Fds returned by one poll/epoll_wait, the depth of the ready queue
+	H_HISTOGRAM_COUNT
+};
+
+const int K_HIST_SUB_BITS = 5;
+const int K_HIST_MAX_BITS = 40;
+const size_t K_HIST_BUCKETS = (size_t)(K_HIST_MAX_BITS - K_HIST_SUB_BITS + 1) << K_HIST_SUB_BITS;
+
+inline size_t hist_bucket(uint64_t v) {
+	if (v < ((uint64_t)1 << K_HIST_SUB_BITS)) { return (size_t)v; }											// 	Small values are exact
+	int msb = 63 - __builtin_clzll(v);
+	if (msb >= K_HIST_MAX_BITS) { return K_HIST_BUCKETS - 1; }
+	uint64_t sub = (v >> (msb - K_HIST_SUB_BITS)) - ((uint64_t)1 << K_HIST_SUB_BITS);
+	return ((size_t)(msb - K_HIST_SUB_BITS + 1) << K_HIST_SUB_BITS) + (size_t)sub;
+}
+
+// Middle of the values that fall in bucket i
+inline uint64_t hist_value(size_t i) {
+	if (i < ((size_t)1 << K_HIST_SUB_BITS)) { return i; }
+	int msb = (int)(i >> K_HIST_SUB_BITS) + K_HIST_SUB_BITS - 1;
+	uint64_t sub = i & (((size_t)1 << K_HIST_SUB_BITS) - 1);
+	uint64_t low = (((uint64_t)1 << K_HIST_SUB_BITS) + sub) << (msb - K_HIST_SUB_BITS);
+	return low + (((uint64_t)1 << (msb - K_HIST_SUB_BITS)) >> 1);
+}
+
+inline uint64_t metrics_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);																		// 	vDSO, about 20 ns
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+// Merged view of every thread, what a scrape returns
+struct HistogramSnapshot {
+	uint64_t count = 0;
+	uint64_t sum = 0;
+	uint64_t max = 0;
+	std::vector<uint64_t> buckets = std::vector<uint64_t>(K_HIST_BUCKETS);
+
+	uint64_t percentile(double p) const {
+		if (count == 0) { return 0; }
+		uint64_t rank = (uint64_t)(p / 100.0 * (double)count + 0.5);
+		if (rank == 0) { rank = 1; }
+		uint64_t seen = 0;
+		for (size_t i = 0; i < K_HIST_BUCKETS; i++) {
+			seen += buckets[i];
+			if (seen >= rank) { return hist_value(i) < max ? hist_value(i) : max; }
+		}
+		return max;
+	}
+};
+
+struct MetricsSnapshot {
+	uint64_t counters[M_COUNTER_COUNT] = {};
+	HistogramSnapshot histograms[H_HISTOGRAM_COUNT];
+
+	// Prometheus text exposition, every name starts with prefix ("http", "kv")
+	std::string render(const char* prefix) const {
+		static const char* const K_COUNTERS[] = {"accepts_total", "closes_total", "timeouts_total", "reads_total", "bytes_in_total",
+			"writes_total", "bytes_out_total", "write_stalls_total", "requests_total", "errors_total",
+			"rejects_total", "cache_hits_total", "cache_misses_total", "offloads_total"};
+		static const char* const K_HISTOGRAMS[] = {"parse_seconds", "handler_seconds", "ready_events"};
+		static const double K_QUANTILES[] = {50, 90, 99, 99.9, 99.99};
+		std::string out;
+		char line[256];
+		for (int c = 0; c < M_COUNTER_COUNT; c++) {
+			snprintf(line, sizeof(line), "# TYPE %s_%s counter\n%s_%s %llu\n", prefix, K_COUNTERS[c], prefix, K_COUNTERS[c],
+				(unsigned long long)counters[c]);
+			out += line;
+		}
+		snprintf(line, sizeof(line), "# TYPE %s_open_connections gauge\n%s_open_connections %lld\n", prefix, prefix,
+			(long long)(counters[M_ACCEPTS] - counters[M_CLOSES]));
+		out += line;
+		for (int h = 0; h < H_HISTOGRAM_COUNT; h++) {
+			const HistogramSnapshot& hist = histograms[h];
+			double scale = h == H_READY_EVENTS ? 1.0 : 1e-9;													// 	Latencies are recorded in ns, shown in seconds
+			snprintf(line, sizeof(line), "# TYPE %s_%s summary\n", prefix, K_HISTOGRAMS[h]);
+			out += line;
+			for (double q : K_QUANTILES) {
+				snprintf(line, sizeof(line), "%s_%s{quantile=\"%g\"} %.9g\n", prefix, K_HISTOGRAMS[h], q / 100.0,
+					(double)hist.percentile(q) * scale);
+				out += line;
+			}
+			snprintf(line, sizeof(line), "%s_%s_max %.9g\n%s_%s_sum %.9g\n%s_%s_count %llu\n", prefix, K_HISTOGRAMS[h],
+				(double)hist.max * scale, prefix, K_HISTOGRAMS[h], (double)hist.sum * scale, prefix, K_HISTOGRAMS[h],
+				(unsigned long long)hist.count);
+			out += line;
+		}
+		return out;
+	}
+};
+
+class Metrics {
+public:
+	// The calling thread's block, registered on first use and never freed (a scrape may still read it)
+	static Metrics& local() {
+		static thread_local Metrics* block = nullptr;
+		if (!block) {
+			block = new Metrics();
+			std::lock_guard<std::mutex> lock(registry_mutex());
+			registry().push_back(block);
+		}
+		return *block;
+	}
+
+	void add(MetricCounter c, uint64_t n = 1) {
+		bump(counters_[c], n);																					// 	Single writer: no atomic read-modify-write needed
+	}
+
+	void record(MetricHistogram h, uint64_t value) {
+		Histogram& hist = histograms_[h];
+		bump(hist.buckets[hist_bucket(value)], 1);
+		bump(hist.count, 1);
+		bump(hist.sum, value);
+		if (value > hist.max.load(std::memory_order_relaxed)) { hist.max.store(value, std::memory_order_relaxed); }
+	}
+
+	static MetricsSnapshot scrape() {
+		std::vector<Metrics*> blocks;
+		{
+			std::lock_guard<std::mutex> lock(registry_mutex());
+			blocks = registry();
+		}
+		MetricsSnapshot snap;
+		for (const Metrics* block : blocks) {
+			for (int c = 0; c < M_COUNTER_COUNT; c++) {
+				snap.counters[c] += block->counters_[c].load(std::memory_order_relaxed);
+			}
+			for (int h = 0; h < H_HISTOGRAM_COUNT; h++) {
+				const Histogram& from = block->histograms_[h];
+				HistogramSnapshot& to = snap.histograms[h];
+				for (size_t i = 0; i < K_HIST_BUCKETS; i++) {
+					to.buckets[i] += from.buckets[i].load(std::memory_order_relaxed);
+				}
+				to.count += from.count.load(std::memory_order_relaxed);
+				to.sum += from.sum.load(std::memory_order_relaxed);
+				uint64_t max = from.max.load(std::memory_order_relaxed);
+				if (max > to.max) { to.max = max; }
+			}
+		}
+		return snap;
+	}
+
+private:
+	struct Histogram {
+		std::atomic<uint64_t> buckets[K_HIST_BUCKETS] = {};
+		std::atomic<uint64_t> count{0};
+		std::atomic<uint64_t> sum{0};
+		std::atomic<uint64_t> max{0};
+	};
+
+	Metrics() = default;
+
+	static void bump(std::atomic<uint64_t>& v, uint64_t n) {
+		v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	static std::vector<Metrics*>& registry() {
+		static std::vector<Metrics*>* blocks = new std::vector<Metrics*>();
+		return *blocks;
+	}
+
+	static std::mutex& registry_mutex() {
+		static std::mutex* mutex = new std::mutex();
+		return *mutex;
+	}
+
+	alignas(64) std::atomic<uint64_t> counters_[M_COUNTER_COUNT] = {};
+	Histogram histograms_[H_HISTOGRAM_COUNT];
+};
+
+#endif // METRICS_HPP
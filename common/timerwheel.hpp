@@ -0,0 +1,141 @@
+#ifndef TIMERWHEEL_HPP
+#define TIMERWHEEL_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+/* 	Hashed timing wheel for connection timeouts, header only so both servers can use it.
+	Time is cut in ticks of tickMs, a timer due at tick t sits in slot t % K_WHEEL_SLOTS, in
+	a doubly linked list threaded through the TimerNode embedded in the owner. Arm, re-arm
+	and cancel are an unlink and a push: O(1), no allocation. Timers further away than one
+	turn of the wheel simply stay in their slot until their tick comes round.
+	A bitmap of the non empty slots lets the event loop sleep exactly until the next slot
+	that holds something instead of waking every tick. */
+
+const size_t K_WHEEL_SLOTS = 1024;																				// 	Power of two, one turn is 1024 ticks
+
+struct TimerNode {
+	TimerNode* prev = nullptr;
+	TimerNode* next = nullptr;
+	uint64_t expires = 0;																						// 	Tick at which it fires
+	uint32_t slot = 0;
+	bool armed = false;
+	void* data = nullptr;																						// 	Owner, handed back on expiry
+};
+
+class TimerWheel {
+public:
+	explicit TimerWheel(uint32_t tickMs = 10) : tick_ms_(tickMs ? tickMs : 1) {
+	}
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator=(const TimerWheel&) = delete;
+
+	// First call fixes the wheel's origin, nowMs is any monotonic millisecond clock
+	void start(int64_t nowMs) {
+		current_ = (uint64_t)nowMs / tick_ms_;
+		started_ = true;
+	}
+
+	// (Re)arm t to fire delayMs after nowMs, rounded up to the next tick
+	void arm(TimerNode* t, int64_t nowMs, uint32_t delayMs) {
+		if (!started_) { start(nowMs); }
+		cancel(t);
+		uint64_t due = ((uint64_t)nowMs + delayMs + tick_ms_ - 1) / tick_ms_;
+		if (due <= current_) { due = current_ + 1; }															// 	The current tick was already processed
+		t->expires = due;
+		link(t, (uint32_t)(due & (K_WHEEL_SLOTS - 1)));
+		count_++;
+	}
+
+	void cancel(TimerNode* t) {
+		if (!t->armed) { return; }
+		unlink(t);
+		count_--;
+	}
+
+	size_t size() const {
+		return count_;
+	}
+
+	// Fire every timer due up to nowMs, onExpire(TimerNode*) may arm or cancel any timer (and free t)
+	template <class F>
+	void advance(int64_t nowMs, F&& onExpire) {
+		if (!started_) { start(nowMs); }
+		uint64_t target = (uint64_t)nowMs / tick_ms_;
+		while (current_ < target && count_ > 0) {
+			uint64_t tick = current_ + 1;
+			if (target - current_ > K_WHEEL_SLOTS) {
+				tick = next_busy_tick(target);																	// 	Long sleep: jump straight to the slots that hold something
+			}
+			current_ = tick;
+			uint32_t slot = (uint32_t)(tick & (K_WHEEL_SLOTS - 1));
+			while (TimerNode* t = slots_[slot]) {																// 	Move the slot to the expiring list first, callbacks may arm into it
+				unlink(t);
+				link(t, K_WHEEL_SLOTS);
+			}
+			while (TimerNode* t = slots_[K_WHEEL_SLOTS]) {
+				if (t->expires > tick) {
+					unlink(t);
+					link(t, slot);																				// 	Due on a later turn
+					continue;
+				}
+				unlink(t);
+				count_--;
+				onExpire(t);
+			}
+		}
+		if (current_ < target) { current_ = target; }
+	}
+
+	// Milliseconds until the next non empty slot may expire, -1 when nothing is armed (block forever)
+	int nextTimeoutMs(int64_t nowMs) const {
+		if (count_ == 0) { return -1; }
+		uint64_t now_tick = (uint64_t)nowMs / tick_ms_;
+		uint64_t due = next_busy_tick(current_ + K_WHEEL_SLOTS);
+		if (due <= now_tick) { return 0; }
+		uint64_t ms = due * tick_ms_ - (uint64_t)nowMs;
+		return ms > 0x7fffffff ? 0x7fffffff : (int)ms;
+	}
+
+private:
+	// First tick after current_ whose slot is non empty (at most one turn ahead), limit if none
+	uint64_t next_busy_tick(uint64_t limit) const {
+		uint64_t tick = current_ + 1;
+		for (size_t scanned = 0; scanned < K_WHEEL_SLOTS && tick <= limit; ) {
+			size_t slot = tick & (K_WHEEL_SLOTS - 1);
+			uint64_t word = busy_[slot / 64] >> (slot % 64);
+			if (word & 1) { return tick; }
+			size_t skip = word ? __builtin_ctzll(word) : 64 - slot % 64;										// 	Skip the empty slots of this bitmap word at once
+			tick += skip;
+			scanned += skip;
+		}
+		return limit;
+	}
+
+	void link(TimerNode* t, uint32_t slot) {
+		t->slot = slot;
+		t->prev = nullptr;
+		t->next = slots_[slot];
+		if (t->next) { t->next->prev = t; }
+		slots_[slot] = t;
+		t->armed = true;
+		if (slot < K_WHEEL_SLOTS) { busy_[slot / 64] |= (uint64_t)1 << (slot % 64); }
+	}
+
+	void unlink(TimerNode* t) {
+		if (t->prev) { t->prev->next = t->next; } else { slots_[t->slot] = t->next; }
+		if (t->next) { t->next->prev = t->prev; }
+		t->prev = t->next = nullptr;
+		t->armed = false;
+		if (t->slot < K_WHEEL_SLOTS && !slots_[t->slot]) { busy_[t->slot / 64] &= ~((uint64_t)1 << (t->slot % 64)); }
+	}
+
+	uint32_t tick_ms_;
+	uint64_t current_ = 0;																						// 	Last tick processed
+	bool started_ = false;
+	size_t count_ = 0;
+	TimerNode* slots_[K_WHEEL_SLOTS + 1] = {};																	// 	The extra slot holds the timers being expired
+	uint64_t busy_[K_WHEEL_SLOTS / 64] = {};
+};
+
+#endif // TIMERWHEEL_HPP
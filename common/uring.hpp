@@ -0,0 +1,298 @@
+#ifndef URING_HPP
+#define URING_HPP
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* 	Minimal io_uring over the raw syscalls (no liburing), header only so both servers can use it.
+	The submission and completion rings are shared with the kernel: an SQE is queued by writing
+	it and bumping the SQ tail, a completion is read by walking the CQ from head to tail, and one
+	io_uring_enter() both submits everything queued and waits for the next completions. Reads
+	use a provided buffer ring: the kernel picks a free buffer per completion (a multishot recv
+	returns one CQE per chunk received without being resubmitted) and we give it back with
+	recycle() once its bytes are copied out.
+	Needs Linux 6.0 (multishot recv); supported() probes the running kernel once so callers can
+	fall back to epoll/poll instead of failing later. */
+
+const unsigned K_URING_ENTRIES = 1024;																			// 	SQ size, the CQ gets twice that
+const uint16_t K_URING_BUF_GROUP = 0;
+
+class Uring {
+public:
+	Uring() = default;
+	Uring(const Uring&) = delete;
+	Uring& operator=(const Uring&) = delete;
+
+	~Uring() {
+		if (bufs_) { munmap(bufs_, (size_t)buf_count_ * buf_size_); }
+		if (buf_ring_) { munmap(buf_ring_, buf_ring_bytes_); }
+		if (sqes_) { munmap(sqes_, sqes_bytes_); }
+		if (ring_ptr_) { munmap(ring_ptr_, ring_bytes_); }
+		if (fd_ >= 0) { close(fd_); }																			// 	Cancels whatever is still in flight
+	}
+
+	// True when the kernel has everything the servers use, probed once per process
+	static bool supported() {
+		static const bool ok = probe();
+		return ok;
+	}
+
+	// Create the rings, false (errno set) when io_uring is missing, disabled or too old
+	bool init(unsigned entries = K_URING_ENTRIES) {
+		struct io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		p.flags = IORING_SETUP_COOP_TASKRUN;																		// 	Completions are run when we enter, not by interrupting the reactor
+		fd_ = (int)syscall(__NR_io_uring_setup, entries, &p);
+		if (fd_ < 0 && errno == EINVAL) {
+			memset(&p, 0, sizeof(p));
+			fd_ = (int)syscall(__NR_io_uring_setup, entries, &p);
+		}
+		if (fd_ < 0) { return false; }
+		if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP)) {
+			errno = ENOSYS;
+			return false;
+		}
+		ring_bytes_ = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+		size_t cq_bytes = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+		if (cq_bytes > ring_bytes_) { ring_bytes_ = cq_bytes; }
+		ring_ptr_ = mmap(NULL, ring_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+		if (ring_ptr_ == MAP_FAILED) { ring_ptr_ = NULL; return false; }
+		sqes_bytes_ = p.sq_entries * sizeof(struct io_uring_sqe);
+		sqes_ = (struct io_uring_sqe*)mmap(NULL, sqes_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+		if (sqes_ == MAP_FAILED) { sqes_ = NULL; return false; }
+
+		char* base = (char*)ring_ptr_;
+		sq_head_ = (unsigned*)(base + p.sq_off.head);
+		sq_tail_ = (unsigned*)(base + p.sq_off.tail);
+		sq_mask_ = *(unsigned*)(base + p.sq_off.ring_mask);
+		sq_entries_ = p.sq_entries;
+		unsigned* array = (unsigned*)(base + p.sq_off.array);
+		for (unsigned i = 0; i < sq_entries_; i++) {
+			array[i] = i;																						// 	Identity: SQE i always sits in slot i
+		}
+		cq_head_ = (unsigned*)(base + p.cq_off.head);
+		cq_tail_ = (unsigned*)(base + p.cq_off.tail);
+		cq_mask_ = *(unsigned*)(base + p.cq_off.ring_mask);
+		cqes_ = (struct io_uring_cqe*)(base + p.cq_off.cqes);
+		sqe_tail_ = *sq_tail_;
+		return true;
+	}
+
+	/* 	Register count buffers of size bytes as group K_URING_BUF_GROUP (count a power of two),
+		for recv with IOSQE_BUFFER_SELECT. */
+	bool setupBuffers(unsigned count, unsigned size) {
+		buf_ring_bytes_ = count * sizeof(struct io_uring_buf);
+		void* ring = mmap(NULL, buf_ring_bytes_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ring == MAP_FAILED) { return false; }
+		buf_ring_ = (struct io_uring_buf_ring*)ring;
+		memset(ring, 0, buf_ring_bytes_);
+		void* bufs = mmap(NULL, (size_t)count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (bufs == MAP_FAILED) { return false; }
+		bufs_ = (uint8_t*)bufs;
+		buf_count_ = count;
+		buf_size_ = size;
+		struct io_uring_buf_reg reg;
+		memset(&reg, 0, sizeof(reg));
+		reg.ring_addr = (uint64_t)(uintptr_t)buf_ring_;
+		reg.ring_entries = count;
+		reg.bgid = K_URING_BUF_GROUP;
+		if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) { return false; }
+		for (unsigned i = 0; i < count; i++) {
+			recycle((uint16_t)i);
+		}
+		return true;
+	}
+
+	const uint8_t* buffer(uint16_t bid) const {
+		return bufs_ + (size_t)bid * buf_size_;
+	}
+
+	// Hand a provided buffer back to the kernel once its bytes were consumed
+	void recycle(uint16_t bid) {
+		struct io_uring_buf* buf = (struct io_uring_buf*)buf_ring_ + (buf_tail_ & (buf_count_ - 1));				// 	Not ->bufs: in C++ the header's flex array sits 8 bytes too far
+		buf->addr = (uint64_t)(uintptr_t)buffer(bid);
+		buf->len = buf_size_;
+		buf->bid = bid;
+		buf_tail_++;
+		__atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+	}
+
+	// Make sure the next n SQEs fit without a flush in between: a link chain must reach the kernel whole
+	void reserve(unsigned n) {
+		while (sq_entries_ - (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE)) < n) {
+			enter(0, 0);
+		}
+	}
+
+	// Next free SQE, zeroed, flushing the queue to the kernel when it is full
+	struct io_uring_sqe* sqe() {
+		while (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+			enter(0, 0);																						// 	EAGAIN/EBUSY: the kernel is short of memory or CQ room, try again
+		}
+		struct io_uring_sqe* e = &sqes_[sqe_tail_ & sq_mask_];
+		memset(e, 0, sizeof(*e));
+		sqe_tail_++;
+		__atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+		return e;
+	}
+
+	void prepAcceptMultishot(int fd, uint64_t userData) {
+		struct io_uring_sqe* e = sqe();
+		e->opcode = IORING_OP_ACCEPT;
+		e->fd = fd;
+		e->ioprio = IORING_ACCEPT_MULTISHOT;																	// 	One SQE, a CQE per accepted connection
+		e->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+		e->user_data = userData;
+	}
+
+	void prepRecvMultishot(int fd, uint64_t userData) {
+		struct io_uring_sqe* e = sqe();
+		e->opcode = IORING_OP_RECV;
+		e->fd = fd;
+		e->ioprio = IORING_RECV_MULTISHOT;																		// 	A CQE per chunk received, until error, EOF or no buffer left
+		e->flags = IOSQE_BUFFER_SELECT;
+		e->buf_group = K_URING_BUF_GROUP;
+		e->user_data = userData;
+	}
+
+	// link: the next SQE only starts once this one completed in full (MSG_WAITALL), and is cancelled if it did not
+	void prepSendmsg(int fd, const struct msghdr* msg, bool link, uint64_t userData) {
+		struct io_uring_sqe* e = sqe();
+		e->opcode = IORING_OP_SENDMSG;
+		e->fd = fd;
+		e->addr = (uint64_t)(uintptr_t)msg;
+		e->len = 1;
+		e->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+		if (link) { e->flags = IOSQE_IO_LINK; }
+		e->user_data = userData;
+	}
+
+	void prepRead(int fd, void* buf, unsigned len, uint64_t userData) {
+		struct io_uring_sqe* e = sqe();
+		e->opcode = IORING_OP_READ;
+		e->fd = fd;
+		e->addr = (uint64_t)(uintptr_t)buf;
+		e->len = len;
+		e->off = (uint64_t)-1;																					// 	Current position, what an eventfd or socket expects
+		e->user_data = userData;
+	}
+
+	void prepPollAdd(int fd, unsigned events, uint64_t userData) {
+		struct io_uring_sqe* e = sqe();
+		e->opcode = IORING_OP_POLL_ADD;
+		e->fd = fd;
+		e->poll32_events = events;
+		e->user_data = userData;
+	}
+
+	void prepCancel(uint64_t target, uint64_t userData) {
+		struct io_uring_sqe* e = sqe();
+		e->opcode = IORING_OP_ASYNC_CANCEL;
+		e->addr = target;
+		e->user_data = userData;
+	}
+
+	/* 	Submit everything queued and wait for at least one completion or timeoutNs (< 0 waits
+		forever, 0 only submits): one syscall per event loop turn. 0, or -errno; -ETIME and -EINTR
+		just mean "nothing yet". */
+	int submitAndWait(int64_t timeoutNs) {
+		struct __kernel_timespec ts;
+		struct io_uring_getevents_arg arg;
+		memset(&arg, 0, sizeof(arg));
+		arg.sigmask_sz = _NSIG / 8;
+		if (timeoutNs >= 0) {
+			ts.tv_sec = timeoutNs / 1000000000;
+			ts.tv_nsec = timeoutNs % 1000000000;
+			arg.ts = (uint64_t)(uintptr_t)&ts;
+		}
+		unsigned wait = timeoutNs == 0 ? 0 : 1;
+		if (wait && cqReady()) { wait = 0; }																	// 	Completions already waiting (a full SQ flushed them), don't sleep
+		int rv = enter(wait, IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+		return rv < 0 ? -errno : 0;
+	}
+
+	// Call onCqe(const io_uring_cqe&) for every completion ready, in order, returns how many
+	template <class F>
+	unsigned drain(F&& onCqe) {
+		unsigned head = *cq_head_;
+		unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+		unsigned n = 0;
+		while (head != tail) {
+			struct io_uring_cqe cqe = cqes_[head & cq_mask_];													// 	Copied: the slot is handed back before onCqe may queue more work
+			head++;
+			__atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+			onCqe(cqe);
+			n++;
+			if (head == tail) { tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE); }
+		}
+		return n;
+	}
+
+private:
+	int enter(unsigned waitNr, unsigned flags, const void* arg = NULL, size_t argSize = 0) {
+		unsigned toSubmit = sqe_tail_ - submitted_;
+		if (waitNr) { flags |= IORING_ENTER_GETEVENTS; }
+		if (!toSubmit && !waitNr) { return 0; }
+		int rv = (int)syscall(__NR_io_uring_enter, fd_, toSubmit, waitNr, flags, arg, argSize);
+		if (rv > 0) { submitted_ += (unsigned)rv; }
+		return rv;
+	}
+
+	bool cqReady() const {
+		return *cq_head_ != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+	}
+
+	/* 	Throwaway ring: register a buffer ring, then check that a multishot recv on a socketpair
+		delivers data and stays armed (6.0+; older kernels reject the flag with -EINVAL). */
+	static bool probe() {
+		Uring ring;
+		if (!ring.init(8) || !ring.setupBuffers(2, 64)) { return false; }
+		int sv[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv)) { return false; }
+		ring.prepRecvMultishot(sv[0], 1);
+		bool ok = write(sv[1], "x", 1) == 1;
+		int res = -1;
+		uint32_t flags = 0;
+		while (ok && res == -1) {
+			if (ring.submitAndWait(1000000000) == -ETIME) { ok = false; }
+			ring.drain([&](const struct io_uring_cqe& cqe) { res = cqe.res; flags = cqe.flags; });
+		}
+		close(sv[0]);
+		close(sv[1]);
+		return ok && res == 1 && (flags & IORING_CQE_F_BUFFER) && (flags & IORING_CQE_F_MORE);
+	}
+
+	int fd_ = -1;
+	void* ring_ptr_ = NULL;
+	size_t ring_bytes_ = 0;
+	struct io_uring_sqe* sqes_ = NULL;
+	size_t sqes_bytes_ = 0;
+	unsigned* sq_head_ = NULL;
+	unsigned* sq_tail_ = NULL;
+	unsigned sq_mask_ = 0;
+	unsigned sq_entries_ = 0;
+	unsigned sqe_tail_ = 0;																						// 	Our copy of the SQ tail
+	unsigned submitted_ = 0;																					// 	SQEs the kernel consumed
+	unsigned* cq_head_ = NULL;
+	unsigned* cq_tail_ = NULL;
+	unsigned cq_mask_ = 0;
+	struct io_uring_cqe* cqes_ = NULL;
+	struct io_uring_buf_ring* buf_ring_ = NULL;
+	size_t buf_ring_bytes_ = 0;
+	uint8_t* bufs_ = NULL;
+	unsigned buf_count_ = 0;
+	unsigned buf_size_ = 0;
+	uint16_t buf_tail_ = 0;
+};
+
+#endif // URING_HPP
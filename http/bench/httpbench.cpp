@@ -0,0 +1,522 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "metrics.hpp"																	// 	Same HDR style histogram as the server's /metrics
+
+/* 	HTTPBench: wrk style load generator for HTTPServer.
+	Every thread runs its own edge-triggered epoll loop over its share of the connections and
+	keeps up to --pipeline requests in flight on each of them. Without --rate the test is
+	closed loop (a connection sends as soon as a response comes back) and the latencies are
+	corrected afterwards for coordinated omission with the mean latency as expected interval,
+	like HdrHistogram does. With --rate every request gets an intended send time on a fixed
+	schedule and its latency is measured from that time, so a stalled server is charged for
+	every request it kept the client from sending (wrk2 style). */
+
+struct BenchConfig {
+	std::string host = "127.0.0.1";
+	int port = 1234;
+	std::vector<std::string> paths;																// 	Rotated per request
+	std::string method = "GET";
+	std::vector<std::string> headers;
+	std::string body;
+	int connections = 10;
+	int threads = 2;
+	int pipeline = 1;
+	double duration_s = 10;
+	uint64_t requests = 0;																		// 	Stop after this many responses instead of after duration_s
+	double rate = 0;																			// 	Requests per second over all connections, 0 means closed loop
+	int timeout_ms = 2000;
+};
+
+struct BenchConn {
+	int fd = -1;
+	std::string out;																			// 	Requests not written yet
+	size_t out_pos = 0;
+	std::string in;																				// 	Response bytes not parsed yet
+	std::deque<uint64_t> sent;																	// 	Send (or intended send) time of every request in flight, in order
+	bool in_body = false;
+	size_t body_left = 0;
+	bool close_after = false;																	// 	The current response carries "Connection: close"
+	uint64_t next_send_ns = 0;																	// 	Rate mode schedule
+	size_t next_template = 0;
+};
+
+struct BenchStats {
+	std::vector<uint64_t> buckets = std::vector<uint64_t>(K_HIST_BUCKETS);
+	uint64_t count = 0;
+	uint64_t sum = 0;
+	uint64_t max = 0;
+	uint64_t bytes_read = 0;
+	uint64_t errors_connect = 0;
+	uint64_t errors_read = 0;
+	uint64_t errors_write = 0;
+	uint64_t errors_status = 0;																	// 	Responses that are not 2xx/3xx
+	uint64_t errors_timeout = 0;																// 	Still in flight when the test ended
+
+	void record(uint64_t ns) {
+		buckets[hist_bucket(ns)]++;
+		count++;
+		sum += ns;
+		if (ns > max) { max = ns; }
+	}
+};
+
+static std::atomic<bool> g_stop{false};
+static std::atomic<int64_t> g_remaining{0};														// 	Requests left to send in --requests mode
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void usage(const char* argv0) {
+	fprintf(stderr,
+		"Usage: %s [options] http://host:port/path\n"
+		"  -c, --connections N   open connections (10)\n"
+		"  -t, --threads N       client threads (2)\n"
+		"  -p, --pipeline N      requests in flight per connection (1)\n"
+		"  -d, --duration S      test length in seconds (10)\n"
+		"  -n, --requests N      stop after N requests instead of a duration\n"
+		"  -R, --rate N          total requests/s, latency measured from the intended send time\n"
+		"  -m, --method M        request method (GET)\n"
+		"  -H, --header H        extra header line, repeatable\n"
+		"  -b, --body B          request body (a Content-Length is added)\n"
+		"  -P, --path P          extra request target, repeatable, targets are rotated\n"
+		"  -T, --timeout MS      how long to wait for in flight requests at the end (2000)\n", argv0);
+	exit(1);
+}
+
+static bool parse_url(const char* url, BenchConfig* cfg) {
+	const char* p = url;
+	if (strncmp(p, "http://", 7) == 0) { p += 7; }
+	const char* slash = strchr(p, '/');
+	std::string hostport = slash ? std::string(p, slash - p) : std::string(p);
+	size_t colon = hostport.rfind(':');
+	if (colon != std::string::npos) {
+		cfg->port = atoi(hostport.c_str() + colon + 1);
+		hostport.resize(colon);
+	} else {
+		cfg->port = 80;
+	}
+	if (hostport.empty() || cfg->port <= 0) { return false; }
+	cfg->host = hostport;
+	cfg->paths.insert(cfg->paths.begin(), slash ? std::string(slash) : std::string("/"));
+	return true;
+}
+
+// One complete request per target, sent as is: nothing is formatted on the hot path
+static std::vector<std::string> build_templates(const BenchConfig& cfg) {
+	std::vector<std::string> templates;
+	for (const std::string& path : cfg.paths) {
+		std::string req = cfg.method + " " + path + " HTTP/1.1\r\nHost: " + cfg.host + ":" + std::to_string(cfg.port) + "\r\n";
+		for (const std::string& header : cfg.headers) {
+			req += header + "\r\n";
+		}
+		if (!cfg.body.empty()) { req += "Content-Length: " + std::to_string(cfg.body.size()) + "\r\n"; }
+		req += "\r\n" + cfg.body;
+		templates.push_back(req);
+	}
+	return templates;
+}
+
+static int connect_to(const struct sockaddr_in& addr) {
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) { return -1; }
+	if (connect(fd, (const struct sockaddr*)&addr, sizeof(addr))) {								// 	Blocking connect, then non-blocking traffic
+		close(fd);
+		return -1;
+	}
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	return fd;
+}
+
+static size_t find_header_end(const std::string& buf, size_t from) {
+	size_t pos = buf.find("\r\n\r\n", from);
+	return pos == std::string::npos ? pos : pos + 4;
+}
+
+// Value of a header in [head, head + len), case-insensitive name, empty when missing
+static std::string header_value(const char* head, size_t len, const char* name) {
+	size_t name_len = strlen(name);
+	const char* end = head + len;
+	for (const char* line = head; line < end; ) {
+		const char* eol = (const char*)memchr(line, '\n', end - line);
+		if (!eol) { eol = end; }
+		if ((size_t)(eol - line) > name_len && strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+			const char* v = line + name_len + 1;
+			while (v < eol && (*v == ' ' || *v == '\t')) { v++; }
+			const char* ve = eol;
+			while (ve > v && (ve[-1] == '\r' || ve[-1] == ' ')) { ve--; }
+			return std::string(v, ve - v);
+		}
+		line = eol + 1;
+	}
+	return std::string();
+}
+
+class BenchThread {
+public:
+	BenchThread(const BenchConfig& cfg, const std::vector<std::string>& templates, const struct sockaddr_in& addr, int connections, uint64_t start_ns)
+		: cfg_(cfg), templates_(templates), addr_(addr), conns_(connections), start_ns_(start_ns) {
+	}
+
+	void run() {
+		epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+		if (cfg_.rate > 0) {
+			interval_ns_ = (uint64_t)(1e9 * cfg_.connections / cfg_.rate);
+		}
+		for (size_t i = 0; i < conns_.size(); i++) {
+			conns_[i].next_send_ns = start_ns_ + interval_ns_ * i / conns_.size();				// 	Spread the first sends over one interval
+			open(&conns_[i]);
+		}
+		std::vector<struct epoll_event> events(256);
+		uint64_t deadline = start_ns_ + (uint64_t)(cfg_.duration_s * 1e9);
+		while (true) {
+			uint64_t now = now_ns();
+			if (cfg_.requests == 0 && now >= deadline) { g_stop = true; }
+			if (g_stop && (inflight() == 0 || now >= stop_at())) { break; }
+			uint64_t wait_ns = 10000000;																// 	Closed loop: only to notice the deadline
+			for (BenchConn& conn : conns_) {
+				send_due(&conn, now);
+				if (cfg_.rate > 0 && (int)conn.sent.size() < cfg_.pipeline && conn.next_send_ns > now && conn.next_send_ns - now < wait_ns) {
+					wait_ns = conn.next_send_ns - now;													// 	Sleep exactly until the next scheduled send
+				}
+			}
+			struct timespec wait = {(time_t)(wait_ns / 1000000000), (long)(wait_ns % 1000000000)};
+			int n = epoll_pwait2(epoll_fd_, events.data(), (int)events.size(), &wait, NULL);
+			for (int i = 0; i < n; i++) {
+				BenchConn* conn = &conns_[events[i].data.u32];
+				if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) { receive(conn); }
+				if (conn->fd >= 0 && (events[i].events & EPOLLOUT)) { flush(conn); }
+			}
+		}
+		for (BenchConn& conn : conns_) {
+			stats_.errors_timeout += conn.sent.size();
+			if (conn.fd >= 0) { close(conn.fd); }
+		}
+		close(epoll_fd_);
+	}
+
+	const BenchStats& stats() const { return stats_; }
+
+private:
+	uint64_t inflight() const {
+		uint64_t n = 0;
+		for (const BenchConn& conn : conns_) {
+			n += conn.sent.size();
+		}
+		return n;
+	}
+
+	uint64_t stop_at() {
+		if (stop_ns_ == 0) { stop_ns_ = now_ns() + (uint64_t)cfg_.timeout_ms * 1000000; }
+		return stop_ns_;
+	}
+
+	void open(BenchConn* conn) {
+		conn->fd = connect_to(addr_);
+		if (conn->fd < 0) {
+			stats_.errors_connect++;
+			return;
+		}
+		struct epoll_event ev = {};
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.u32 = (uint32_t)(conn - conns_.data());
+		epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, conn->fd, &ev);
+	}
+
+	// Server closed or broke the connection: what was in flight is lost, start over on a new socket
+	void reopen(BenchConn* conn, uint64_t* errors) {
+		if (errors) { *errors += conn->sent.size(); }
+		close(conn->fd);
+		conn->fd = -1;
+		conn->sent.clear();
+		conn->out.clear();
+		conn->out_pos = 0;
+		conn->in.clear();
+		conn->in_body = false;
+		conn->close_after = false;
+		if (!g_stop) { open(conn); }
+	}
+
+	bool take_request() {
+		if (g_stop) { return false; }
+		if (cfg_.requests == 0) { return true; }
+		if (g_remaining.fetch_sub(1, std::memory_order_relaxed) > 0) { return true; }
+		g_stop = true;
+		return false;
+	}
+
+	void send_due(BenchConn* conn, uint64_t now) {
+		if (conn->fd < 0) {
+			if (!g_stop) { open(conn); }
+			if (conn->fd < 0) { return; }
+		}
+		bool queued = false;
+		while ((int)conn->sent.size() < cfg_.pipeline && !conn->close_after) {
+			uint64_t at = now;
+			if (cfg_.rate > 0) {
+				if (conn->next_send_ns > now) { break; }
+				at = conn->next_send_ns;																// 	Latency counts from when it should have gone out
+				conn->next_send_ns += interval_ns_;
+			}
+			if (!take_request()) { break; }
+			conn->out += templates_[conn->next_template];
+			conn->next_template = (conn->next_template + 1) % templates_.size();
+			conn->sent.push_back(at);
+			queued = true;
+		}
+		if (queued) { flush(conn); }
+	}
+
+	void flush(BenchConn* conn) {
+		while (conn->out_pos < conn->out.size()) {
+			ssize_t rv = write(conn->fd, conn->out.data() + conn->out_pos, conn->out.size() - conn->out_pos);
+			if (rv < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK) { return; }
+				if (errno == EINTR) { continue; }
+				stats_.errors_write++;
+				reopen(conn, nullptr);
+				return;
+			}
+			conn->out_pos += (size_t)rv;
+		}
+		conn->out.clear();
+		conn->out_pos = 0;
+	}
+
+	void receive(BenchConn* conn) {
+		char buf[64 << 10];
+		while (conn->fd >= 0) {
+			ssize_t rv = read(conn->fd, buf, sizeof(buf));
+			if (rv < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK) { return; }
+				if (errno == EINTR) { continue; }
+				reopen(conn, &stats_.errors_read);
+				return;
+			}
+			if (rv == 0) {
+				reopen(conn, &stats_.errors_read);
+				return;
+			}
+			stats_.bytes_read += (uint64_t)rv;
+			conn->in.append(buf, (size_t)rv);
+			if (!parse(conn)) { return; }
+		}
+	}
+
+	// Complete every response in conn->in, false when the connection had to be reopened
+	bool parse(BenchConn* conn) {
+		size_t pos = 0;
+		while (pos < conn->in.size()) {
+			if (!conn->in_body) {
+				size_t end = find_header_end(conn->in, pos);
+				if (end == std::string::npos) { break; }
+				const char* head = conn->in.data() + pos;
+				if (end - pos < 12 || strncmp(head, "HTTP/1.", 7) != 0) {
+					reopen(conn, &stats_.errors_read);
+					return false;
+				}
+				int status = atoi(head + 9);
+				if (status < 200 || status >= 400) { stats_.errors_status++; }
+				std::string length = header_value(head, end - pos, "Content-Length");
+				conn->body_left = cfg_.method == "HEAD" || status == 204 || status == 304 ? 0 : strtoull(length.c_str(), NULL, 10);
+				conn->close_after = strcasecmp(header_value(head, end - pos, "Connection").c_str(), "close") == 0;
+				conn->in_body = true;
+				pos = end;
+			}
+			size_t take = conn->in.size() - pos < conn->body_left ? conn->in.size() - pos : conn->body_left;
+			pos += take;
+			conn->body_left -= take;
+			if (conn->body_left > 0) { break; }
+			conn->in_body = false;
+			if (conn->sent.empty()) {																// 	A response nobody asked for
+				reopen(conn, &stats_.errors_read);
+				return false;
+			}
+			stats_.record(now_ns() - conn->sent.front());
+			conn->sent.pop_front();
+			if (conn->close_after) {
+				reopen(conn, &stats_.errors_read);
+				return false;
+			}
+		}
+		conn->in.erase(0, pos);
+		send_due(conn, now_ns());																// 	Closed loop: refill the pipeline right away
+		return conn->fd >= 0;
+	}
+
+	const BenchConfig& cfg_;
+	const std::vector<std::string>& templates_;
+	struct sockaddr_in addr_;
+	std::vector<BenchConn> conns_;
+	uint64_t start_ns_;
+	uint64_t interval_ns_ = 0;
+	uint64_t stop_ns_ = 0;
+	int epoll_fd_ = -1;
+	BenchStats stats_;
+};
+
+// HdrHistogram's copyCorrectedForCoordinatedOmission: a sample of v with an expected interval i
+// stands for the requests that could not be sent meanwhile, v - i, v - 2i, ... down to i
+static HistogramSnapshot correct_for_omission(const HistogramSnapshot& raw, uint64_t interval) {
+	HistogramSnapshot out = raw;
+	if (interval == 0) { return out; }
+	for (size_t i = 0; i < K_HIST_BUCKETS; i++) {
+		if (raw.buckets[i] == 0) { continue; }
+		uint64_t value = hist_value(i);
+		for (uint64_t missed = value > interval ? value - interval : 0; missed >= interval; missed -= interval) {
+			out.buckets[hist_bucket(missed)] += raw.buckets[i];
+			out.count += raw.buckets[i];
+			out.sum += missed * raw.buckets[i];
+		}
+	}
+	return out;
+}
+
+static std::string format_ns(double ns) {
+	char buf[32];
+	if (ns < 1e3) { snprintf(buf, sizeof(buf), "%.0fns", ns); }
+	else if (ns < 1e6) { snprintf(buf, sizeof(buf), "%.2fus", ns / 1e3); }
+	else if (ns < 1e9) { snprintf(buf, sizeof(buf), "%.2fms", ns / 1e6); }
+	else { snprintf(buf, sizeof(buf), "%.2fs", ns / 1e9); }
+	return buf;
+}
+
+static void print_latency(const char* title, const HistogramSnapshot& hist) {
+	printf("  %s\n", title);
+	printf("    %-8s %12s\n", "mean", format_ns(hist.count ? (double)hist.sum / hist.count : 0).c_str());
+	static const double K_PERCENTILES[] = {50, 75, 90, 99, 99.9, 99.99};
+	for (double p : K_PERCENTILES) {
+		char label[16];
+		snprintf(label, sizeof(label), "p%g", p);
+		printf("    %-8s %12s\n", label, format_ns((double)hist.percentile(p)).c_str());
+	}
+	printf("    %-8s %12s\n", "max", format_ns((double)hist.max).c_str());
+}
+
+int main(int argc, char** argv) {
+	BenchConfig cfg;
+	static const struct option K_OPTIONS[] = {
+		{"connections", required_argument, NULL, 'c'}, {"threads", required_argument, NULL, 't'},
+		{"pipeline", required_argument, NULL, 'p'}, {"duration", required_argument, NULL, 'd'},
+		{"requests", required_argument, NULL, 'n'}, {"rate", required_argument, NULL, 'R'},
+		{"method", required_argument, NULL, 'm'}, {"header", required_argument, NULL, 'H'},
+		{"body", required_argument, NULL, 'b'}, {"path", required_argument, NULL, 'P'},
+		{"timeout", required_argument, NULL, 'T'}, {NULL, 0, NULL, 0}
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "c:t:p:d:n:R:m:H:b:P:T:", K_OPTIONS, NULL)) != -1) {
+		switch (opt) {
+			case 'c': cfg.connections = atoi(optarg); break;
+			case 't': cfg.threads = atoi(optarg); break;
+			case 'p': cfg.pipeline = atoi(optarg); break;
+			case 'd': cfg.duration_s = atof(optarg); break;
+			case 'n': cfg.requests = strtoull(optarg, NULL, 10); break;
+			case 'R': cfg.rate = atof(optarg); break;
+			case 'm': cfg.method = optarg; break;
+			case 'H': cfg.headers.push_back(optarg); break;
+			case 'b': cfg.body = optarg; break;
+			case 'P': cfg.paths.push_back(optarg); break;
+			case 'T': cfg.timeout_ms = atoi(optarg); break;
+			default: usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || !parse_url(argv[optind], &cfg)) { usage(argv[0]); }
+	if (cfg.connections <= 0 || cfg.threads <= 0 || cfg.pipeline <= 0) { usage(argv[0]); }
+	if (cfg.threads > cfg.connections) { cfg.threads = cfg.connections; }
+
+	struct addrinfo hints = {};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo* res = NULL;
+	if (getaddrinfo(cfg.host.c_str(), NULL, &hints, &res) || !res) {
+		fprintf(stderr, "cannot resolve %s\n", cfg.host.c_str());
+		return 1;
+	}
+	struct sockaddr_in addr = *(struct sockaddr_in*)res->ai_addr;
+	addr.sin_port = htons(cfg.port);
+	freeaddrinfo(res);
+
+	std::vector<std::string> templates = build_templates(cfg);
+	g_remaining = (int64_t)cfg.requests;
+	if (cfg.requests) {
+		printf("Running %llu requests @ http://%s:%d%s\n", (unsigned long long)cfg.requests, cfg.host.c_str(), cfg.port, cfg.paths[0].c_str());
+	} else {
+		printf("Running %gs test @ http://%s:%d%s\n", cfg.duration_s, cfg.host.c_str(), cfg.port, cfg.paths[0].c_str());
+	}
+	printf("  %d threads and %d connections, pipeline %d%s\n", cfg.threads, cfg.connections, cfg.pipeline,
+		cfg.rate > 0 ? ", constant rate" : ", closed loop");
+
+	std::vector<std::unique_ptr<BenchThread>> workers;
+	uint64_t start = now_ns();
+	for (int i = 0; i < cfg.threads; i++) {
+		int share = cfg.connections / cfg.threads + (i < cfg.connections % cfg.threads ? 1 : 0);
+		workers.emplace_back(new BenchThread(cfg, templates, addr, share, start));
+	}
+	std::vector<std::thread> threads;
+	for (auto& worker : workers) {
+		BenchThread* w = worker.get();
+		threads.emplace_back([w] { w->run(); });
+	}
+	for (std::thread& t : threads) {
+		t.join();
+	}
+	double elapsed = (double)(now_ns() - start) / 1e9;
+
+	HistogramSnapshot raw;
+	BenchStats total;
+	for (auto& worker : workers) {
+		const BenchStats& s = worker->stats();
+		for (size_t i = 0; i < K_HIST_BUCKETS; i++) {
+			raw.buckets[i] += s.buckets[i];
+		}
+		raw.count += s.count;
+		raw.sum += s.sum;
+		if (s.max > raw.max) { raw.max = s.max; }
+		total.bytes_read += s.bytes_read;
+		total.errors_connect += s.errors_connect;
+		total.errors_read += s.errors_read;
+		total.errors_write += s.errors_write;
+		total.errors_status += s.errors_status;
+		total.errors_timeout += s.errors_timeout;
+	}
+
+	printf("  %llu requests in %.2fs, %.2f MB read\n", (unsigned long long)raw.count, elapsed, total.bytes_read / 1048576.0);
+	printf("  Requests/sec: %.2f\n", raw.count / elapsed);
+	printf("  Transfer/sec: %.2f MB\n", total.bytes_read / 1048576.0 / elapsed);
+	if (total.errors_connect || total.errors_read || total.errors_write || total.errors_status || total.errors_timeout) {
+		printf("  Errors: connect %llu, read %llu, write %llu, status %llu, timeout %llu\n",
+			(unsigned long long)total.errors_connect, (unsigned long long)total.errors_read, (unsigned long long)total.errors_write,
+			(unsigned long long)total.errors_status, (unsigned long long)total.errors_timeout);
+	}
+	if (cfg.rate > 0) {
+		print_latency("Latency (from intended send time, corrected for coordinated omission):", raw);
+	} else {
+		print_latency("Latency (measured):", raw);
+		uint64_t interval = raw.count ? raw.sum / raw.count : 0;
+		print_latency("Latency (corrected for coordinated omission, expected interval = mean):", correct_for_omission(raw, interval));
+	}
+	return 0;
+}
@@ -0,0 +1,137 @@
+#include <cstdlib>
+#include <cstring>
+
+#include <zlib.h>
+
+#include "compression.hpp"
+#include "httpparser.hpp"
+#include "workerpool.hpp"
+
+const size_t K_COMPRESS_STEP = 64 << 10;																		// 	Output grown and input fed to zlib this much at a time
+const int K_COMPRESS_LEVEL = 6;
+
+static std::string_view trim(std::string_view s) {
+	while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) { s.remove_prefix(1); }
+	while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) { s.remove_suffix(1); }
+	return s;
+}
+
+// "gzip;q=0.8, deflate, *;q=0": highest q wins, gzip on a tie, q=0 (or no mention and no "*") excludes
+int http_negotiate_encoding(std::string_view acceptEncoding) {
+	double q_gzip = -1, q_deflate = -1, q_any = -1;
+	size_t pos = 0;
+	while (pos < acceptEncoding.size()) {
+		size_t end = acceptEncoding.find(',', pos);
+		if (end == std::string_view::npos) { end = acceptEncoding.size(); }
+		std::string_view item = acceptEncoding.substr(pos, end - pos);
+		pos = end + 1;
+		double q = 1;
+		size_t semi = item.find(';');
+		if (semi != std::string_view::npos) {
+			std::string_view param = trim(item.substr(semi + 1));
+			if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+				q = strtod(std::string(param.substr(2)).c_str(), NULL);
+			}
+			item = item.substr(0, semi);
+		}
+		item = trim(item);
+		if (http_iequals(item, "gzip") || http_iequals(item, "x-gzip")) {
+			q_gzip = q;
+		} else if (http_iequals(item, "deflate")) {
+			q_deflate = q;
+		} else if (item == "*") {
+			q_any = q;
+		}
+	}
+	if (q_gzip < 0) { q_gzip = q_any; }
+	if (q_deflate < 0) { q_deflate = q_any; }
+	if (q_gzip <= 0 && q_deflate <= 0) { return ENCODING_IDENTITY; }
+	return q_gzip >= q_deflate ? ENCODING_GZIP : ENCODING_DEFLATE;
+}
+
+const char* http_encoding_name(int encoding) {
+	switch (encoding) {
+		case ENCODING_GZIP: return "gzip";
+		case ENCODING_DEFLATE: return "deflate";
+		default: return "identity";
+	}
+}
+
+bool http_compressible(std::string_view contentType) {
+	static const char* const K_TYPES[] = {"text/", "application/json", "application/javascript", "application/xml",
+		"image/svg+xml", "application/wasm"};
+	for (const char* type : K_TYPES) {
+		size_t len = strlen(type);
+		if (contentType.size() >= len && http_iequals(contentType.substr(0, len), type)) { return true; }
+	}
+	return false;
+}
+
+bool http_compress(std::string_view in, int encoding, std::string& out) {
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	int window = encoding == ENCODING_GZIP ? 15 + 16 : 15;													// 	+16: gzip header and trailer instead of zlib's
+	if (deflateInit2(&zs, K_COMPRESS_LEVEL, Z_DEFLATED, window, 8, Z_DEFAULT_STRATEGY) != Z_OK) { return false; }
+	out.clear();
+	size_t fed = 0;
+	int rv = Z_OK;
+	while (rv != Z_STREAM_END) {
+		if (zs.avail_in == 0 && fed < in.size()) {
+			size_t step = in.size() - fed < K_COMPRESS_STEP ? in.size() - fed : K_COMPRESS_STEP;
+			zs.next_in = (Bytef*)(in.data() + fed);
+			zs.avail_in = (uInt)step;
+			fed += step;
+		}
+		size_t used = out.size();
+		out.resize(used + K_COMPRESS_STEP);
+		zs.next_out = (Bytef*)&out[used];
+		zs.avail_out = (uInt)K_COMPRESS_STEP;
+		rv = deflate(&zs, fed == in.size() ? Z_FINISH : Z_NO_FLUSH);
+		out.resize(used + K_COMPRESS_STEP - zs.avail_out);
+		if (rv != Z_OK && rv != Z_STREAM_END && rv != Z_BUF_ERROR) {
+			deflateEnd(&zs);
+			return false;
+		}
+	}
+	deflateEnd(&zs);
+	return true;
+}
+
+Compressor::Compressor(size_t variantBytes) : max_variant_bytes_(variantBytes) {
+}
+
+Compressor& Compressor::shared() {
+	static Compressor compressor;
+	return compressor;
+}
+
+std::shared_ptr<const std::string> Compressor::variant(const std::string& key) {
+	std::lock_guard<std::mutex> guard(lock_);
+	auto found = variants_.find(std::string_view(key));
+	if (found == variants_.end()) { return nullptr; }
+	lru_.splice(lru_.begin(), lru_, found->second);
+	return found->second->body;
+}
+
+void Compressor::prepare(const std::string& key, std::function<std::shared_ptr<const std::string>()> produce) {
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		if (variants_.count(std::string_view(key)) || !pending_.insert(key).second) { return; }				// 	Done, or another request already started it
+	}
+	WorkerPool::shared().submit([this, key, produce] { store(key, produce()); });
+}
+
+void Compressor::store(const std::string& key, std::shared_ptr<const std::string> body) {
+	std::lock_guard<std::mutex> guard(lock_);
+	pending_.erase(key);
+	if (!body || body->size() > max_variant_bytes_) { return; }
+	lru_.push_front(Variant{key, std::move(body)});
+	variants_.emplace(std::string_view(lru_.front().key), lru_.begin());
+	variant_bytes_ += lru_.front().body->size();
+	while (variant_bytes_ > max_variant_bytes_) {
+		Variant& last = lru_.back();
+		variant_bytes_ -= last.body->size();
+		variants_.erase(std::string_view(last.key));
+		lru_.pop_back();
+	}
+}
@@ -0,0 +1,58 @@
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+enum ContentEncoding {
+	ENCODING_IDENTITY,
+	ENCODING_GZIP,
+	ENCODING_DEFLATE																							// 	zlib stream, what "deflate" means in HTTP
+};
+
+const size_t K_COMPRESS_MIN_SIZE = 1024;																		// 	Smaller bodies gain less than the trip to a worker costs
+const size_t K_COMPRESS_MAX_FILE = 16 << 20;																	// 	Bigger static files are always sent as they are, with sendfile()
+
+int http_negotiate_encoding(std::string_view acceptEncoding);													// 	Best of gzip/deflate the client accepts (q > 0), identity otherwise
+const char* http_encoding_name(int encoding);
+bool http_compressible(std::string_view contentType);															// 	Text, JSON, JS, XML, SVG: already compressed formats are left alone
+bool http_compress(std::string_view in, int encoding, std::string& out);										// 	Streams in through zlib in fixed steps, false on a zlib error
+
+/* 	Compressed variants of bodies that are served again and again (static files), so they are
+	compressed once. prepare() queues the job on the WorkerPool unless it is already done or
+	running, variant() returns the result once ready. An LRU bounded in bytes. */
+class Compressor {
+public:
+	explicit Compressor(size_t variantBytes = 64 << 20);
+	Compressor(const Compressor&) = delete;
+	Compressor& operator=(const Compressor&) = delete;
+
+	static Compressor& shared();																				// 	Process wide
+
+	std::shared_ptr<const std::string> variant(const std::string& key);											// 	nullptr until prepared
+	void prepare(const std::string& key, std::function<std::shared_ptr<const std::string>()> produce);			// 	produce runs on a worker, nullptr stores nothing
+
+private:
+	struct Variant {
+		std::string key;
+		std::shared_ptr<const std::string> body;
+	};
+
+	void store(const std::string& key, std::shared_ptr<const std::string> body);
+
+	std::mutex lock_;
+	std::list<Variant> lru_;																					// 	Front is the most recently used
+	std::unordered_map<std::string_view, std::list<Variant>::iterator> variants_;								// 	Views into the keys of lru_
+	std::unordered_set<std::string> pending_;
+	size_t variant_bytes_ = 0;
+	size_t max_variant_bytes_;
+};
+
+#endif // COMPRESSION_HPP
@@ -0,0 +1,311 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <new>
+#include <cerrno>
+#include <cstdint>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "conn.hpp"
+#include "compression.hpp"
+
+const size_t K_COPY_BODY_LIMIT = 16 << 10;																		// 	Bodies up to this size are copied next to their head (one iovec)
+
+void die(const char* msg) {
+	LOG_ERROR("%s: %s", msg, strerror(errno));
+	exit(1);																									// 	The logger writes what is left from its destructor
+}
+
+void set_nonblock(int fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags == -1) { die("fcntl(F_GETFL)"); }
+	int rv = fcntl(fd, F_SETFL, flags | O_NONBLOCK); // Set the file descriptor to non-blocking mode, this means that read and write operations will not block the process
+													 // this means that if there is no data to read, read will return -1 and set errno to EAGAIN
+	if (rv == -1) { die("fcntl(F_SETFL)"); }
+}
+
+// Parse the request head at read_pos, on success conn->req holds views into read_buf
+bool parse_request(Conn* conn) {
+	if (conn->close_after_write) { return false; }																// 	Anything pipelined after a "Connection: close" request is ignored
+	ParseStatus status = conn->parser.parse(conn->read_buf.data() + conn->read_pos, conn->read_size - conn->read_pos, &conn->req);
+	if (status == PARSE_INCOMPLETE) { return false; }															// 	The parser remembers where it stopped, next call only scans the new bytes
+	if (status == PARSE_ERROR) {
+		Metrics::local().add(M_ERRORS);
+		conn->state = STATE_CLOSE;
+		return false;
+	}
+	return true; // complete request, we can process it return true to continue processing
+}
+
+// Set up body framing for the request just parsed
+bool start_body(Conn* conn) {
+	if (!conn->body.init(conn->req)) {
+		Metrics::local().add(M_ERRORS);
+		conn->state = STATE_CLOSE;
+		return false;
+	}
+	conn->in_body = true;
+	conn->body_consumed = 0;
+	return true;
+}
+
+bool expects_continue(const Conn* conn) {
+	bool has_body = conn->body.chunked() || conn->body.contentLength() > 0;
+	return has_body && conn->req.minor_version >= 1 && http_iequals(conn->req.header("Expect"), "100-continue");
+}
+
+// Only once the request will be read, never for one answered without its body
+void send_continue(Conn* conn) {
+	static const char K_CONTINUE[] = "HTTP/1.1 100 Continue\r\n\r\n";
+	conn->out.append(K_CONTINUE, sizeof(K_CONTINUE) - 1);
+}
+
+/* 	Feed the bytes that follow the head to the body decoder. While the body is incomplete every
+	byte is decoded and handed to the sink, so the bytes are dropped from read_buf right away and
+	only the head stays (conn->req keeps pointing into it): an upload never accumulates. */
+BodyStatus read_body(Conn* conn, const BodySink& sink) {
+	size_t body_start = conn->read_pos + conn->req.header_len;
+	size_t consumed = 0;
+	BodyStatus status = conn->body.feed(conn->read_buf.data() + body_start, conn->read_size - body_start, &consumed, sink);
+	if (status == BODY_ERROR) {
+		Metrics::local().add(M_ERRORS);
+		conn->state = STATE_CLOSE;
+	} else if (status == BODY_INCOMPLETE) {
+		conn->read_size = body_start;
+	} else {
+		conn->body_consumed = consumed;																			// 	What follows is the next pipelined request
+	}
+	return status;
+}
+
+// Drop the request parsed by parse_request, the views in conn->req are no longer valid after this
+void consume_request(Conn* conn) {
+	conn->read_pos += conn->req.header_len + conn->body_consumed;
+	conn->in_body = false;
+	conn->body_consumed = 0;
+	if (conn->read_pos == conn->read_size) {																	// 	Nothing pipelined behind it, rewind for free
+		conn->read_pos = 0;
+		conn->read_size = 0;
+	}
+	conn->parser.reset();
+}
+
+// HTTP/1.1 connections are persistent unless "Connection: close", HTTP/1.0 ones only with "Connection: keep-alive"
+bool wants_keep_alive(const HttpRequest& req) {
+	std::string_view value = req.header("Connection");
+	bool keep_alive = req.minor_version >= 1;
+	while (!value.empty()) {																					// 	The header is a comma separated list of tokens
+		size_t comma = value.find(',');
+		std::string_view token = value.substr(0, comma);
+		while (!token.empty() && (token.front() == ' ' || token.front() == '\t')) { token.remove_prefix(1); }
+		while (!token.empty() && (token.back() == ' ' || token.back() == '\t')) { token.remove_suffix(1); }
+		if (http_iequals(token, "close")) { return false; }
+		if (http_iequals(token, "keep-alive")) { keep_alive = true; }
+		if (comma == std::string_view::npos) { break; }
+		value.remove_prefix(comma + 1);
+	}
+	return keep_alive;
+}
+
+const char* connection_header(Conn* conn) {
+	if (conn->close_after_write || !wants_keep_alive(conn->req)) {
+		conn->close_after_write = true;
+		return "Connection: close\r\n";
+	}
+	if (conn->req.minor_version == 0) { return "Connection: keep-alive\r\n"; }								// 	HTTP/1.0 clients assume close unless told otherwise
+	return "";
+}
+
+void append_response(Conn* conn, HttpResponse& res, bool head_only) {
+	const char* connection = connection_header(conn);
+	std::string_view headers = res.headers();
+	size_t cap = headers.size() + 128;
+	int len = snprintf(conn->out.reserve(cap), cap, "HTTP/1.1 %d %s\r\n%.*sContent-Length: %zu\r\n%s\r\n",
+		res.status(), http_status_text(res.status()), (int)headers.size(), headers.data(), res.contentLength(), connection);
+	conn->out.commit((size_t)len < cap ? (size_t)len : 0);
+	if (head_only) { return; }																					// 	HEAD gets the headers of the GET, without the body
+
+	if (res.file()) {
+		conn->out.appendFile(res.file(), res.fileOffset(), res.contentLength());								// 	Sent with sendfile() when its turn comes
+	} else if (res.sharedBody()) {
+		conn->out.appendShared(res.sharedBody(), 0, res.sharedBody()->size());
+	} else if (res.body().size() >= K_COPY_BODY_LIMIT) {
+		std::shared_ptr<const std::string> body = res.takeBody();												// 	Big body: hand the string over instead of copying it
+		conn->out.appendShared(body, 0, body->size());
+	} else {
+		conn->out.append(res.body().data(), res.body().size());
+	}
+}
+
+std::shared_ptr<DeferredResponse> defer_response(HttpResponse& res, bool head_only, const char* connection) {
+	std::shared_ptr<DeferredResponse> deferred = std::make_shared<DeferredResponse>();
+	std::string_view headers = res.headers();
+	char line[128];
+	int len = snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", res.status(), http_status_text(res.status()));
+	deferred->head.reserve(headers.size() + 128);
+	deferred->head.append(line, len);
+	deferred->head.append(headers);
+	len = snprintf(line, sizeof(line), "Content-Length: %zu\r\n%s\r\n", res.contentLength(), connection);
+	deferred->head.append(line, len);
+	if (head_only) { return deferred; }
+
+	if (res.file()) {
+		deferred->file = res.file();
+		deferred->file_offset = res.fileOffset();
+		deferred->file_length = res.contentLength();
+	} else if (res.sharedBody()) {
+		deferred->body = res.sharedBody();
+	} else if (!res.body().empty()) {
+		deferred->body = res.takeBody();
+	}
+	return deferred;
+}
+
+/* 	The cached bytes are borrowed, never copied: a keep-alive HTTP/1.1 hit is a single slice.
+	Otherwise the Connection header goes in a small owned slice between the head and the body. */
+void append_cached(Conn* conn, const std::shared_ptr<const CachedResponse>& cached, bool head_only, bool not_modified) {
+	const char* connection = connection_header(conn);
+	if (not_modified) {
+		size_t cap = cached->etag.size() + 128;
+		const char* vary = cached->compressible || cached->encoding != ENCODING_IDENTITY ? "Vary: Accept-Encoding\r\n" : "";	// 	As the 200 would, so caches keep the codings apart
+		int len = snprintf(conn->out.reserve(cap), cap, "HTTP/1.1 304 Not Modified\r\nETag: %s\r\n%s%s\r\n", cached->etag.c_str(), vary, connection);
+		conn->out.commit((size_t)len < cap ? (size_t)len : 0);
+		return;
+	}
+	size_t end = head_only ? cached->head_len + 2 : cached->wire->size();
+	if (!*connection) {
+		conn->out.appendShared(cached->wire, 0, end);
+		return;
+	}
+	conn->out.appendShared(cached->wire, 0, cached->head_len);
+	conn->out.append(connection, strlen(connection));
+	conn->out.appendShared(cached->wire, cached->head_len, end - cached->head_len);
+}
+
+bool handle_write(Conn* conn) {
+	assert(!conn->out.empty());																					// 	Assert is used to check if a condition is true, if it is not, the program will terminate
+	LOG_TRACE("Sending %zu bytes on %i", conn->out.size(), conn->fd);
+	size_t queued = conn->out.size();
+	int rv = conn->out.flush(conn->fd);																			// 	writev() of the queued slices, partial writes just advance an offset
+	Metrics& metrics = Metrics::local();
+	metrics.add(M_WRITES);
+	metrics.add(M_BYTES_OUT, queued - conn->out.size());
+	if (rv == FLUSH_AGAIN) {																					// 	EAGAIN means that the write would block, so we should try again later
+		metrics.add(M_WRITE_STALLS);
+		LOG_TRACE("Write would block on %i", conn->fd);															// 	This is necessary because pipelined requests can cause the write buffer to fill up (and EAGAIN to be returned)
+		return false;
+	}
+	if (rv == FLUSH_ERROR) {
+		LOG_DEBUG("Write error on %i: %s", conn->fd, strerror(errno));
+		conn->state = STATE_CLOSE;
+		return false;
+	}
+	conn->state = conn->close_after_write ? STATE_CLOSE : STATE_READ;											// 	Last response of a "Connection: close" request is out
+	return false;
+}
+
+static void rebase_view(std::string_view& v, uintptr_t from, size_t len, const uint8_t* to) {
+	uintptr_t p = (uintptr_t)v.data();
+	if (p >= from && p < from + len) { v = std::string_view((const char*)to + (p - from), v.size()); }
+}
+
+// Move read_buf to the size class of need bytes (up or down). While a body streams conn->req
+// points into the head kept in the buffer, so its views follow the bytes.
+static void resize_read_buf(Conn* conn, size_t need) {
+	uintptr_t from = (uintptr_t)conn->read_buf.data();
+	if (need > conn->read_buf.capacity()) {
+		if (!conn->read_buf.reserve(need, conn->read_size)) { throw std::bad_alloc(); }
+	} else {
+		conn->read_buf.shrink(conn->read_size, need);
+	}
+	if (!conn->in_body || from == (uintptr_t)conn->read_buf.data()) { return; }
+	HttpRequest& req = conn->req;
+	const uint8_t* to = conn->read_buf.data();
+	rebase_view(req.method, from, conn->read_size, to);
+	rebase_view(req.target, from, conn->read_size, to);
+	rebase_view(req.path, from, conn->read_size, to);
+	rebase_view(req.query, from, conn->read_size, to);
+	rebase_view(req.version, from, conn->read_size, to);
+	for (size_t i = 0; i < req.num_headers; i++) {
+		rebase_view(req.headers[i].name, from, conn->read_size, to);
+		rebase_view(req.headers[i].value, from, conn->read_size, to);
+	}
+	for (size_t i = 0; i < req.num_params; i++) {
+		rebase_view(req.params[i].value, from, conn->read_size, to);										// 	Names point into the route pattern
+	}
+}
+
+// Make room for at least need more bytes after read_size, false (connection closed) past MAX_BUF_SIZE
+static bool reserve_read(Conn* conn, size_t need) {
+	if (conn->read_pos > 0 && !conn->in_body) {																	// 	Keep the unparsed tail (a partial pipelined request), one memmove per read instead of per request
+																												// 	Not while streaming a body: conn->req points into the head
+		conn->read_size -= conn->read_pos;
+		memmove(conn->read_buf.data(), conn->read_buf.data() + conn->read_pos, conn->read_size);
+		conn->read_pos = 0;
+	}
+	if (conn->read_buf.capacity() - conn->read_size < need) {
+		if (conn->read_size + need > MAX_BUF_SIZE) {
+			LOG_WARN("Read buffer overflow on %i, closing connection", conn->fd);
+			conn->state = STATE_CLOSE;
+			return false;
+		}
+		size_t grow = conn->read_size ? 2 * conn->read_size : K_READ_BUF_INITIAL;							// 	Full (or released while idle): next size class
+		resize_read_buf(conn, grow > conn->read_size + need ? grow : conn->read_size + need);
+	}
+	return true;
+}
+
+bool handle_read(Conn* conn) {
+	if (!reserve_read(conn, 1)) { return false; }
+	ssize_t rv = read(conn->fd, conn->read_buf.data() + conn->read_size, conn->read_buf.capacity() - conn->read_size);	// 	Read data from the connection into the read buffer, starting at the end of the current read size
+
+	if (rv < 0 && errno == EAGAIN) {
+		if (conn->read_size == 0) {
+			conn->read_buf.release();																			// 	Idle between requests: the connection holds no read memory
+		} else if (conn->read_size < conn->read_buf.capacity() / 4) {											// 	Mostly empty after a burst: give the memory back, keeping room to grow
+			size_t keep = 2 * conn->read_size;																	// 	Hysteresis: requests piling up behind a slow response would otherwise
+			resize_read_buf(conn, keep > K_READ_BUF_INITIAL ? keep : K_READ_BUF_INITIAL);					// 	shrink and regrow (copying the whole backlog) on every read
+		}
+		return false;
+	}
+	if (rv < 0) {
+		LOG_DEBUG("Read error on %i: %s", conn->fd, strerror(errno));
+		conn->state = STATE_CLOSE;
+		return false;
+	}
+	if (rv == 0) {
+		LOG_TRACE("EOF on %i", conn->fd);
+		conn->close_after_write = true;																			// 	Half-closed peer: still send the responses of what it pipelined
+		if (conn->out.empty()) { conn->state = STATE_CLOSE; }
+		return false;
+	}
+
+	conn->read_size += rv;																						// 	Increase the size of the read buffer
+	Metrics::local().add(M_READS);
+	Metrics::local().add(M_BYTES_IN, (uint64_t)rv);
+	LOG_TRACE("Read %zd bytes on %i, %zu buffered", rv, conn->fd, conn->read_size);
+	assert(conn->read_size <= conn->read_buf.capacity());
+	return true;																								// 	The caller runs parse_request until it returns false
+}
+
+// Bytes received by someone else (io_uring provided buffer), appended like a read would
+bool handle_recv(Conn* conn, const uint8_t* data, size_t len) {
+	if (!reserve_read(conn, len)) { return false; }
+	memcpy(conn->read_buf.data() + conn->read_size, data, len);
+	conn->read_size += len;
+	Metrics::local().add(M_READS);
+	Metrics::local().add(M_BYTES_IN, (uint64_t)len);
+	LOG_TRACE("Received %zu bytes on %i, %zu buffered", len, conn->fd, conn->read_size);
+	return true;
+}
+
+Conn* conn_new() {
+	return ObjectPool<Conn>::create();
+}
+
+void conn_free(Conn* conn) {
+	ObjectPool<Conn>::destroy(conn);																			// 	The buffers go back to the pool with it
+}
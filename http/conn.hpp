@@ -0,0 +1,92 @@
+#ifndef CONN_HPP
+#define CONN_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "httpparser.hpp"
+#include "httpbody.hpp"
+#include "httpresponse.hpp"
+#include "router.hpp"
+#include "staticfiles.hpp"
+#include "responsecache.hpp"
+#include "outqueue.hpp"
+#include "bufferpool.hpp"
+#include "timerwheel.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
+
+enum {
+	STATE_READ,
+	STATE_WRITE,
+	STATE_CLOSE
+};
+
+enum {																											// 	What the connection timer is counting
+	TIMEOUT_NONE,
+	TIMEOUT_IDLE,																								// 	Keep-alive between requests
+	TIMEOUT_HEADER,																								// 	From the first byte of a head, not re-armed on progress (slow senders)
+	TIMEOUT_BODY,																								// 	Between two reads of a body
+	TIMEOUT_WRITE																								// 	Between two writes the peer accepts
+};
+
+const size_t MAX_BUF_SIZE = 32 << 20; // 32 MB
+const size_t K_READ_BUF_INITIAL = 4 << 10;																		// 	First read buffer of a connection, doubled while full up to MAX_BUF_SIZE
+const size_t K_MAX_STRINGS = 1024;
+
+// A response finished off the reactor (compressed, or by a coroutine), queued on out once processRequests gets to it
+struct DeferredResponse {
+	std::string head;
+	std::shared_ptr<const std::string> body;																	// 	May be null: no body, or a file
+	std::shared_ptr<const OpenFile> file;
+	off_t file_offset = 0;
+	size_t file_length = 0;
+};
+
+struct Conn{
+		int fd = -1;
+		uint8_t state = STATE_READ;
+		size_t read_size = 0;
+		size_t read_pos = 0;																					// 	Start of the first unconsumed request in read_buf
+		bool close_after_write = false;																			// 	Close once out drains (Connection: close, HTTP/1.0, EOF)
+		HttpParser parser;
+		HttpRequest req;																						// 	Last parsed request, views into read_buf
+		BodyDecoder body;
+		bool in_body = false;																					// 	Head parsed, body still arriving
+		size_t body_consumed = 0;																				// 	Body bytes that follow the head once the body is complete
+		RouteMatch route;																						// 	Resolved when the head is parsed, so the body knows where to go
+		std::string body_buf;																					// 	Body of buffered (non streaming) routes
+		bool body_overflow = false;
+		Buffer read_buf;																						// 	Pooled, grows on demand and is given back when it drains
+		OutQueue out;																							// 	Responses waiting for the socket, in order
+		TimerNode timer;																						// 	Linked in the reactor's TimerWheel
+		uint8_t timeout_kind = TIMEOUT_NONE;
+		size_t charged = 0;																						// 	Bytes of this connection in the reactor's buffered total
+		uint64_t pending_job = 0;																				// 	Response being produced off the reactor, the requests after it wait
+		std::shared_ptr<DeferredResponse> deferred;
+};
+
+void die(const char* msg);
+void set_nonblock(int fd);
+
+bool parse_request(Conn* conn);																				// 	true when a complete request sits at read_pos
+bool start_body(Conn* conn);
+bool expects_continue(const Conn* conn);																		// 	The client waits for "100 Continue" before sending the body
+void send_continue(Conn* conn);
+BodyStatus read_body(Conn* conn, const BodySink& sink);
+void consume_request(Conn* conn);
+bool wants_keep_alive(const HttpRequest& req);
+const char* connection_header(Conn* conn);																		// 	"Connection: ..." line for the current request, may be empty; sets close_after_write
+void append_response(Conn* conn, HttpResponse& res, bool head_only);										// 	Queue head and body on conn->out
+std::shared_ptr<DeferredResponse> defer_response(HttpResponse& res, bool head_only, const char* connection);	// 	Same bytes as append_response, for later
+void append_cached(Conn* conn, const std::shared_ptr<const CachedResponse>& cached, bool head_only, bool not_modified);	// 	Queue a cache hit by reference, or its 304
+bool handle_write(Conn* conn);																					// 	Flushes conn->out until done or EAGAIN, always false (loop-compatible)
+bool handle_read(Conn* conn);																					// 	true when bytes were appended to read_buf, false on EAGAIN, EOF or error
+bool handle_recv(Conn* conn, const uint8_t* data, size_t len);												// 	Copy len received bytes into read_buf, false when it would overflow (STATE_CLOSE)
+
+Conn* conn_new();																								// 	From the reactor thread's Conn pool
+void conn_free(Conn* conn);
+
+#endif // CONN_HPP
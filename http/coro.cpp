@@ -0,0 +1,120 @@
+#include <cerrno>
+#include <cstring>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "coro.hpp"
+#include "epollserver.hpp"
+#include "workerpool.hpp"
+
+static EpollServer* reactor() {
+	EpollServer* server = EpollServer::current();
+	if (!server) {
+		errno = EINVAL;
+		die("co_await outside a reactor thread");
+	}
+	return server;
+}
+
+bool co_park(CoWaiter* waiter) {
+	return reactor()->park(waiter);
+}
+
+std::function<void(std::function<void()>)> co_poster() {
+	return reactor()->poster();
+}
+
+void co_offload_submit(std::function<void()> job) {
+	WorkerPool::shared().submit(std::move(job));
+}
+
+AsyncSocket::AsyncSocket(int fd) : fd_(fd) {
+	if (fd_ >= 0) { set_nonblock(fd_); }
+}
+
+AsyncSocket::~AsyncSocket() {
+	close();
+}
+
+AsyncSocket::AsyncSocket(AsyncSocket&& other) noexcept : fd_(std::exchange(other.fd_, -1)), timeout_ms_(other.timeout_ms_) {
+}
+
+AsyncSocket& AsyncSocket::operator=(AsyncSocket&& other) noexcept {
+	if (this != &other) {
+		close();
+		fd_ = std::exchange(other.fd_, -1);
+		timeout_ms_ = other.timeout_ms_;
+	}
+	return *this;
+}
+
+void AsyncSocket::setTimeout(int ms) {
+	timeout_ms_ = ms;
+}
+
+int AsyncSocket::fd() const {
+	return fd_;
+}
+
+void AsyncSocket::close() {
+	if (fd_ < 0) { return; }
+	(void)::close(fd_);																							// 	Never closed while parked: only the coroutine itself can get here
+	fd_ = -1;
+}
+
+Task<int> AsyncSocket::connect(const char* ip, int port) {
+	close();
+	fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd_ < 0) { co_return -errno; }
+	int one = 1;
+	setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1) { co_return -EINVAL; }
+	if (::connect(fd_, (struct sockaddr*)&addr, sizeof(addr)) == 0) { co_return 0; }
+	if (errno != EINPROGRESS) { co_return -errno; }
+	uint32_t revents = co_await fd_ready(fd_, EPOLLOUT, timeout_ms_);
+	if (!revents) { co_return -ETIMEDOUT; }
+	int err = 0;
+	socklen_t len = sizeof(err);
+	if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len)) { co_return -errno; }
+	co_return -err;
+}
+
+// A wakeup is only a hint (spurious ones happen on timeouts racing readiness): the syscall says what is really there
+Task<ssize_t> AsyncSocket::read(void* buf, size_t len) {
+	while (true) {
+		ssize_t rv = ::read(fd_, buf, len);
+		if (rv >= 0) { co_return rv; }
+		if (errno == EINTR) { continue; }
+		if (errno != EAGAIN && errno != EWOULDBLOCK) { co_return -errno; }
+		if (!co_await fd_ready(fd_, EPOLLIN | EPOLLRDHUP, timeout_ms_)) { co_return -ETIMEDOUT; }
+	}
+}
+
+Task<ssize_t> AsyncSocket::write(const void* data, size_t len) {
+	while (true) {
+		ssize_t rv = send(fd_, data, len, MSG_NOSIGNAL);
+		if (rv >= 0) { co_return rv; }
+		if (errno == EINTR) { continue; }
+		if (errno != EAGAIN && errno != EWOULDBLOCK) { co_return -errno; }
+		if (!co_await fd_ready(fd_, EPOLLOUT, timeout_ms_)) { co_return -ETIMEDOUT; }
+	}
+}
+
+Task<ssize_t> AsyncSocket::writeAll(const void* data, size_t len) {
+	size_t sent = 0;
+	while (sent < len) {
+		ssize_t rv = co_await write((const char*)data + sent, len - sent);
+		if (rv < 0) { co_return rv; }
+		sent += (size_t)rv;
+	}
+	co_return (ssize_t)sent;
+}
@@ -0,0 +1,224 @@
+#ifndef CORO_HPP
+#define CORO_HPP
+
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include <sys/types.h>
+
+#include "timerwheel.hpp"
+
+/* 	C++20 coroutines driven by the reactor. A handler registered with addAsyncRoute() is a
+	coroutine returning Task<>: it reads like blocking code, but every co_await on a socket, a
+	timer or an offloaded call parks the coroutine and gives the thread back to the event loop,
+	which resumes it from the same thread once the wait is over. Thousands of such requests can
+	be in flight on one reactor, each costing a coroutine frame instead of a thread.
+	Coroutines only run on the reactor thread that started them, no locking is involved. */
+
+template <class T = void>
+class Task;
+
+namespace coro_detail {
+
+template <class T>
+struct Result {
+	std::optional<T> value;
+	void return_value(T v) { value.emplace(std::move(v)); }
+	T take() { return std::move(*value); }
+};
+
+template <>
+struct Result<void> {
+	void return_void() {}
+	void take() {}
+};
+
+}
+
+// Lazy: runs when co_awaited (the awaiting coroutine resumes when it ends) or start()ed
+template <class T>
+class Task {
+public:
+	struct promise_type : coro_detail::Result<T> {
+		std::coroutine_handle<> continuation;
+		std::function<void(std::exception_ptr)> on_done;														// 	Top level only
+		std::exception_ptr error;
+
+		Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+
+		struct FinalAwaiter {
+			bool await_ready() noexcept { return false; }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+				promise_type& p = h.promise();
+				if (p.continuation) { return p.continuation; }													// 	Straight back into the caller, no stack growth
+				std::function<void(std::exception_ptr)> done = std::move(p.on_done);
+				std::exception_ptr error = p.error;
+				h.destroy();																					// 	Detached: the frame frees itself
+				if (done) { done(error); }
+				return std::noop_coroutine();
+			}
+			void await_resume() noexcept {}
+		};
+		FinalAwaiter final_suspend() noexcept { return {}; }
+		void unhandled_exception() { error = std::current_exception(); }
+	};
+
+	Task(Task&& other) noexcept : h_(std::exchange(other.h_, {})) {}
+	Task& operator=(Task&&) = delete;
+	~Task() {
+		if (h_) { h_.destroy(); }
+	}
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+		h_.promise().continuation = awaiting;
+		return h_;
+	}
+	T await_resume() {
+		if (h_.promise().error) { std::rethrow_exception(h_.promise().error); }
+		return h_.promise().take();
+	}
+
+	// Run until the first suspension; onDone gets what escaped the coroutine (or nullptr) once it ends
+	void start(std::function<void(std::exception_ptr)> onDone) {
+		std::coroutine_handle<promise_type> h = std::exchange(h_, {});
+		h.promise().on_done = std::move(onDone);
+		h.resume();
+	}
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> h) : h_(h) {}
+
+	std::coroutine_handle<promise_type> h_;
+};
+
+// A parked coroutine: the reactor resumes it on fd readiness or when its timer fires, whichever comes first
+struct CoWaiter {
+	std::coroutine_handle<> handle;
+	int fd = -1;																								// 	-1: timer only
+	uint32_t events = 0;																						// 	EPOLLIN / EPOLLOUT
+	uint32_t revents = 0;																						// 	0 after a timeout
+	int timeout_ms = -1;																						// 	-1: no timer
+	TimerNode timer;
+};
+
+bool co_park(CoWaiter* waiter);																					// 	Registers it with the reactor of the calling thread, false: could not wait (revents says why)
+
+// co_await sleep_for(100);
+struct SleepFor {
+	CoWaiter waiter;
+
+	bool await_ready() const noexcept { return waiter.timeout_ms <= 0; }
+	bool await_suspend(std::coroutine_handle<> h) {
+		waiter.handle = h;
+		return co_park(&waiter);
+	}
+	void await_resume() const noexcept {}
+};
+
+inline SleepFor sleep_for(int ms) {
+	SleepFor s;
+	s.waiter.timeout_ms = ms;
+	return s;
+}
+
+// uint32_t revents = co_await fd_ready(fd, EPOLLIN, 1000); 0 when timeoutMs passed first
+struct FdReady {
+	CoWaiter waiter;
+
+	bool await_ready() const noexcept { return false; }
+	bool await_suspend(std::coroutine_handle<> h) {
+		waiter.handle = h;
+		return co_park(&waiter);
+	}
+	uint32_t await_resume() const noexcept { return waiter.revents; }
+};
+
+inline FdReady fd_ready(int fd, uint32_t events, int timeoutMs = -1) {
+	FdReady r;
+	r.waiter.fd = fd;
+	r.waiter.events = events;
+	r.waiter.timeout_ms = timeoutMs;
+	return r;
+}
+
+std::function<void(std::function<void()>)> co_poster();														// 	Runs a job on the calling thread's reactor, from any thread
+void co_offload_submit(std::function<void()> job);																// 	On the WorkerPool
+
+/* 	auto rows = co_await offload([] { return blocking_query(); });
+	Calls into code that blocks (or is simply slow) run on the WorkerPool; the coroutine is
+	resumed on its reactor with the result, or with the exception fn threw. */
+template <class F>
+struct Offload {
+	using R = std::invoke_result_t<F&>;
+	using Stored = std::conditional_t<std::is_void_v<R>, bool, R>;
+
+	F fn;
+	std::optional<Stored> result;
+	std::exception_ptr error;
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> h) {
+		std::function<void(std::function<void()>)> poster = co_poster();
+		co_offload_submit([this, h, poster]() {
+			try {
+				if constexpr (std::is_void_v<R>) {
+					fn();
+					result.emplace(true);
+				} else {
+					result.emplace(fn());
+				}
+			} catch (...) {
+				error = std::current_exception();
+			}
+			poster([h]() { h.resume(); });
+		});
+	}
+	R await_resume() {
+		if (error) { std::rethrow_exception(error); }
+		if constexpr (!std::is_void_v<R>) { return std::move(*result); }
+	}
+};
+
+template <class F>
+Offload<std::decay_t<F>> offload(F&& fn) {
+	return Offload<std::decay_t<F>>{std::forward<F>(fn), std::nullopt, nullptr};
+}
+
+/* 	Non-blocking TCP client socket for coroutines, e.g. a handler calling a backend:
+		AsyncSocket s;
+		if (co_await s.connect("127.0.0.1", 1234) < 0) { ... }
+		co_await s.writeAll(req.data(), req.size());
+		ssize_t n = co_await s.read(buf, sizeof(buf));
+	Every call tries the syscall first and only parks on EAGAIN. Results are >= 0 or -errno,
+	-ETIMEDOUT when a wait lasts longer than setTimeout(). */
+class AsyncSocket {
+public:
+	AsyncSocket() = default;
+	explicit AsyncSocket(int fd);																				// 	Takes ownership, made non-blocking
+	~AsyncSocket();
+	AsyncSocket(AsyncSocket&& other) noexcept;
+	AsyncSocket& operator=(AsyncSocket&& other) noexcept;
+	AsyncSocket(const AsyncSocket&) = delete;
+	AsyncSocket& operator=(const AsyncSocket&) = delete;
+
+	void setTimeout(int ms);																					// 	Per wait, -1 (default) waits forever
+	Task<int> connect(const char* ip, int port);
+	Task<ssize_t> read(void* buf, size_t len);																	// 	0 on EOF
+	Task<ssize_t> write(const void* data, size_t len);
+	Task<ssize_t> writeAll(const void* data, size_t len);														// 	len, or the error that stopped it
+	void close();
+	int fd() const;
+
+private:
+	int fd_ = -1;
+	int timeout_ms_ = -1;
+};
+
+#endif // CORO_HPP
@@ -0,0 +1,814 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "epollserver.hpp"
+#include "compression.hpp"
+#include "workerpool.hpp"
+
+const size_t K_MAX_BUFFERED_BODY = 8 << 20;																		// 	Larger bodies need a streaming route (BodyHandler)
+
+static thread_local EpollServer* t_current = NULL;
+
+// The request of a coroutine or blocking handler, copied off the read buffer: it outlives the request's turn on the connection
+struct AsyncCall {
+	std::string raw;																							// 	Head then body, req views into it
+	HttpRequest req;
+	HttpResponse res;
+	bool head_only = false;
+	const char* connection = "";
+	bool starting = true;																						// 	Still inside start(): it finished without suspending
+	bool done = false;
+};
+
+static std::string_view rebase(std::string_view v, const char* from, size_t len, const char* to) {
+	if (v.data() < from || v.data() >= from + len) { return v; }												// 	Route parameter names live in the router
+	return std::string_view(to + (v.data() - from), v.size());
+}
+
+static std::shared_ptr<AsyncCall> copy_call(Conn* conn) {
+	std::shared_ptr<AsyncCall> call = std::make_shared<AsyncCall>();
+	const char* head = (const char*)conn->read_buf.data() + conn->read_pos;
+	size_t head_len = conn->req.header_len;
+	call->raw.reserve(head_len + conn->req.body.size());
+	call->raw.append(head, head_len);
+	call->raw.append(conn->req.body);
+	const char* to = call->raw.data();
+	HttpRequest& req = call->req;
+	req = conn->req;
+	req.method = rebase(req.method, head, head_len, to);
+	req.target = rebase(req.target, head, head_len, to);
+	req.path = rebase(req.path, head, head_len, to);
+	req.query = rebase(req.query, head, head_len, to);
+	req.version = rebase(req.version, head, head_len, to);
+	for (size_t i = 0; i < req.num_headers; i++) {
+		req.headers[i].name = rebase(req.headers[i].name, head, head_len, to);
+		req.headers[i].value = rebase(req.headers[i].value, head, head_len, to);
+	}
+	for (size_t i = 0; i < req.num_params; i++) {
+		req.params[i].name = rebase(req.params[i].name, head, head_len, to);
+		req.params[i].value = rebase(req.params[i].value, head, head_len, to);
+	}
+	req.body = std::string_view(to + head_len, conn->req.body.size());
+	call->head_only = req.method == "HEAD";
+	call->connection = connection_header(conn);
+	return call;
+}
+
+// Encoding a response should be compressed with, ENCODING_IDENTITY when it should go as it is
+static int compress_encoding(const HttpRequest& req, const HttpResponse& res, bool headOnly) {
+	if (headOnly || res.status() != 200 || res.file() || res.contentLength() < K_COMPRESS_MIN_SIZE) { return ENCODING_IDENTITY; }
+	if (!res.header("Content-Encoding").empty() || !http_compressible(res.header("Content-Type"))) { return ENCODING_IDENTITY; }
+	return http_negotiate_encoding(req.header("Accept-Encoding"));
+}
+
+// Off the reactor: the response with its body compressed, or as it is when that gains nothing
+static std::shared_ptr<DeferredResponse> compress_response(const std::string& head, const std::shared_ptr<const std::string>& body, int encoding, const char* connection) {
+	std::shared_ptr<DeferredResponse> deferred = std::make_shared<DeferredResponse>();
+	std::shared_ptr<std::string> compressed = std::make_shared<std::string>();
+	bool smaller = http_compress(*body, encoding, *compressed) && compressed->size() < body->size();
+	deferred->head = head;
+	char line[128];
+	int len = smaller
+		? snprintf(line, sizeof(line), "Content-Encoding: %s\r\nContent-Length: %zu\r\n%s\r\n", http_encoding_name(encoding), compressed->size(), connection)
+		: snprintf(line, sizeof(line), "Content-Length: %zu\r\n%s\r\n", body->size(), connection);
+	deferred->head.append(line, len);
+	deferred->body = smaller ? std::shared_ptr<const std::string>(compressed) : body;
+	return deferred;
+}
+
+// Status line and headers of a 200 about to be compressed, up to where Content-Length goes
+static std::string compressed_head(const HttpResponse& res) {
+	std::string head;
+	std::string_view headers = res.headers();
+	head.reserve(headers.size() + 160);
+	head.append("HTTP/1.1 200 OK\r\n");
+	head.append(headers);
+	head.append("Vary: Accept-Encoding\r\n");
+	return head;
+}
+
+// Off the reactor: the response of a handler that ran on a copy of the request, compressed when it qualifies
+static std::shared_ptr<DeferredResponse> finish_call(AsyncCall& call) {
+	int encoding = compress_encoding(call.req, call.res, call.head_only);
+	if (encoding == ENCODING_IDENTITY) { return defer_response(call.res, call.head_only, call.connection); }
+	std::shared_ptr<const std::string> body = call.res.sharedBody() ? call.res.sharedBody() : call.res.takeBody();
+	return compress_response(compressed_head(call.res), body, encoding, call.connection);
+}
+
+EpollServer::Mailbox::Mailbox() {
+	wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);															// 	stop() writes here too so a blocked wait returns
+	if (wake_fd < 0) { die("eventfd"); }
+}
+
+EpollServer::Mailbox::~Mailbox() {
+	(void)close(wake_fd);
+}
+
+int64_t EpollServer::monotonic_ms() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+EpollServer::EpollServer(int maxEvents) : mailbox_(std::make_shared<Mailbox>()) {
+	setMaxEvents(maxEvents);
+}
+
+EpollServer::~EpollServer() {
+	mailbox_->closed = true;																					// 	Jobs still running elsewhere post into the void from now on
+	for (Conn* conn : conns_) {
+		if (!conn) { continue; }
+		(void)close(conn->fd);
+		conn_free(conn);
+	}
+	if (listen_fd_ >= 0) { (void)close(listen_fd_); }
+	if (reserve_fd_ >= 0) { (void)close(reserve_fd_); }
+	if (epoll_fd_ >= 0) { (void)close(epoll_fd_); }
+}
+
+void EpollServer::setupServer(int port, int timeoutMs) {
+	port_ = port;
+	timeout_ms_ = timeoutMs;
+	now_ms_ = monotonic_ms();
+	timers_.start(now_ms_);
+	openListener();
+
+	epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd_ < 0) { die("epoll_create1"); }
+	wake_fd_ = mailbox_->wake_fd;
+
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.fd = listen_fd_;
+	if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev)) { die("epoll_ctl(listen)"); }
+	ev.data.fd = wake_fd_;
+	if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev)) { die("epoll_ctl(wake)"); }
+}
+
+void EpollServer::openListener() {
+	signal(SIGPIPE, SIG_IGN);																					// 	A write to a peer that reset gives EPIPE instead of killing the process
+	listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd_ < 0) { die("socket"); }
+	int val = 1;
+	setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+	if (reuse_port_ && setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val))) { die("setsockopt(SO_REUSEPORT)"); }
+	set_nonblock(listen_fd_);
+
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port_);
+	addr.sin_addr.s_addr = ntohl(0);
+	int rv = bind(listen_fd_, (struct sockaddr*)&addr, sizeof(addr));
+	if (rv) { die("bind"); }
+
+	rv = listen(listen_fd_, backlog_);																			// 	The kernel caps it at net.core.somaxconn
+	if (rv) { die("listen"); }
+	reserve_fd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+void EpollServer::start() {
+	t_current = this;
+	running_ = true;
+	while (!stop_requested_) {																					// 	A stop() that arrives before start() still wins
+		pollOnce(-1);
+	}
+	stop_requested_ = false;
+	running_ = false;
+}
+
+void EpollServer::stop() {
+	stop_requested_ = true;
+	uint64_t one = 1;
+	ssize_t rv = write(wake_fd_, &one, sizeof(one));
+	(void)rv;
+}
+
+bool EpollServer::isRunning() const {
+	return running_;
+}
+
+std::unique_ptr<std::string> EpollServer::readRequest(int idleTime) {
+	using clock = std::chrono::steady_clock;
+	const auto deadline = clock::now() + std::chrono::milliseconds(idleTime);
+	t_current = this;
+	capture_ = true;
+	while (pending_.empty()) {
+		int wait = -1;
+		if (idleTime >= 0) {
+			auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+			if (left <= 0) { break; }
+			wait = (int)left;
+		}
+		pollOnce(wait);
+	}
+	capture_ = false;
+	if (pending_.empty()) { return nullptr; }
+	auto req = std::make_unique<std::string>(std::move(pending_.front()));
+	pending_.pop_front();
+	return req;
+}
+
+int EpollServer::getPort() const {
+	return port_;
+}
+
+void EpollServer::setMaxEvents(int maxEvents) {
+	events_.resize(maxEvents > 0 ? maxEvents : 1);
+}
+
+int EpollServer::getMaxEvents() const {
+	return (int)events_.size();
+}
+
+void EpollServer::setReusePort(bool reusePort) {
+	reuse_port_ = reusePort;
+}
+
+void EpollServer::setTimeouts(int idleMs, int headerMs, int writeMs) {
+	timeout_ms_ = idleMs;
+	header_timeout_ms_ = headerMs > 0 ? headerMs : -1;
+	write_timeout_ms_ = writeMs > 0 ? writeMs : -1;
+}
+
+void EpollServer::setBacklog(int backlog) {
+	backlog_ = backlog > 0 ? backlog : SOMAXCONN;
+}
+
+void EpollServer::setLimits(size_t maxConns, size_t maxBufferedBytes) {
+	max_conns_ = maxConns;
+	max_buffered_ = maxBufferedBytes;
+}
+
+void EpollServer::setResponseCache(std::shared_ptr<ResponseCache> cache) {
+	cache_ = std::move(cache);
+}
+
+bool EpollServer::addRoute(const std::string& method, const std::string& pattern, RouteHandler handler, BodyHandler bodyHandler) {
+	return router_.add(method, pattern, std::move(handler), std::move(bodyHandler));
+}
+
+bool EpollServer::addBlockingRoute(const std::string& method, const std::string& pattern, RouteHandler handler) {
+	return router_.add(method, pattern, std::move(handler), nullptr, true);
+}
+
+bool EpollServer::addAsyncRoute(const std::string& method, const std::string& pattern, AsyncHandler handler) {
+	return router_.addAsync(method, pattern, std::move(handler));
+}
+
+EpollServer* EpollServer::current() {
+	return t_current;
+}
+
+std::function<void(std::function<void()>)> EpollServer::poster() const {
+	std::shared_ptr<Mailbox> mailbox = mailbox_;
+	return [mailbox](std::function<void()> job) { post(mailbox, std::move(job)); };
+}
+
+int EpollServer::nextWaitMs(int timeoutMs) const {
+	int64_t now = monotonic_ms();
+	int wait = timers_.nextTimeoutMs(now);
+	int sleep = sleepers_.nextTimeoutMs(now);
+	if (sleep >= 0 && (wait < 0 || sleep < wait)) { wait = sleep; }
+	if (timeoutMs >= 0 && (wait < 0 || timeoutMs < wait)) { wait = timeoutMs; }
+	return wait;
+}
+
+// Wait for events, but never past the next connection deadline, then reap what expired
+int EpollServer::pollOnce(int timeoutMs) {
+	int wait = nextWaitMs(timeoutMs);
+	if (accept_pending_) { wait = 0; }																			// 	Connections are still queued, the edge won't come again
+	int n = epoll_wait(epoll_fd_, events_.data(), (int)events_.size(), wait);
+	if (n < 0) {
+		if (errno == EINTR) { return 0; }
+		die("epoll_wait");
+	}
+	now_ms_ = monotonic_ms();
+	if (n > 0) { Metrics::local().record(H_READY_EVENTS, (uint64_t)n); }
+	if (accept_pending_) { acceptAll(); }
+	for (int i = 0; i < n; i++) {
+		int fd = events_[i].data.fd;
+		uint32_t ready = events_[i].events;
+		if (fd == listen_fd_) {
+			acceptAll();
+			continue;
+		}
+		if (fd == wake_fd_) {
+			uint64_t val;
+			while (read(wake_fd_, &val, sizeof(val)) > 0) { }
+			continue;
+		}
+		if ((size_t)fd < watchers_.size() && watchers_[fd]) {
+			wakeWatcher(fd, ready);
+			continue;
+		}
+		if ((size_t)fd >= conns_.size() || !conns_[fd]) { continue; }
+		Conn* conn = conns_[fd];
+		if (ready & (EPOLLERR | EPOLLHUP)) {
+			conn->state = STATE_CLOSE;
+		} else {
+			serviceConn(conn);
+		}
+		if (conn->state == STATE_CLOSE) {
+			closeConn(conn);
+		} else {
+			armTimer(conn);
+			charge(conn);
+		}
+	}
+	runPosted();
+	timers_.advance(now_ms_, [this](TimerNode* timer) {
+		Conn* conn = (Conn*)timer->data;
+		LOG_DEBUG("Timeout (%i) on %i", conn->timeout_kind, conn->fd);
+		Metrics::local().add(M_TIMEOUTS);
+		closeConn(conn);
+	});
+	expireSleepers();
+	return n;
+}
+
+/* 	With EPOLLET the listener only reports new connections once, so accept until the queue is
+	empty, at most K_ACCEPT_BATCH per turn so a connection storm does not starve the open ones
+	(accept_pending_ brings us back without waiting). Errors are never fatal: on EMFILE/ENFILE
+	the connection is taken with the reserve fd and refused, past the limits it gets a 503. */
+void EpollServer::acceptAll() {
+	accept_pending_ = false;
+	for (int accepted = 0; ; accepted++) {
+		if (accepted == K_ACCEPT_BATCH) {
+			accept_pending_ = true;
+			return;
+		}
+		struct sockaddr_in addr = {};
+		socklen_t addrlen = sizeof(addr);
+		int client_fd = accept4(listen_fd_, (struct sockaddr*)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (client_fd < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) { return; }
+			if (errno == EINTR || errno == ECONNABORTED) { continue; }
+			if ((errno == EMFILE || errno == ENFILE) && acceptOverflow()) { continue; }
+			LOG_WARN("accept: %s", strerror(errno));																// 	ENOBUFS, ENOMEM, EMFILE without a spare: try again next turn
+			return;
+		}
+		if (overloaded()) {
+			reject(client_fd);
+			continue;
+		}
+		LOG_DEBUG("Accepted connection from %s:%d, fd: %i", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port), client_fd);
+		Conn* conn = openConn(client_fd);
+
+		struct epoll_event ev = {};
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;														// 	Registered once, both directions, never EPOLL_CTL_MOD
+		ev.data.fd = client_fd;
+		if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client_fd, &ev)) {
+			LOG_ERROR("epoll_ctl(conn): %s", strerror(errno));
+			closeConn(conn);
+		}
+	}
+}
+
+bool EpollServer::overloaded() const {
+	return (max_conns_ && open_conns_ >= max_conns_) || (max_buffered_ && buffered_bytes_ >= max_buffered_);
+}
+
+// Refuse a connection before it costs anything: one send of a canned 503 (the socket buffer is empty, it can't block) and close
+void EpollServer::reject(int fd) {
+	static const char K_BUSY[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nRetry-After: 1\r\nConnection: close\r\n\r\n";
+	ssize_t rv = send(fd, K_BUSY, sizeof(K_BUSY) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+	(void)rv;
+	(void)close(fd);
+	Metrics::local().add(M_REJECTS);
+	LOG_DEBUG("Rejected connection, %zu open, %zu bytes buffered", open_conns_, buffered_bytes_);
+}
+
+/* 	Out of fds: the connection would stay in the backlog and the listener keep waking us up for
+	it. Free the spare fd, take the connection with it, refuse it and take the spare back. */
+bool EpollServer::acceptOverflow() {
+	LOG_DEBUG("accept: %s, refusing a connection", strerror(errno));
+	if (reserve_fd_ >= 0) {
+		(void)close(reserve_fd_);
+		reserve_fd_ = -1;
+	}
+	int fd = accept4(listen_fd_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd >= 0) { reject(fd); }
+	reserve_fd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	return fd >= 0;																								// 	false: nothing to free, wait for the next edge
+}
+
+// Keep buffered_bytes_ in step with what the connection holds after an event
+void EpollServer::charge(Conn* conn) {
+	size_t now = conn->read_buf.capacity() + conn->out.size();
+	buffered_bytes_ += now - conn->charged;
+	conn->charged = now;
+}
+
+Conn* EpollServer::openConn(int fd) {
+	Metrics::local().add(M_ACCEPTS);
+	open_conns_++;
+	Conn* conn = conn_new();																					// 	Pooled, no buffer memory until the first read
+	conn->fd = fd;
+	conn->state = STATE_READ;
+	if (conns_.size() <= (size_t)conn->fd) {
+		conns_.resize(conn->fd + 1);
+	}
+	conns_[conn->fd] = conn;
+	conn->timer.data = conn;
+	armTimer(conn);																								// 	Idle until the first request arrives
+	return conn;
+}
+
+/* 	Drive the connection until both directions would block. Reads are paused while a
+	response is pending, so once the write buffer drains we must try to read again:
+	the EPOLLIN edge may already have been consumed. Requests already buffered
+	(pipelined) are answered before reading more. */
+void EpollServer::serviceConn(Conn* conn) {
+	bool progress = true;
+	while (progress && conn->state != STATE_CLOSE) {
+		progress = false;
+		if (conn->state == STATE_WRITE) {
+			while (handle_write(conn)) { }
+			if (conn->state == STATE_READ) { progress = true; }
+		}
+		if (conn->state == STATE_READ) {
+			do {
+				processRequests(conn);
+				if (!conn->out.empty() || conn->state != STATE_READ || conn->pending_job) { break; }
+			} while (handle_read(conn));
+			if (!conn->out.empty() && conn->state != STATE_CLOSE) {
+				conn->state = STATE_WRITE;																		// 	All the responses of this batch go out with one write
+				progress = true;
+			}
+		}
+	}
+}
+
+// Answer every complete request in the read buffer, in order, until the output queue is too full
+void EpollServer::processRequests(Conn* conn) {
+	if (conn->deferred) {																						// 	Its turn has come, everything before it is queued
+		DeferredResponse& deferred = *conn->deferred;
+		conn->out.append(deferred.head.data(), deferred.head.size());
+		if (deferred.body) { conn->out.appendShared(deferred.body, 0, deferred.body->size()); }
+		if (deferred.file) { conn->out.appendFile(deferred.file, deferred.file_offset, deferred.file_length); }
+		conn->deferred.reset();
+	}
+	while (conn->out.size() < K_WRITE_HIGH_WATER && !conn->pending_job) {
+		if (!conn->in_body) {
+			uint64_t parse_start = metrics_now_ns();
+			if (!parse_request(conn)) { return; }
+			Metrics::local().record(H_PARSE_NS, metrics_now_ns() - parse_start);							// 	Only the call that completes the head, earlier ones found nothing
+			if (!start_body(conn)) { return; }
+			conn->route = router_.match(&conn->req);
+			conn->body_buf.clear();
+			conn->body_overflow = false;
+			bool buffered = (conn->route.handler && !conn->route.body_handler) || conn->route.async_handler;
+			if (buffered && !conn->body.chunked() && conn->body.contentLength() > K_MAX_BUFFERED_BODY) {
+				conn->body_overflow = true;																		// 	Refuse before reading it, the connection is closed after the 413
+				onRequest(conn);
+				consume_request(conn);
+				return;
+			}
+			if (expects_continue(conn)) {
+				bool routed = conn->route.handler || conn->route.body_handler || conn->route.async_handler;
+				if (!routed || (max_buffered_ && buffered_bytes_ >= max_buffered_)) {
+					conn->close_after_write = true;																// 	404/405/503 already known: answer without a 100, the body is never read
+					onRequest(conn);
+					consume_request(conn);
+					return;
+				}
+				send_continue(conn);
+			}
+		}
+		BodySink sink;
+		if (conn->route.body_handler) {
+			sink = [conn](std::string_view data) { (*conn->route.body_handler)(conn->req, data, false); };
+		} else if (conn->route.handler || conn->route.async_handler) {
+			sink = [conn](std::string_view data) {
+				if (conn->body_buf.size() + data.size() > K_MAX_BUFFERED_BODY) { conn->body_overflow = true; return; }
+				conn->body_buf.append(data);
+			};
+		}
+		if (read_body(conn, sink) != BODY_DONE) { return; }
+		if (conn->route.body_handler) { (*conn->route.body_handler)(conn->req, std::string_view(), true); }
+		conn->req.body = conn->body_buf;
+		onRequest(conn);
+		consume_request(conn);
+		conn->timeout_kind = TIMEOUT_NONE;																		// 	A new request (or idle) starts, its timer is armed afresh
+	}
+}
+
+void EpollServer::onRequest(Conn* conn) {
+	if (capture_) {
+		pending_.emplace_back((const char*)conn->read_buf.data() + conn->read_pos, conn->req.header_len);
+	}
+	HttpResponse& res = response_;
+	res.reset();
+	Metrics& metrics = Metrics::local();
+	metrics.add(M_REQUESTS);
+	if (conn->body_overflow) {
+		res.setStatus(413);
+		conn->close_after_write = true;
+	} else if (max_buffered_ && buffered_bytes_ >= max_buffered_) {
+		res.setStatus(503);																						// 	Shed before running the handler, the client may retry elsewhere
+		res.setHeader("Retry-After", "1");
+		conn->close_after_write = true;
+		metrics.add(M_REJECTS);
+	} else if (conn->route.async_handler) {
+		runAsync(conn);
+		return;
+	} else if (conn->route.blocking) {
+		runBlocking(conn);
+		return;
+	} else if (conn->route.handler) {
+		if (cache_ && !conn->route.body_handler && (conn->req.method == "GET" || conn->req.method == "HEAD")) {
+			if (serveCached(conn)) { return; }
+		}
+		runHandler(conn, res);
+		respond(conn, res, conn->req.method == "HEAD");
+		return;
+	} else {
+		res.setStatus(conn->route.status);
+		if (conn->route.status == 405) {
+			std::string allow;
+			for (int m = 0; m < METHOD_COUNT; m++) {
+				if (!(conn->route.allowed & (1u << m))) { continue; }
+				if (!allow.empty()) { allow += ", "; }
+				allow += http_method_name(m);
+			}
+			res.setHeader("Allow", allow);
+		}
+	}
+	append_response(conn, res, conn->req.method == "HEAD");
+}
+
+/* 	Start the coroutine on a copy of the request. If it finishes without suspending it is
+	answered like any handler; otherwise the connection waits with pending_job set, as for a
+	compression, and the response is queued in order when the coroutine ends. An exception
+	that escapes the handler is a 500. */
+void EpollServer::runAsync(Conn* conn) {
+	std::shared_ptr<AsyncCall> call = copy_call(conn);
+	uint64_t job = ++job_seq_;
+	conn->pending_job = job;
+	int fd = conn->fd;
+	Task<> task = (*conn->route.async_handler)(call->req, call->res);
+	task.start([this, call, fd, job](std::exception_ptr error) {
+		if (error) {
+			try {
+				std::rethrow_exception(error);
+			} catch (const std::exception& e) {
+				LOG_ERROR("Async handler failed: %s", e.what());
+			} catch (...) {
+				LOG_ERROR("Async handler failed");
+			}
+			call->res.reset();
+			call->res.setStatus(500);
+		}
+		call->done = true;
+		if (call->starting) { return; }																		// 	runAsync answers it, processRequests is still on the stack
+		if (compress_encoding(call->req, call->res, call->head_only) == ENCODING_IDENTITY) {
+			onDeferred(fd, job, defer_response(call->res, call->head_only, call->connection));
+			return;
+		}
+		std::shared_ptr<Mailbox> mailbox = mailbox_;
+		WorkerPool::shared().submit([this, mailbox, call, fd, job]() {											// 	Compressed like the other routes, off the reactor
+			std::shared_ptr<DeferredResponse> deferred = finish_call(*call);
+			post(mailbox, [this, fd, job, deferred]() { onDeferred(fd, job, deferred); });					// 	this is only used from the reactor, and only while it exists
+		});
+	});
+	call->starting = false;
+	if (!call->done) { return; }
+	conn->pending_job = 0;
+	respond(conn, call->res, call->head_only);
+}
+
+/* 	The handler runs on a WorkerPool thread, so a CPU heavy one only holds up its own
+	connection, which waits with pending_job set until the response comes back through the
+	mailbox (pipelined requests behind it stay in order). The response is compressed there
+	too when it qualifies. A full pool sheds the request with a 503. */
+void EpollServer::runBlocking(Conn* conn) {
+	std::shared_ptr<AsyncCall> call = copy_call(conn);
+	RouteHandler handler = *conn->route.handler;																// 	A copy: the shared pool can still run the job after the Router is gone
+	uint64_t job = ++job_seq_;
+	int fd = conn->fd;
+	std::shared_ptr<Mailbox> mailbox = mailbox_;
+	bool queued = WorkerPool::shared().trySubmit([this, mailbox, handler = std::move(handler), call, fd, job]() {
+		uint64_t handler_start = metrics_now_ns();
+		try {
+			handler(call->req, call->res);
+		} catch (const std::exception& e) {
+			LOG_ERROR("Blocking handler failed: %s", e.what());
+			call->res.reset();
+			call->res.setStatus(500);
+		} catch (...) {																							// 	Escaping a pool thread would terminate the process
+			LOG_ERROR("Blocking handler failed");
+			call->res.reset();
+			call->res.setStatus(500);
+		}
+		Metrics::local().record(H_HANDLER_NS, metrics_now_ns() - handler_start);
+		std::shared_ptr<DeferredResponse> deferred = finish_call(*call);
+		post(mailbox, [this, fd, job, deferred]() { onDeferred(fd, job, deferred); });						// 	this is only used by the reactor, a closed mailbox drops the callback
+	});
+	if (!queued) {
+		HttpResponse& res = response_;
+		res.setStatus(503);
+		res.setHeader("Retry-After", "1");
+		Metrics::local().add(M_REJECTS);
+		append_response(conn, res, call->head_only);
+		return;
+	}
+	Metrics::local().add(M_OFFLOADS);
+	conn->pending_job = job;
+}
+
+void EpollServer::runHandler(Conn* conn, HttpResponse& res) {
+	uint64_t handler_start = metrics_now_ns();
+	(*conn->route.handler)(conn->req, res);
+	Metrics::local().record(H_HANDLER_NS, metrics_now_ns() - handler_start);
+}
+
+/* 	A hit (or a 304 for a matching If-None-Match) skips the handler. On a miss the handler
+	runs here and, when it opted in, its response is stored and served from the new entry so
+	the first client gets the ETag too. false: nothing was queued, answer as usual. */
+bool EpollServer::serveCached(Conn* conn) {
+	Metrics& metrics = Metrics::local();
+	bool head_only = conn->req.method == "HEAD";
+	cache_->key(conn->req, cache_key_);
+	std::shared_ptr<const CachedResponse> cached = cache_->get(cache_key_, now_ms_);
+	if (cached) {
+		metrics.add(M_CACHE_HITS);
+	} else {
+		metrics.add(M_CACHE_MISSES);
+		HttpResponse& res = response_;
+		runHandler(conn, res);
+		cached = cache_->put(cache_key_, res, now_ms_);
+		if (!cached) {
+			respond(conn, res, head_only);
+			return true;
+		}
+	}
+	if (cached->compressible) {
+		int encoding = http_negotiate_encoding(conn->req.header("Accept-Encoding"));
+		if (encoding != ENCODING_IDENTITY) {
+			std::shared_ptr<const CachedResponse> variant = cache_->variant(cache_key_, cached, encoding, now_ms_);
+			if (variant) { cached = std::move(variant); }
+		}
+	}
+	std::string_view if_none_match = conn->req.header("If-None-Match");
+	append_cached(conn, cached, head_only, !if_none_match.empty() && ResponseCache::etagMatches(if_none_match, cached->etag));
+	return true;
+}
+
+void EpollServer::respond(Conn* conn, HttpResponse& res, bool headOnly) {
+	if (compressAsync(conn, res, headOnly)) { return; }
+	append_response(conn, res, headOnly);
+}
+
+/* 	Big compressible bodies go to the WorkerPool instead of being sent as they are.
+	The connection stops answering its pipelined requests until the compressed response comes
+	back through the mailbox, so the responses stay in order; the other connections of the
+	reactor are not held up. */
+bool EpollServer::compressAsync(Conn* conn, HttpResponse& res, bool headOnly) {
+	int encoding = compress_encoding(conn->req, res, headOnly);
+	if (encoding == ENCODING_IDENTITY) { return false; }
+
+	std::shared_ptr<const std::string> body = res.sharedBody() ? res.sharedBody() : res.takeBody();
+	std::string head = compressed_head(res);
+	const char* connection = connection_header(conn);
+	uint64_t job = ++job_seq_;
+	conn->pending_job = job;
+	int fd = conn->fd;
+	std::shared_ptr<Mailbox> mailbox = mailbox_;
+	WorkerPool::shared().submit([this, mailbox, fd, job, encoding, body, head, connection]() {
+		std::shared_ptr<DeferredResponse> deferred = compress_response(head, body, encoding, connection);
+		post(mailbox, [this, fd, job, deferred]() { onDeferred(fd, job, deferred); });						// 	this is only used from the reactor, and only while it exists
+	});
+	return true;
+}
+
+void EpollServer::onDeferred(int fd, uint64_t job, std::shared_ptr<DeferredResponse> deferred) {
+	Conn* conn = (size_t)fd < conns_.size() ? conns_[fd] : NULL;
+	if (!conn || conn->pending_job != job || conn->state == STATE_CLOSE) { return; }						// 	Closed meanwhile, the fd may already be another connection
+	conn->pending_job = 0;
+	conn->deferred = std::move(deferred);
+	resumeConn(conn);
+}
+
+void EpollServer::resumeConn(Conn* conn) {
+	serviceConn(conn);
+	if (conn->state == STATE_CLOSE) {
+		closeConn(conn);
+	} else {
+		armTimer(conn);
+		charge(conn);
+	}
+}
+
+void EpollServer::post(const std::shared_ptr<Mailbox>& mailbox, std::function<void()> job) {
+	if (mailbox->closed.load(std::memory_order_acquire)) { return; }
+	if (mailbox->jobs.push(std::move(job)) == 0) {																// 	One wakeup per batch, the reactor takes all of them
+		uint64_t one = 1;
+		ssize_t rv = write(mailbox->wake_fd, &one, sizeof(one));
+		(void)rv;
+	}
+}
+
+void EpollServer::runPosted() {
+	mailbox_->jobs.drain([](std::function<void()>& job) { job(); });
+}
+
+bool EpollServer::park(CoWaiter* waiter) {
+	if (waiter->fd >= 0) {
+		if (!watchFd(waiter->fd, waiter->events)) {
+			waiter->revents = EPOLLERR;
+			return false;
+		}
+		if (watchers_.size() <= (size_t)waiter->fd) { watchers_.resize(waiter->fd + 1); }
+		watchers_[waiter->fd] = waiter;
+	}
+	if (waiter->timeout_ms >= 0) {
+		waiter->timer.data = waiter;
+		sleepers_.arm(&waiter->timer, monotonic_ms(), (uint32_t)waiter->timeout_ms);
+	}
+	return true;
+}
+
+bool EpollServer::watchFd(int fd, uint32_t events) {
+	struct epoll_event ev = {};
+	ev.events = events | EPOLLONESHOT;
+	ev.data.fd = fd;
+	if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev) == 0) { return true; }									// 	Still registered from its last wait
+	if (errno == ENOENT && epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) == 0) { return true; }
+	LOG_DEBUG("epoll_ctl(watch %i): %s", fd, strerror(errno));
+	return false;
+}
+
+void EpollServer::unwatchFd(int fd) {
+	(void)epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
+}
+
+void EpollServer::wakeWatcher(int fd, uint32_t revents) {
+	CoWaiter* waiter = watchers_[fd];
+	watchers_[fd] = NULL;
+	sleepers_.cancel(&waiter->timer);
+	waiter->revents = revents;
+	waiter->handle.resume();
+}
+
+void EpollServer::expireSleepers() {
+	sleepers_.advance(now_ms_, [this](TimerNode* timer) {
+		CoWaiter* waiter = (CoWaiter*)timer->data;
+		if (waiter->fd >= 0) {
+			watchers_[waiter->fd] = NULL;
+			unwatchFd(waiter->fd);
+		}
+		waiter->revents = 0;
+		waiter->handle.resume();
+	});
+}
+
+/* 	Pick the deadline for what the connection now waits for. Switching phase arms a new
+	timer; within a phase only the body and write timers restart on progress, the header one
+	counts from the first byte so a client trickling a head a byte at a time is still reaped. */
+void EpollServer::armTimer(Conn* conn) {
+	if (conn->pending_job) {																					// 	The server is the one late, not the peer
+		conn->timeout_kind = TIMEOUT_NONE;
+		timers_.cancel(&conn->timer);
+		return;
+	}
+	uint8_t kind = TIMEOUT_IDLE;
+	int ms = timeout_ms_;
+	if (!conn->out.empty()) {
+		kind = TIMEOUT_WRITE;
+		ms = write_timeout_ms_ ? write_timeout_ms_ : timeout_ms_;
+	} else if (conn->in_body) {
+		kind = TIMEOUT_BODY;
+		ms = header_timeout_ms_ ? header_timeout_ms_ : timeout_ms_;
+	} else if (conn->read_size > conn->read_pos) {
+		kind = TIMEOUT_HEADER;
+		ms = header_timeout_ms_ ? header_timeout_ms_ : timeout_ms_;
+	}
+	if (kind == conn->timeout_kind && (kind == TIMEOUT_IDLE || kind == TIMEOUT_HEADER)) { return; }
+	conn->timeout_kind = kind;
+	if (ms > 0) {
+		timers_.arm(&conn->timer, now_ms_, (uint32_t)ms);
+	} else {
+		timers_.cancel(&conn->timer);
+	}
+}
+
+void EpollServer::closeConn(Conn* conn) {
+	LOG_DEBUG("Closed on %i", conn->fd);
+	Metrics::local().add(M_CLOSES);
+	timers_.cancel(&conn->timer);
+	(void)epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->fd, NULL);
+	(void)close(conn->fd);
+	conns_[conn->fd] = NULL;
+	open_conns_--;
+	buffered_bytes_ -= conn->charged;
+	conn_free(conn);
+}
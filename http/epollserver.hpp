@@ -0,0 +1,134 @@
+#ifndef EPOLLSERVER_HPP
+#define EPOLLSERVER_HPP
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <string>
+#include <memory>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "iserver.hpp"
+#include "conn.hpp"
+#include "coro.hpp"
+#include "mpscqueue.hpp"
+#include "router.hpp"
+#include "timerwheel.hpp"
+
+const size_t K_WRITE_HIGH_WATER = 1 << 20;																		// 	Stop answering pipelined requests until the socket takes this much
+const int K_ACCEPT_BATCH = 64;																					// 	Connections accepted per wakeup, the rest wait for the next turn
+
+/* 	Edge-triggered epoll implementation of IServer.
+	Every fd (listener, wake eventfd and each connection) is registered once with
+	EPOLLIN | EPOLLOUT | EPOLLET and never modified again, so a wakeup only costs
+	the number of sockets that actually changed state. Because readiness is only
+	reported on edges, every handler keeps reading/writing until EAGAIN.
+	The fds coroutines wait on are the exception: EPOLLONESHOT, armed per wait. */
+class EpollServer : public IServer {
+public:
+	explicit EpollServer(int maxEvents = 1024);
+	~EpollServer() override;
+
+	void setupServer(int port, int timeoutMs) override;
+	void start() override;																						// 	Blocks running the event loop until stop() is called
+	void stop() override;																						// 	Safe to call from another thread or a signal handler
+	bool isRunning() const override;
+	std::unique_ptr<std::string> readRequest(int idleTime) override;											// 	Runs the loop until a request arrives or idleTime ms pass (nullptr)
+	bool addRoute(const std::string& method, const std::string& pattern, RouteHandler handler, BodyHandler bodyHandler = nullptr) override;
+	bool addAsyncRoute(const std::string& method, const std::string& pattern, AsyncHandler handler);			// 	Coroutine handler, see coro.hpp
+	bool addBlockingRoute(const std::string& method, const std::string& pattern, RouteHandler handler);		// 	CPU heavy or blocking handler, run on the WorkerPool
+
+	int getPort() const override;
+
+	void setMaxEvents(int maxEvents);																			// 	Size of the epoll_wait batch
+	int getMaxEvents() const;
+	void setReusePort(bool reusePort);																			// 	Must be called before setupServer, lets several reactors bind the same port
+	void setTimeouts(int idleMs, int headerMs, int writeMs);													// 	Override the timeoutMs of setupServer per phase, <= 0 disables one
+	void setBacklog(int backlog);																				// 	listen() queue length, before setupServer (SOMAXCONN by default)
+	void setLimits(size_t maxConns, size_t maxBufferedBytes);													// 	0 is unlimited; past a limit connections and requests get a cheap 503
+	void setResponseCache(std::shared_ptr<ResponseCache> cache);												// 	Consulted before GET/HEAD handlers, can be shared by several reactors
+
+	static EpollServer* current();																				// 	Reactor running on the calling thread, NULL outside one
+	bool park(CoWaiter* waiter);																				// 	Resume waiter->handle on readiness of its fd or at its timeout
+	std::function<void(std::function<void()>)> poster() const;												// 	Runs a job on this reactor, callable from any thread
+
+protected:																										// 	Shared with UringServer, which only replaces the I/O
+	/* 	Work handed back to the reactor by other threads, run from its loop: a lock-free MPSC
+		queue and the eventfd that wakes the reactor, written only when the queue was empty.
+		Posters keep the mailbox (and its eventfd) alive and not the server: once the server is
+		gone posting is a no-op. */
+	struct Mailbox {
+		Mailbox();
+		~Mailbox();
+		MpscQueue<std::function<void()>> jobs;
+		int wake_fd = -1;																						// 	Also the reactor's wake_fd_
+		std::atomic<bool> closed{false};																		// 	The server is destroyed
+	};
+
+	static void post(const std::shared_ptr<Mailbox>& mailbox, std::function<void()> job);						// 	Any thread, wakes the reactor
+	void runPosted();
+	virtual void resumeConn(Conn* conn);																		// 	Carry on after a deferred response is ready
+	void respond(Conn* conn, HttpResponse& res, bool headOnly);
+	bool compressAsync(Conn* conn, HttpResponse& res, bool headOnly);
+	void onDeferred(int fd, uint64_t job, std::shared_ptr<DeferredResponse> deferred);
+	void runAsync(Conn* conn);
+	void runBlocking(Conn* conn);
+	virtual bool watchFd(int fd, uint32_t events);																// 	One shot: wakeWatcher() once it is ready
+	virtual void unwatchFd(int fd);
+	void wakeWatcher(int fd, uint32_t revents);
+	void expireSleepers();
+	int nextWaitMs(int timeoutMs) const;
+	static int64_t monotonic_ms();
+	virtual int pollOnce(int timeoutMs);
+	void openListener();
+	Conn* openConn(int fd);																						// 	Pooled Conn for an accepted fd, in conns_ with its idle timer
+	void acceptAll();
+	void serviceConn(Conn* conn);
+	void processRequests(Conn* conn);
+	void onRequest(Conn* conn);
+	bool serveCached(Conn* conn);
+	void runHandler(Conn* conn, HttpResponse& res);
+	void closeConn(Conn* conn);
+	void armTimer(Conn* conn);
+	bool overloaded() const;
+	void reject(int fd);
+	bool acceptOverflow();
+	void charge(Conn* conn);
+
+	int port_ = 0;
+	int timeout_ms_ = -1;																						// 	Idle keep-alive, also header/body and write unless set apart
+	int header_timeout_ms_ = 0;																				// 	0: same as timeout_ms_
+	int write_timeout_ms_ = 0;
+	TimerWheel timers_;
+	TimerWheel sleepers_;																						// 	Timeouts of parked coroutines
+	std::vector<CoWaiter*> watchers_;																			// 	Indexed by fd, the coroutine waiting on it
+	int64_t now_ms_ = 0;																						// 	Monotonic time of the last epoll_wait return
+	bool reuse_port_ = false;
+	int backlog_ = SOMAXCONN;
+	size_t max_conns_ = 0;
+	size_t max_buffered_ = 0;
+	size_t open_conns_ = 0;
+	size_t buffered_bytes_ = 0;																					// 	Read buffers and output queues of every connection, at their last event
+	bool accept_pending_ = false;																				// 	The last accept batch stopped before EAGAIN
+	int reserve_fd_ = -1;																						// 	Spare fd given up to accept (and refuse) a connection on EMFILE
+	int listen_fd_ = -1;
+	int epoll_fd_ = -1;
+	int wake_fd_ = -1;
+	std::atomic<bool> running_{false};
+	std::atomic<bool> stop_requested_{false};
+	std::vector<struct epoll_event> events_;
+	std::vector<Conn*> conns_;																					// 	Indexed by fd, like the poll based servers
+	bool capture_ = false;																						// 	Only copy requests while someone is inside readRequest
+	std::deque<std::string> pending_;
+	Router router_;
+	HttpResponse response_;																						// 	Reused for every request, keeps its capacity
+	std::shared_ptr<Mailbox> mailbox_;
+	uint64_t job_seq_ = 0;
+	std::shared_ptr<ResponseCache> cache_;
+	std::string cache_key_;																						// 	Reused for every lookup
+};
+
+#endif // EPOLLSERVER_HPP
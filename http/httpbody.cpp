@@ -0,0 +1,152 @@
+#include "httpbody.hpp"
+
+const size_t K_MAX_TRAILER_SIZE = 8 << 10;
+const uint64_t K_MAX_CHUNK_SIZE = (uint64_t)1 << 60;															// 	Keeps size * 16 from overflowing
+const size_t K_MAX_CHUNK_SIZE_DIGITS = 32;																		// 	Leading zeros included, they don't grow the value
+
+static bool parse_content_length(std::string_view value, uint64_t* out) {
+	if (value.empty()) { return false; }
+	uint64_t n = 0;
+	for (char c : value) {
+		if (c < '0' || c > '9') { return false; }																// 	No sign, no spaces, no list ("5, 5")
+		if (n > (UINT64_MAX - 9) / 10) { return false; }
+		n = n * 10 + (uint64_t)(c - '0');
+	}
+	*out = n;
+	return true;
+}
+
+static int hex_value(uint8_t c) {
+	if (c >= '0' && c <= '9') { return c - '0'; }
+	if (c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+	if (c >= 'A' && c <= 'F') { return c - 'A' + 10; }
+	return -1;
+}
+
+bool BodyDecoder::init(const HttpRequest& req) {
+	chunked_ = false;
+	content_length_ = 0;
+	remaining_ = 0;
+	chunk_state_ = CHUNK_SIZE;
+	size_digits_ = 0;
+	trailer_bytes_ = 0;
+
+	bool have_length = false;
+	bool have_encoding = false;
+	for (size_t i = 0; i < req.num_headers; i++) {
+		const HttpHeader& h = req.headers[i];
+		if (http_iequals(h.name, "Content-Length")) {
+			uint64_t n = 0;
+			if (!parse_content_length(h.value, &n)) { return false; }
+			if (have_length && n != content_length_) { return false; }											// 	Conflicting duplicates
+			content_length_ = n;
+			have_length = true;
+		} else if (http_iequals(h.name, "Transfer-Encoding")) {
+			if (have_encoding) { return false; }
+			std::string_view coding = h.value;																	// 	Only "chunked" (last and alone) is understood
+			if (!http_iequals(coding, "chunked")) { return false; }
+			have_encoding = true;
+		}
+	}
+	if (have_encoding && have_length) { return false; }															// 	Both present is the classic request smuggling vector, refuse it
+	chunked_ = have_encoding;
+	remaining_ = chunked_ ? 0 : content_length_;
+	return true;
+}
+
+BodyStatus BodyDecoder::feed(const uint8_t* buf, size_t len, size_t* consumed, const BodySink& sink) {
+	if (chunked_) { return feedChunked(buf, len, consumed, sink); }
+	size_t n = remaining_ < len ? (size_t)remaining_ : len;
+	if (n > 0 && sink) { sink(std::string_view((const char*)buf, n)); }
+	remaining_ -= n;
+	*consumed = n;
+	return remaining_ == 0 ? BODY_DONE : BODY_INCOMPLETE;
+}
+
+BodyStatus BodyDecoder::feedChunked(const uint8_t* buf, size_t len, size_t* consumed, const BodySink& sink) {
+	const uint8_t* p = buf;
+	const uint8_t* end = buf + len;
+	while (p < end && chunk_state_ != CHUNK_DONE) {
+		uint8_t c = *p;
+		switch (chunk_state_) {
+			case CHUNK_SIZE: {
+				int v = hex_value(c);
+				if (v >= 0) {
+					if (remaining_ >= K_MAX_CHUNK_SIZE || size_digits_ == K_MAX_CHUNK_SIZE_DIGITS) { return BODY_ERROR; }
+					remaining_ = remaining_ * 16 + (uint64_t)v;
+					size_digits_++;
+				} else if (size_digits_ == 0) {
+					return BODY_ERROR;
+				} else if (c == ';' || c == ' ' || c == '\t') {
+					chunk_state_ = CHUNK_EXT;
+				} else if (c == '\r') {
+					chunk_state_ = CHUNK_SIZE_LF;
+				} else {
+					return BODY_ERROR;
+				}
+				p++;
+				break;
+			}
+			case CHUNK_EXT:																						// 	Chunk extensions are ignored
+				p = http_find_byte(p, end, '\r');
+				if (p < end) { chunk_state_ = CHUNK_SIZE_LF; p++; }
+				break;
+			case CHUNK_SIZE_LF:
+				if (c != '\n') { return BODY_ERROR; }
+				chunk_state_ = remaining_ == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+				size_digits_ = 0;
+				p++;
+				break;
+			case CHUNK_DATA: {
+				size_t n = remaining_ < (uint64_t)(end - p) ? (size_t)remaining_ : (size_t)(end - p);
+				if (sink) { sink(std::string_view((const char*)p, n)); }
+				remaining_ -= n;
+				p += n;
+				if (remaining_ == 0) { chunk_state_ = CHUNK_DATA_CR; }
+				break;
+			}
+			case CHUNK_DATA_CR:
+				if (c != '\r') { return BODY_ERROR; }
+				chunk_state_ = CHUNK_DATA_LF;
+				p++;
+				break;
+			case CHUNK_DATA_LF:
+				if (c != '\n') { return BODY_ERROR; }
+				chunk_state_ = CHUNK_SIZE;
+				p++;
+				break;
+			case CHUNK_TRAILER:																					// 	Start of a trailer line, or the final empty line
+				chunk_state_ = c == '\r' ? CHUNK_FINAL_LF : CHUNK_TRAILER_LINE;
+				p++;
+				break;
+			case CHUNK_TRAILER_LINE: {																			// 	Trailer fields are skipped
+				const uint8_t* cr = http_find_byte(p, end, '\r');
+				trailer_bytes_ += (size_t)(cr - p);
+				if (trailer_bytes_ > K_MAX_TRAILER_SIZE) { return BODY_ERROR; }
+				p = cr;
+				if (p < end) { chunk_state_ = CHUNK_TRAILER_LF; p++; }
+				break;
+			}
+			case CHUNK_TRAILER_LF:
+				if (c != '\n') { return BODY_ERROR; }
+				chunk_state_ = CHUNK_TRAILER;
+				p++;
+				break;
+			case CHUNK_FINAL_LF:
+				if (c != '\n') { return BODY_ERROR; }
+				chunk_state_ = CHUNK_DONE;
+				p++;
+				break;
+		}
+	}
+	*consumed = (size_t)(p - buf);
+	return chunk_state_ == CHUNK_DONE ? BODY_DONE : BODY_INCOMPLETE;
+}
+
+bool BodyDecoder::chunked() const {
+	return chunked_;
+}
+
+uint64_t BodyDecoder::contentLength() const {
+	return content_length_;
+}
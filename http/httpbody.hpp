@@ -0,0 +1,57 @@
+#ifndef HTTPBODY_HPP
+#define HTTPBODY_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <string_view>
+
+#include "httpparser.hpp"
+
+enum BodyStatus {
+	BODY_INCOMPLETE,
+	BODY_DONE,
+	BODY_ERROR
+};
+
+// Receives the body as it arrives, the view is only valid during the call
+typedef std::function<void(std::string_view data)> BodySink;
+
+/* 	Message body framing (RFC 9112 section 6): Content-Length or chunked transfer coding.
+	feed() is called with whatever bytes follow the head, it hands the decoded data to the
+	sink without buffering it and reports how many input bytes belong to the body, so what
+	follows is the next pipelined request. */
+class BodyDecoder {
+public:
+	bool init(const HttpRequest& req);																			// 	false when the framing headers are invalid or ambiguous
+	BodyStatus feed(const uint8_t* buf, size_t len, size_t* consumed, const BodySink& sink);
+
+	bool chunked() const;
+	uint64_t contentLength() const;																				// 	Declared length, 0 for chunked bodies
+
+private:
+	BodyStatus feedChunked(const uint8_t* buf, size_t len, size_t* consumed, const BodySink& sink);
+
+	enum {
+		CHUNK_SIZE,
+		CHUNK_EXT,
+		CHUNK_SIZE_LF,
+		CHUNK_DATA,
+		CHUNK_DATA_CR,
+		CHUNK_DATA_LF,
+		CHUNK_TRAILER,
+		CHUNK_TRAILER_LINE,
+		CHUNK_TRAILER_LF,
+		CHUNK_FINAL_LF,
+		CHUNK_DONE
+	};
+
+	bool chunked_ = false;
+	uint64_t content_length_ = 0;
+	uint64_t remaining_ = 0;																					// 	Bytes left in the body (Content-Length) or in the current chunk
+	uint8_t chunk_state_ = CHUNK_SIZE;
+	size_t size_digits_ = 0;
+	size_t trailer_bytes_ = 0;
+};
+
+#endif // HTTPBODY_HPP
@@ -0,0 +1,181 @@
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HTTP_HAVE_X86 1
+#endif
+
+#include "httpparser.hpp"
+
+struct TcharTable {																								// 	RFC 9110 token characters (method and header names)
+	bool v[256];
+	constexpr TcharTable() : v() {
+		for (int c = '0'; c <= '9'; c++) { v[c] = true; }
+		for (int c = 'A'; c <= 'Z'; c++) { v[c] = true; v[c + 32] = true; }
+		for (const char* s = "!#$%&'*+-.^_`|~"; *s; s++) { v[(uint8_t)*s] = true; }
+	}
+};
+
+static constexpr TcharTable K_TCHAR;
+
+static bool is_tchar(uint8_t c) {
+	return K_TCHAR.v[c];
+}
+
+static const uint8_t* find_byte_scalar(const uint8_t* p, const uint8_t* end, uint8_t c) {
+	while (p < end && *p != c) { p++; }
+	return p;
+}
+
+#if defined(HTTP_HAVE_X86) && !defined(HTTP_PARSER_SCALAR)
+static const uint8_t* find_byte_sse2(const uint8_t* p, const uint8_t* end, uint8_t c) {
+	const __m128i needle = _mm_set1_epi8((char)c);
+	while (end - p >= 16) {
+		__m128i chunk = _mm_loadu_si128((const __m128i*)p);
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));											// 	One bit per byte that matched
+		if (mask) { return p + __builtin_ctz(mask); }
+		p += 16;
+	}
+	return find_byte_scalar(p, end, c);
+}
+
+__attribute__((target("avx2")))
+static const uint8_t* find_byte_avx2(const uint8_t* p, const uint8_t* end, uint8_t c) {
+	const __m256i needle = _mm256_set1_epi8((char)c);
+	while (end - p >= 32) {
+		__m256i chunk = _mm256_loadu_si256((const __m256i*)p);
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+		if (mask) { return p + __builtin_ctz(mask); }
+		p += 32;
+	}
+	return find_byte_sse2(p, end, c);
+}
+
+typedef const uint8_t* (*find_byte_fn)(const uint8_t*, const uint8_t*, uint8_t);
+
+static find_byte_fn resolve_find_byte() {																		// 	Picked once at startup, the binary runs on CPUs without AVX2
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") ? find_byte_avx2 : find_byte_sse2;
+}
+
+static const find_byte_fn g_find_byte = resolve_find_byte();
+
+const uint8_t* http_find_byte(const uint8_t* p, const uint8_t* end, uint8_t c) {
+	return g_find_byte(p, end, c);
+}
+#else
+const uint8_t* http_find_byte(const uint8_t* p, const uint8_t* end, uint8_t c) {
+	return find_byte_scalar(p, end, c);
+}
+#endif
+
+bool http_iequals(std::string_view a, std::string_view b) {
+	if (a.size() != b.size()) { return false; }
+	for (size_t i = 0; i < a.size(); i++) {
+		uint8_t x = (uint8_t)a[i], y = (uint8_t)b[i];
+		if ((uint8_t)(x - 'A') < 26) { x += 32; }
+		if ((uint8_t)(y - 'A') < 26) { y += 32; }
+		if (x != y) { return false; }
+	}
+	return true;
+}
+
+std::string_view HttpRequest::header(std::string_view name) const {
+	for (size_t i = 0; i < num_headers; i++) {
+		if (http_iequals(headers[i].name, name)) { return headers[i].value; }
+	}
+	return std::string_view();
+}
+
+std::string_view HttpRequest::param(std::string_view name) const {
+	for (size_t i = 0; i < num_params; i++) {
+		if (params[i].name == name) { return params[i].value; }
+	}
+	return std::string_view();
+}
+
+static std::string_view make_view(const uint8_t* begin, const uint8_t* end) {
+	return std::string_view((const char*)begin, (size_t)(end - begin));
+}
+
+// Split a complete head (it ends with \r\n\r\n) into request line and headers
+static ParseStatus parse_head(const uint8_t* buf, const uint8_t* head_end, HttpRequest* req) {
+	const uint8_t* line_end = http_find_byte(buf, head_end, '\r');
+	if (line_end[1] != '\n') { return PARSE_ERROR; }
+
+	const uint8_t* sp1 = http_find_byte(buf, line_end, ' ');
+	if (sp1 == buf || sp1 == line_end) { return PARSE_ERROR; }
+	for (const uint8_t* c = buf; c < sp1; c++) {
+		if (!is_tchar(*c)) { return PARSE_ERROR; }
+	}
+	const uint8_t* target = sp1 + 1;
+	const uint8_t* sp2 = http_find_byte(target, line_end, ' ');
+	if (sp2 == target || sp2 == line_end) { return PARSE_ERROR; }
+	for (const uint8_t* c = target; c < sp2; c++) {
+		if (*c < 0x21 || *c == 0x7f) { return PARSE_ERROR; }													// 	No CTL, NUL or DEL, they would end up in the path
+	}
+	const uint8_t* version = sp2 + 1;
+	if (line_end - version != 8 || memcmp(version, "HTTP/1.", 7) != 0) { return PARSE_ERROR; }
+	if (version[7] != '0' && version[7] != '1') { return PARSE_ERROR; }
+
+	req->method = make_view(buf, sp1);
+	req->target = make_view(target, sp2);
+	const uint8_t* qmark = http_find_byte(target, sp2, '?');
+	req->path = make_view(target, qmark);
+	req->query = qmark == sp2 ? std::string_view() : make_view(qmark + 1, sp2);
+	req->version = make_view(version, line_end);
+	req->minor_version = version[7] - '0';
+	req->num_headers = 0;
+	req->num_params = 0;
+	req->body = std::string_view();
+
+	const uint8_t* p = line_end + 2;
+	while (true) {
+		line_end = http_find_byte(p, head_end, '\r');
+		if (line_end[1] != '\n') { return PARSE_ERROR; }
+		if (line_end == p) { break; }																			// 	Empty line, end of the head
+		if (*p == ' ' || *p == '\t') { return PARSE_ERROR; }													// 	Obsolete line folding is rejected (RFC 9112 5.2)
+		if (req->num_headers == K_MAX_HEADERS) { return PARSE_ERROR; }
+
+		const uint8_t* colon = http_find_byte(p, line_end, ':');
+		if (colon == p || colon == line_end) { return PARSE_ERROR; }
+		for (const uint8_t* c = p; c < colon; c++) {
+			if (!is_tchar(*c)) { return PARSE_ERROR; }														// 	Also rejects "Name :" (whitespace before the colon)
+		}
+		const uint8_t* vbegin = colon + 1;
+		const uint8_t* vend = line_end;
+		while (vbegin < vend && (*vbegin == ' ' || *vbegin == '\t')) { vbegin++; }
+		while (vend > vbegin && (vend[-1] == ' ' || vend[-1] == '\t')) { vend--; }
+		for (const uint8_t* c = vbegin; c < vend; c++) {
+			if ((*c < 0x20 && *c != '\t') || *c == 0x7f) { return PARSE_ERROR; }							// 	A bare \n or NUL here is a smuggling attempt
+		}
+		req->headers[req->num_headers].name = make_view(p, colon);
+		req->headers[req->num_headers].value = make_view(vbegin, vend);
+		req->num_headers++;
+		p = line_end + 2;
+	}
+	req->header_len = (size_t)(head_end - buf);
+	return PARSE_DONE;
+}
+
+ParseStatus HttpParser::parse(const uint8_t* buf, size_t len, HttpRequest* req) {
+	const uint8_t* end = buf + len;
+	const uint8_t* p = buf + scan_pos_;
+	while (true) {
+		p = http_find_byte(p, end, '\r');
+		if (end - p < 4) { break; }
+		if (p[1] == '\n' && p[2] == '\r' && p[3] == '\n') {
+			scan_pos_ = 0;
+			if ((size_t)(p + 4 - buf) > K_MAX_HEAD_SIZE) { return PARSE_ERROR; }								// 	Arrived whole in one burst, the limit still holds
+			return parse_head(buf, p + 4, req);
+		}
+		p++;
+	}
+	scan_pos_ = (size_t)(p - buf);																				// 	Resume at the '\r' (or the end) next time, never rescan bytes
+	if (len > K_MAX_HEAD_SIZE) { return PARSE_ERROR; }
+	return PARSE_INCOMPLETE;
+}
+
+void HttpParser::reset() {
+	scan_pos_ = 0;
+}
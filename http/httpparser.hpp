@@ -0,0 +1,66 @@
+#ifndef HTTPPARSER_HPP
+#define HTTPPARSER_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+
+const size_t K_MAX_HEADERS = 64;
+const size_t K_MAX_HEAD_SIZE = 64 << 10;																		// 	Request line + headers, bigger heads are rejected
+const size_t K_MAX_PARAMS = 8;
+
+struct HttpHeader {
+	std::string_view name;
+	std::string_view value;
+};
+
+struct HttpParam {
+	std::string_view name;
+	std::string_view value;
+};
+
+/* 	Every field is a view into the connection read buffer, nothing is copied or allocated.
+	The views are only valid until the bytes they point to are consumed from the buffer. */
+struct HttpRequest {
+	std::string_view method;
+	std::string_view target;																					// 	path + '?' + query, as sent
+	std::string_view path;
+	std::string_view query;																						// 	Without the '?', empty when there is none
+	std::string_view version;																					// 	"HTTP/1.1"
+	int minor_version = 1;
+	HttpHeader headers[K_MAX_HEADERS];
+	size_t num_headers = 0;
+	size_t header_len = 0;																						// 	Bytes up to and including the final \r\n\r\n
+	HttpParam params[K_MAX_PARAMS];																				// 	Filled by the router from ":name" and "*name" segments
+	size_t num_params = 0;
+	std::string_view body;																						// 	Whole body for buffered routes, empty for streaming ones
+
+	std::string_view header(std::string_view name) const;														// 	Case-insensitive lookup, empty view when missing
+	std::string_view param(std::string_view name) const;
+};
+
+enum ParseStatus {
+	PARSE_INCOMPLETE,
+	PARSE_DONE,
+	PARSE_ERROR
+};
+
+/* 	Incremental HTTP/1.1 request head parser.
+	The end of the head is searched with SSE2/AVX2 (scalar when neither is available) and the
+	search resumes where the previous call stopped, so bytes of a slowly arriving request are
+	scanned once. When the terminator is found the head is split in a single pass. */
+class HttpParser {
+public:
+	ParseStatus parse(const uint8_t* buf, size_t len, HttpRequest* req);
+	void reset();																								// 	Call after a request has been consumed from the buffer
+
+private:
+	size_t scan_pos_ = 0;
+};
+
+// Exposed for the other parsers (body framing, headers values): first byte equal to c, or end
+const uint8_t* http_find_byte(const uint8_t* p, const uint8_t* end, uint8_t c);
+
+bool http_iequals(std::string_view a, std::string_view b);
+
+#endif // HTTPPARSER_HPP
@@ -0,0 +1,120 @@
+#include "httpresponse.hpp"
+#include "httpparser.hpp"
+
+void HttpResponse::setStatus(int code) {
+	status_ = code;
+}
+
+void HttpResponse::setHeader(std::string_view name, std::string_view value) {
+	headers_.append(name);
+	headers_.append(": ", 2);
+	headers_.append(value);
+	headers_.append("\r\n", 2);
+}
+
+void HttpResponse::write(std::string_view data) {
+	body_.append(data);
+}
+
+void HttpResponse::setSharedBody(std::shared_ptr<const std::string> body) {
+	body_.clear();
+	file_.reset();
+	shared_body_ = std::move(body);
+}
+
+void HttpResponse::sendFile(std::shared_ptr<const OpenFile> file, off_t offset, size_t length) {
+	body_.clear();
+	shared_body_.reset();
+	file_ = std::move(file);
+	file_offset_ = offset;
+	file_length_ = length;
+}
+
+void HttpResponse::setCacheTtl(int ms) {
+	cache_ttl_ = ms;
+}
+
+void HttpResponse::reset() {
+	status_ = 200;
+	headers_.clear();																							// 	clear() keeps the capacity
+	body_.clear();
+	shared_body_.reset();
+	file_.reset();
+	file_offset_ = 0;
+	file_length_ = 0;
+	cache_ttl_ = 0;
+}
+
+int HttpResponse::status() const {
+	return status_;
+}
+
+std::string_view HttpResponse::headers() const {
+	return headers_;
+}
+
+std::string_view HttpResponse::header(std::string_view name) const {
+	std::string_view rest = headers_;
+	while (!rest.empty()) {
+		size_t eol = rest.find("\r\n");
+		std::string_view line = rest.substr(0, eol);
+		rest.remove_prefix(eol + 2);
+		size_t colon = line.find(':');
+		if (colon == name.size() && http_iequals(line.substr(0, colon), name)) { return line.substr(colon + 2); }	// 	setHeader() writes "Name: value"
+	}
+	return std::string_view();
+}
+
+const std::string& HttpResponse::body() const {
+	return body_;
+}
+
+const std::shared_ptr<const std::string>& HttpResponse::sharedBody() const {
+	return shared_body_;
+}
+
+std::shared_ptr<const std::string> HttpResponse::takeBody() {
+	return std::make_shared<const std::string>(std::move(body_));
+}
+
+const std::shared_ptr<const OpenFile>& HttpResponse::file() const {
+	return file_;
+}
+
+off_t HttpResponse::fileOffset() const {
+	return file_offset_;
+}
+
+size_t HttpResponse::contentLength() const {
+	if (file_) { return file_length_; }
+	return shared_body_ ? shared_body_->size() : body_.size();
+}
+
+int HttpResponse::cacheTtl() const {
+	return cache_ttl_;
+}
+
+const char* http_status_text(int code) {
+	switch (code) {
+		case 100: return "Continue";
+		case 200: return "OK";
+		case 201: return "Created";
+		case 204: return "No Content";
+		case 206: return "Partial Content";
+		case 301: return "Moved Permanently";
+		case 302: return "Found";
+		case 304: return "Not Modified";
+		case 400: return "Bad Request";
+		case 403: return "Forbidden";
+		case 404: return "Not Found";
+		case 405: return "Method Not Allowed";
+		case 408: return "Request Timeout";
+		case 413: return "Content Too Large";
+		case 416: return "Range Not Satisfiable";
+		case 431: return "Request Header Fields Too Large";
+		case 500: return "Internal Server Error";
+		case 501: return "Not Implemented";
+		case 503: return "Service Unavailable";
+		default: return "Unknown";
+	}
+}
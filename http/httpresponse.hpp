@@ -0,0 +1,49 @@
+#ifndef HTTPRESPONSE_HPP
+#define HTTPRESPONSE_HPP
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <sys/types.h>
+
+struct OpenFile;
+
+/* 	What a handler fills in. The server owns one per reactor and reset()s it between
+	requests, so the header and body strings keep their capacity and a steady stream of
+	requests does not allocate. Content-Length and Connection are added by the server. */
+class HttpResponse {
+public:
+	void setStatus(int code);
+	void setHeader(std::string_view name, std::string_view value);
+	void write(std::string_view data);																			// 	Append to the body
+	void setSharedBody(std::shared_ptr<const std::string> body);												// 	Refcounted body, written without copying
+	void sendFile(std::shared_ptr<const OpenFile> file, off_t offset, size_t length);							// 	Body is a file range, sent with sendfile()
+	void setCacheTtl(int ms);																					// 	Let the server's ResponseCache answer this request for ms (200s only)
+	void reset();
+
+	int status() const;
+	std::string_view headers() const;																			// 	Already formatted "Name: value\r\n" lines
+	std::string_view header(std::string_view name) const;														// 	Value of a header set by the handler, empty when missing
+	const std::string& body() const;
+	const std::shared_ptr<const std::string>& sharedBody() const;
+	std::shared_ptr<const std::string> takeBody();																// 	Moves the written body out, for bodies too big to copy
+	const std::shared_ptr<const OpenFile>& file() const;
+	off_t fileOffset() const;
+	size_t contentLength() const;
+	int cacheTtl() const;
+
+private:
+	int status_ = 200;
+	std::string headers_;
+	std::string body_;
+	std::shared_ptr<const std::string> shared_body_;
+	std::shared_ptr<const OpenFile> file_;
+	off_t file_offset_ = 0;
+	size_t file_length_ = 0;
+	int cache_ttl_ = 0;
+};
+
+const char* http_status_text(int code);
+
+#endif // HTTPRESPONSE_HPP
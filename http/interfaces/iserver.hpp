@@ -4,6 +4,8 @@
 #include <string>
 #include <memory>
 
+#include "router.hpp"
+
 class IServer {
 public:
     virtual ~IServer() = default;
@@ -13,6 +15,7 @@ public:
     virtual void stop() = 0;
     virtual bool isRunning() const = 0;
     virtual std::unique_ptr<std::string> readRequest(int idleTime) = 0;
+    virtual bool addRoute(const std::string& method, const std::string& pattern, RouteHandler handler, BodyHandler bodyHandler = nullptr) = 0;
 
     virtual int getPort() const = 0;
 };
@@ -0,0 +1,97 @@
+#ifndef MPSCQUEUE_HPP
+#define MPSCQUEUE_HPP
+
+#include <atomic>
+#include <thread>
+#include <utility>
+
+/* 	Unbounded lock-free multi-producer single-consumer queue (Vyukov's intrusive list).
+	push() is one exchange on the head plus a store into the previous node, any thread may
+	call it and none waits for another. pop() belongs to one consumer thread. Between the
+	exchange and the store a push is briefly invisible: pop() then reports empty even though
+	the count says otherwise, the consumer just yields and retries. */
+template <class T>
+class MpscQueue {
+public:
+	MpscQueue() : head_(&stub_), tail_(&stub_) {
+	}
+	MpscQueue(const MpscQueue&) = delete;
+	MpscQueue& operator=(const MpscQueue&) = delete;
+	~MpscQueue() {
+		T value;
+		while (pop(value)) { }
+	}
+
+	// Returns the number of values queued before this one, 0: the consumer may be asleep, wake it
+	size_t push(T value) {
+		Node* node = new Node();
+		node->value = std::move(value);
+		size_t before = size_.fetch_add(1, std::memory_order_acq_rel);
+		Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+		prev->next.store(node, std::memory_order_release);
+		return before;
+	}
+
+	// Consumer only; false when nothing is linked yet
+	bool pop(T& value) {
+		Node* tail = tail_;
+		Node* next = tail->next.load(std::memory_order_acquire);
+		if (tail == &stub_) {																					// 	Skip the stub, it carries no value
+			if (!next) { return false; }
+			tail_ = next;
+			tail = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+		if (next) {
+			tail_ = next;
+			value = std::move(tail->value);
+			delete tail;
+			size_.fetch_sub(1, std::memory_order_acq_rel);
+			return true;
+		}
+		if (tail != head_.load(std::memory_order_acquire)) { return false; }									// 	A push is between its two steps
+		stub_.next.store(nullptr, std::memory_order_relaxed);													// 	tail is the last node: put the stub behind it so it can go
+		Node* prev = head_.exchange(&stub_, std::memory_order_acq_rel);
+		prev->next.store(&stub_, std::memory_order_release);
+		next = tail->next.load(std::memory_order_acquire);
+		if (!next) { return false; }
+		tail_ = next;
+		value = std::move(tail->value);
+		delete tail;
+		size_.fetch_sub(1, std::memory_order_acq_rel);
+		return true;
+	}
+
+	// Consumer only: every value pushed before the call, waiting out pushes caught between their two steps
+	template <class F>
+	size_t drain(F&& fn) {
+		size_t n = 0;
+		T value;
+		while (size_.load(std::memory_order_acquire) > 0) {
+			if (!pop(value)) {
+				std::this_thread::yield();
+				continue;
+			}
+			fn(value);
+			n++;
+		}
+		return n;
+	}
+
+	size_t size() const {
+		return size_.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct Node {
+		std::atomic<Node*> next{nullptr};
+		T value;
+	};
+
+	alignas(64) std::atomic<Node*> head_;																		// 	Producers
+	alignas(64) Node* tail_;																					// 	Consumer
+	Node stub_;
+	std::atomic<size_t> size_{0};
+};
+
+#endif // MPSCQUEUE_HPP
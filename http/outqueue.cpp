@@ -0,0 +1,130 @@
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+
+#include "outqueue.hpp"
+#include "staticfiles.hpp"
+
+const int K_MAX_IOV = 64;
+
+char* OutQueue::reserve(size_t n) {
+	if (staging_.capacity() < staging_used_ + n) {
+		compact();
+	}
+	if (!staging_.reserve(staging_used_ + n, staging_used_)) { throw std::bad_alloc(); }				// 	Next size class, slices hold offsets so moving is safe
+	return (char*)staging_.data() + staging_used_;
+}
+
+void OutQueue::commit(size_t n) {
+	if (n == 0) { return; }
+	if (head_ < slices_.size() && slices_.back().kind == SLICE_OWNED
+		&& slices_.back().begin + slices_.back().len == staging_used_) {
+		slices_.back().len += n;																				// 	Back to back copies become one iovec
+	} else {
+		slices_.push_back(Slice{SLICE_OWNED, staging_used_, n, nullptr, nullptr});
+	}
+	staging_used_ += n;
+	size_ += n;
+}
+
+void OutQueue::append(const void* data, size_t len) {
+	memcpy(reserve(len), data, len);
+	commit(len);
+}
+
+void OutQueue::appendShared(std::shared_ptr<const std::string> buf, size_t offset, size_t len) {
+	if (len == 0) { return; }
+	slices_.push_back(Slice{SLICE_SHARED, offset, len, std::move(buf), nullptr});
+	size_ += len;
+}
+
+void OutQueue::appendFile(std::shared_ptr<const OpenFile> file, off_t offset, size_t len) {
+	if (len == 0) { return; }
+	slices_.push_back(Slice{SLICE_FILE, (size_t)offset, len, nullptr, std::move(file)});
+	size_ += len;
+}
+
+// Only when the staging buffer is full and the queue never drained: drop the bytes and slices already sent
+void OutQueue::compact() {
+	if (head_ > 0) {
+		slices_.erase(slices_.begin(), slices_.begin() + head_);
+		head_ = 0;
+	}
+	size_t shift = staging_used_;
+	for (const Slice& s : slices_) {
+		if (s.kind == SLICE_OWNED) { shift = s.begin; break; }													// 	Owned offsets grow along the queue, the first one is the lowest
+	}
+	if (shift == 0) { return; }
+	memmove(staging_.data(), staging_.data() + shift, staging_used_ - shift);
+	for (Slice& s : slices_) {
+		if (s.kind == SLICE_OWNED) { s.begin -= shift; }
+	}
+	staging_used_ -= shift;
+}
+
+void OutQueue::consume(size_t n) {
+	size_ -= n;
+	while (n > 0) {
+		Slice& s = slices_[head_];
+		size_t step = n < s.len ? n : s.len;
+		s.begin += step;
+		s.len -= step;
+		n -= step;
+		if (s.len == 0) { s.buf.reset(); s.file.reset(); head_++; }											// 	Drop the references now, the slot is reused later
+	}
+	while (head_ < slices_.size() && slices_[head_].len == 0) { head_++; }
+	if (head_ == slices_.size()) { clear(); }																	// 	Everything sent, rewind instead of moving bytes
+}
+
+int OutQueue::flush(int fd) {
+	while (head_ < slices_.size()) {
+		Slice& head = slices_[head_];
+		ssize_t rv;
+		if (head.kind == SLICE_FILE) {
+			off_t offset = (off_t)head.begin;
+			rv = sendfile(fd, head.file->fd, &offset, head.len);
+			if (rv == 0) { errno = EIO; return FLUSH_ERROR; }													// 	The file shrank, the promised Content-Length can't be met
+		} else {
+			struct iovec iov[K_MAX_IOV];
+			rv = writev(fd, iov, gather(iov, K_MAX_IOV));
+		}
+		if (rv < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) { return FLUSH_AGAIN; }
+			if (errno == EINTR) { continue; }
+			return FLUSH_ERROR;
+		}
+		consume((size_t)rv);
+	}
+	return FLUSH_DONE;
+}
+
+// The iovecs stay valid until the bytes are consumed, as long as nothing is appended meanwhile (reserve() may move staging_)
+int OutQueue::gather(struct iovec* iov, int max) const {
+	int n = 0;
+	for (auto it = slices_.begin() + head_; it != slices_.end() && n < max && it->kind != SLICE_FILE; ++it) {
+		const char* base = it->kind == SLICE_OWNED ? (const char*)staging_.data() : it->buf->data();
+		iov[n].iov_base = (void*)(base + it->begin);
+		iov[n].iov_len = it->len;
+		n++;
+	}
+	return n;
+}
+
+size_t OutQueue::size() const {
+	return size_;
+}
+
+bool OutQueue::empty() const {
+	return head_ == slices_.size();
+}
+
+void OutQueue::clear() {
+	slices_.clear();																							// 	Keeps the vector capacity, only the bytes go back to the pool
+	head_ = 0;
+	staging_.release();
+	staging_used_ = 0;
+	size_ = 0;
+}
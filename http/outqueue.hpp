@@ -0,0 +1,65 @@
+#ifndef OUTQUEUE_HPP
+#define OUTQUEUE_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "bufferpool.hpp"
+
+struct OpenFile;
+
+enum {
+	FLUSH_ERROR = -1,
+	FLUSH_AGAIN = 0,																							// 	The socket is full, wait for EPOLLOUT
+	FLUSH_DONE = 1
+};
+
+/* 	Outgoing bytes of a connection as a list of slices, flushed with writev() (and sendfile()
+	for file slices). Small pieces (status lines, headers, small bodies) are copied into one
+	owned staging buffer and coalesce into a single slice; large bodies are borrowed through a
+	refcount and never copied. A partial write only advances the offset of the first slice,
+	nothing is moved; when the queue drains the staging buffer goes back to the thread's pool,
+	so an idle connection holds no output memory. Slices live in a vector consumed from
+	head_, an empty queue allocates nothing. */
+class OutQueue {
+public:
+	char* reserve(size_t n);																					// 	Room for n bytes at the end of the staging buffer
+	void commit(size_t n);																						// 	Queue n bytes written at reserve()
+	void append(const void* data, size_t len);																	// 	Copy
+	void appendShared(std::shared_ptr<const std::string> buf, size_t offset, size_t len);						// 	Borrow, buf stays alive until sent
+	void appendFile(std::shared_ptr<const OpenFile> file, off_t offset, size_t len);
+
+	int flush(int fd);																							// 	FLUSH_DONE, FLUSH_AGAIN or FLUSH_ERROR (errno set)
+	int gather(struct iovec* iov, int max) const;																// 	iovecs of the memory slices up to the first file one, for an async send
+	void consume(size_t n);																						// 	n bytes left the queue (sent by someone else than flush)
+	size_t size() const;																						// 	Bytes still queued
+	bool empty() const;
+	void clear();
+
+private:
+	enum { SLICE_OWNED, SLICE_SHARED, SLICE_FILE };
+
+	struct Slice {
+		uint8_t kind;
+		size_t begin;																							// 	Owned: offset in staging_, shared: offset in buf, file: file offset
+		size_t len;																								// 	Bytes left, begin advances as they are sent
+		std::shared_ptr<const std::string> buf;
+		std::shared_ptr<const OpenFile> file;
+	};
+
+	void compact();
+
+	Buffer staging_;
+	size_t staging_used_ = 0;
+	std::vector<Slice> slices_;
+	size_t head_ = 0;																						// 	First slice not fully sent
+	size_t size_ = 0;
+};
+
+#endif // OUTQUEUE_HPP
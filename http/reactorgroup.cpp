@@ -0,0 +1,133 @@
+#include <cstdio>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "reactorgroup.hpp"
+
+ReactorGroup::ReactorGroup(int threads, int maxEvents, bool pinCpus, bool uring)
+	: max_events_(maxEvents), pin_cpus_(pinCpus) {
+	if (threads <= 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 0 ? (int)cpus : 1;
+	}
+	for (int i = 0; i < threads; i++) {
+		reactors_.emplace_back(uring ? new UringServer(max_events_) : new EpollServer(max_events_));
+		reactors_.back()->setReusePort(true);
+	}
+}
+
+ReactorGroup::~ReactorGroup() {
+	stop();
+	for (std::thread& t : threads_) {
+		if (t.joinable()) { t.join(); }
+	}
+}
+
+void ReactorGroup::setupServer(int port, int timeoutMs) {
+	port_ = port;
+	for (auto& reactor : reactors_) {
+		reactor->setupServer(port, timeoutMs);																	// 	Every reactor gets its own listening socket on the same port
+	}
+}
+
+void ReactorGroup::start() {
+	running_ = true;
+	for (size_t i = 1; i < reactors_.size(); i++) {
+		threads_.emplace_back(&ReactorGroup::run, this, i);
+	}
+	run(0);																										// 	The calling thread is reactor 0
+	for (std::thread& t : threads_) {
+		t.join();
+	}
+	threads_.clear();
+	running_ = false;
+}
+
+void ReactorGroup::stop() {
+	for (auto& reactor : reactors_) {
+		reactor->stop();
+	}
+}
+
+bool ReactorGroup::isRunning() const {
+	return running_;
+}
+
+std::unique_ptr<std::string> ReactorGroup::readRequest(int idleTime) {
+	(void)idleTime;
+	return nullptr;
+}
+
+bool ReactorGroup::addRoute(const std::string& method, const std::string& pattern, RouteHandler handler, BodyHandler bodyHandler) {
+	for (auto& reactor : reactors_) {
+		if (!reactor->addRoute(method, pattern, handler, bodyHandler)) { return false; }
+	}
+	return true;
+}
+
+bool ReactorGroup::addBlockingRoute(const std::string& method, const std::string& pattern, RouteHandler handler) {
+	for (auto& reactor : reactors_) {
+		if (!reactor->addBlockingRoute(method, pattern, handler)) { return false; }
+	}
+	return true;
+}
+
+bool ReactorGroup::addAsyncRoute(const std::string& method, const std::string& pattern, AsyncHandler handler) {
+	for (auto& reactor : reactors_) {
+		if (!reactor->addAsyncRoute(method, pattern, handler)) { return false; }
+	}
+	return true;
+}
+
+int ReactorGroup::getPort() const {
+	return port_;
+}
+
+void ReactorGroup::setTimeouts(int idleMs, int headerMs, int writeMs) {
+	for (auto& reactor : reactors_) {
+		reactor->setTimeouts(idleMs, headerMs, writeMs);
+	}
+}
+
+void ReactorGroup::setBacklog(int backlog) {
+	for (auto& reactor : reactors_) {
+		reactor->setBacklog(backlog);
+	}
+}
+
+/* 	Reactors share nothing, so the limits are split rather than counted globally. SO_REUSEPORT
+	spreads connections evenly enough for a share each, rounded up so a limit never becomes 0. */
+void ReactorGroup::setLimits(size_t maxConns, size_t maxBufferedBytes) {
+	size_t n = reactors_.size();
+	for (auto& reactor : reactors_) {
+		reactor->setLimits((maxConns + n - 1) / n, (maxBufferedBytes + n - 1) / n);
+	}
+}
+
+void ReactorGroup::setResponseCache(std::shared_ptr<ResponseCache> cache) {
+	for (auto& reactor : reactors_) {
+		reactor->setResponseCache(cache);
+	}
+}
+
+size_t ReactorGroup::size() const {
+	return reactors_.size();
+}
+
+EpollServer& ReactorGroup::reactor(size_t i) {
+	return *reactors_[i];
+}
+
+void ReactorGroup::run(size_t i) {
+	if (pin_cpus_) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(i % (size_t)(cpus > 0 ? cpus : 1), &set);
+		int rv = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);								// 	Keep the reactor, its connections and their buffers on one core's caches
+		if (rv) { LOG_WARN("pthread_setaffinity_np failed for reactor %zu", i); }
+	}
+	reactors_[i]->start();
+}
@@ -0,0 +1,49 @@
+#ifndef REACTORGROUP_HPP
+#define REACTORGROUP_HPP
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "iserver.hpp"
+#include "epollserver.hpp"
+#include "uringserver.hpp"
+
+/* 	One EpollServer (or UringServer) per thread. Each reactor binds its own SO_REUSEPORT listener, so the
+	kernel spreads incoming connections across them and a connection lives its whole life
+	on the thread that accepted it: no connection table, buffer or lock is shared. */
+class ReactorGroup : public IServer {
+public:
+	explicit ReactorGroup(int threads = 0, int maxEvents = 1024, bool pinCpus = false, bool uring = false);	// 	threads <= 0 uses one reactor per online CPU, uring: UringServer reactors
+	~ReactorGroup() override;
+
+	void setupServer(int port, int timeoutMs) override;
+	void start() override;																						// 	Blocks until every reactor has stopped
+	void stop() override;
+	bool isRunning() const override;
+	std::unique_ptr<std::string> readRequest(int idleTime) override;											// 	Not supported, requests belong to their reactor thread
+	bool addRoute(const std::string& method, const std::string& pattern, RouteHandler handler, BodyHandler bodyHandler = nullptr) override;	// 	Every reactor gets its own copy
+	bool addAsyncRoute(const std::string& method, const std::string& pattern, AsyncHandler handler);
+	bool addBlockingRoute(const std::string& method, const std::string& pattern, RouteHandler handler);		// 	One WorkerPool for the whole process
+
+	int getPort() const override;
+	void setTimeouts(int idleMs, int headerMs, int writeMs);													// 	Forwarded to every reactor, after setupServer
+	void setBacklog(int backlog);																				// 	Forwarded to every reactor, before setupServer
+	void setLimits(size_t maxConns, size_t maxBufferedBytes);													// 	Totals for the group, each reactor enforces its share
+	void setResponseCache(std::shared_ptr<ResponseCache> cache);												// 	One cache for the group, its shards are locked
+	size_t size() const;
+	EpollServer& reactor(size_t i);
+
+private:
+	void run(size_t i);
+
+	int port_ = 0;
+	int max_events_;
+	bool pin_cpus_;
+	std::atomic<bool> running_{false};
+	std::vector<std::unique_ptr<EpollServer>> reactors_;
+	std::vector<std::thread> threads_;
+};
+
+#endif // REACTORGROUP_HPP
@@ -0,0 +1,198 @@
+#include <cstdio>
+#include <functional>
+#include <iterator>
+
+#include "responsecache.hpp"
+#include "compression.hpp"
+#include "workerpool.hpp"
+
+ResponseCache::ResponseCache(size_t maxBytes, size_t maxEntryBytes, std::vector<std::string> varyHeaders, size_t shards)
+	: max_entry_bytes_(maxEntryBytes), vary_(std::move(varyHeaders)) {
+	if (shards == 0) { shards = 1; }
+	shard_bytes_ = maxBytes / shards;
+	for (size_t i = 0; i < shards; i++) {
+		shards_.emplace_back(new Shard());
+	}
+}
+
+// HEAD shares the entry of GET, the server only sends the head of it
+void ResponseCache::key(const HttpRequest& req, std::string& out) const {
+	out.clear();
+	out.append(req.method == "HEAD" ? std::string_view("GET") : req.method);
+	out.push_back(' ');
+	out.append(req.target);
+	for (const std::string& name : vary_) {
+		out.push_back('\n');																					// 	Can't appear in a header value, keeps "a" + "bc" apart from "ab" + "c"
+		out.append(req.header(name));
+	}
+}
+
+ResponseCache::Shard& ResponseCache::shardFor(const std::string& key) {
+	return *shards_[std::hash<std::string>()(key) % shards_.size()];
+}
+
+void ResponseCache::erase(Shard& shard, std::list<Entry>::iterator it) {
+	if (std::shared_ptr<const CachedResponse> identity = it->response->identity.lock()) {
+		identity->variants_started.fetch_and(~(1u << it->response->encoding));								// 	Evicted or replaced: the next miss builds it again
+	}
+	shard.bytes -= it->bytes;
+	shard.index.erase(std::string_view(it->key));
+	shard.lru.erase(it);
+}
+
+std::shared_ptr<const CachedResponse> ResponseCache::get(const std::string& key, int64_t nowMs) {
+	return lookup(key, nowMs, nullptr);
+}
+
+std::shared_ptr<const CachedResponse> ResponseCache::lookup(const std::string& key, int64_t nowMs, const CachedResponse* identity) {
+	Shard& shard = shardFor(key);
+	std::lock_guard<std::mutex> guard(shard.lock);
+	auto found = shard.index.find(std::string_view(key));
+	if (found == shard.index.end()) { return nullptr; }
+	std::list<Entry>::iterator it = found->second;
+	if (it->response->expires_ms <= nowMs || (identity && it->response->identity.lock().get() != identity)) {
+		erase(shard, it);																						// 	Expired, or the body it compresses was evicted and cached again since
+		return nullptr;
+	}
+	shard.lru.splice(shard.lru.begin(), shard.lru, it);														// 	Most recently used, no node moves in memory
+	return it->response;
+}
+
+// FNV-1a, enough to tell two versions of a body apart, the tag is never trusted for anything else
+static uint64_t body_hash(std::string_view data) {
+	uint64_t h = 14695981039346656037ull;
+	for (unsigned char c : data) {
+		h ^= c;
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+std::shared_ptr<const CachedResponse> ResponseCache::put(const std::string& key, const HttpResponse& res, int64_t nowMs) {
+	if (res.cacheTtl() <= 0 || res.status() != 200 || res.file()) { return nullptr; }
+	std::string_view body = res.sharedBody() ? std::string_view(*res.sharedBody()) : std::string_view(res.body());
+	std::string_view headers = res.headers();
+	size_t bytes = key.size() + headers.size() + body.size() + 128;
+	if (bytes > max_entry_bytes_ || bytes > shard_bytes_) { return nullptr; }
+
+	std::shared_ptr<CachedResponse> response(new CachedResponse());
+	response->compressible = body.size() >= K_COMPRESS_MIN_SIZE && res.header("Content-Encoding").empty()
+		&& http_compressible(res.header("Content-Type"));
+	char etag[24];
+	snprintf(etag, sizeof(etag), "\"%016llx\"", (unsigned long long)body_hash(body));
+	response->etag = etag;
+	response->expires_ms = nowMs + res.cacheTtl();
+	std::string* wire = new std::string();
+	wire->reserve(bytes);
+	char line[96];
+	int len = snprintf(line, sizeof(line), "HTTP/1.1 200 OK\r\n");
+	wire->append(line, len);
+	wire->append(headers);
+	if (response->compressible) { wire->append("Vary: Accept-Encoding\r\n"); }
+	response->headers_end = wire->size();
+	len = snprintf(line, sizeof(line), "ETag: %s\r\nContent-Length: %zu\r\n", etag, body.size());
+	wire->append(line, len);
+	response->head_len = wire->size();
+	wire->append("\r\n", 2);
+	wire->append(body);
+	response->wire.reset(wire);
+	insert(key, response, bytes);
+	return response;
+}
+
+void ResponseCache::insert(const std::string& key, std::shared_ptr<const CachedResponse> response, size_t bytes) {
+	Shard& shard = shardFor(key);
+	std::lock_guard<std::mutex> guard(shard.lock);
+	auto found = shard.index.find(std::string_view(key));
+	if (found != shard.index.end()) { erase(shard, found->second); }											// 	Another reactor filled it meanwhile, the newest wins
+	shard.lru.push_front(Entry{key, std::move(response), bytes});
+	shard.index.emplace(std::string_view(shard.lru.front().key), shard.lru.begin());
+	shard.bytes += bytes;
+	while (shard.bytes > shard_bytes_) {
+		erase(shard, std::prev(shard.lru.end()));
+	}
+}
+
+std::shared_ptr<const CachedResponse> ResponseCache::variant(const std::string& key, const std::shared_ptr<const CachedResponse>& identity, int encoding, int64_t nowMs) {
+	static thread_local std::string variant_key;
+	variant_key.assign(key);
+	variant_key.push_back('\n');
+	variant_key.append(http_encoding_name(encoding));
+	std::shared_ptr<const CachedResponse> found = lookup(variant_key, nowMs, identity.get());
+	if (found) { return found; }
+	unsigned bit = 1u << encoding;
+	if (!(identity->variants_started.fetch_or(bit) & bit)) {													// 	Only the first miss compresses, the others are served identity meanwhile
+		std::shared_ptr<ResponseCache> self = shared_from_this();
+		std::string target = variant_key;
+		WorkerPool::shared().submit([self, target, identity, encoding]() { self->buildVariant(target, identity, encoding); });
+	}
+	return nullptr;
+}
+
+// On a WorkerPool thread: same head as the identity entry plus the coding, its own ETag (strong tags differ per coding)
+void ResponseCache::buildVariant(const std::string& key, const std::shared_ptr<const CachedResponse>& identity, int encoding) {
+	std::string_view body(identity->wire->data() + identity->head_len + 2, identity->wire->size() - identity->head_len - 2);
+	std::string compressed;
+	if (!http_compress(body, encoding, compressed) || compressed.size() >= body.size()) { return; }		// 	No gain: stays identity, the bit keeps it from being tried again
+	std::shared_ptr<CachedResponse> response(new CachedResponse());
+	response->identity = identity;
+	response->encoding = encoding;
+	response->etag.assign(identity->etag, 0, identity->etag.size() - 1);
+	response->etag.append("-");
+	response->etag.append(http_encoding_name(encoding));
+	response->etag.append("\"");
+	response->expires_ms = identity->expires_ms;
+	std::string* wire = new std::string();
+	wire->reserve(identity->headers_end + compressed.size() + 128);
+	wire->append(*identity->wire, 0, identity->headers_end);
+	response->headers_end = wire->size();
+	char line[160];
+	int len = snprintf(line, sizeof(line), "Content-Encoding: %s\r\nETag: %s\r\nContent-Length: %zu\r\n",
+		http_encoding_name(encoding), response->etag.c_str(), compressed.size());
+	wire->append(line, len);
+	response->head_len = wire->size();
+	wire->append("\r\n", 2);
+	wire->append(compressed);
+	response->wire.reset(wire);
+	size_t bytes = key.size() + wire->size();
+	if (bytes > max_entry_bytes_ || bytes > shard_bytes_) {
+		identity->variants_started.fetch_and(~(1u << encoding));												// 	Not stored: only "no gain" above keeps the bit
+		return;
+	}
+	insert(key, response, bytes);
+}
+
+size_t ResponseCache::size() const {
+	size_t n = 0;
+	for (const auto& shard : shards_) {
+		std::lock_guard<std::mutex> guard(shard->lock);
+		n += shard->lru.size();
+	}
+	return n;
+}
+
+size_t ResponseCache::bytes() const {
+	size_t n = 0;
+	for (const auto& shard : shards_) {
+		std::lock_guard<std::mutex> guard(shard->lock);
+		n += shard->bytes;
+	}
+	return n;
+}
+
+bool ResponseCache::etagMatches(std::string_view ifNoneMatch, std::string_view etag) {
+	if (etag.substr(0, 2) == "W/") { etag.remove_prefix(2); }
+	size_t pos = 0;
+	while (pos < ifNoneMatch.size()) {
+		size_t end = ifNoneMatch.find(',', pos);
+		if (end == std::string_view::npos) { end = ifNoneMatch.size(); }
+		std::string_view tag = ifNoneMatch.substr(pos, end - pos);
+		while (!tag.empty() && (tag.front() == ' ' || tag.front() == '\t')) { tag.remove_prefix(1); }
+		while (!tag.empty() && (tag.back() == ' ' || tag.back() == '\t')) { tag.remove_suffix(1); }
+		if (tag == "*") { return true; }
+		if (tag.substr(0, 2) == "W/") { tag.remove_prefix(2); }
+		if (tag == etag) { return true; }
+		pos = end + 1;
+	}
+	return false;
+}
@@ -0,0 +1,79 @@
+#ifndef RESPONSECACHE_HPP
+#define RESPONSECACHE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "httpparser.hpp"
+#include "httpresponse.hpp"
+
+// A response serialized once, queued by every hit as a refcounted slice of wire
+struct CachedResponse {
+	std::shared_ptr<const std::string> wire;																	// 	Status line, headers (ETag and Content-Length included), blank line, body
+	size_t head_len = 0;																						// 	Up to the blank line, where a Connection header can still go
+	size_t headers_end = 0;																						// 	End of the handler's headers, a variant copies them
+	std::string etag;																							// 	Quoted, as sent
+	int64_t expires_ms = 0;																						// 	Monotonic
+	bool compressible = false;																					// 	Big enough text: has compressed variants, sent with Vary
+	mutable std::atomic<unsigned> variants_started{0};															// 	Bit per ContentEncoding whose variant is cached, being built, or gains nothing
+	std::weak_ptr<const CachedResponse> identity;																// 	Variants: the entry they compress, whose bit is cleared when they leave the cache
+	int encoding = 0;
+};
+
+/* 	LRU of serialized GET responses keyed by method, target and the values of the vary
+	headers. Handlers opt in with HttpResponse::setCacheTtl(); only 200s with an in-memory
+	body are kept. Shared by every reactor of a group, so it is split in shards, each with its
+	own lock, list and map: a hit locks one shard for a lookup and a splice, the bytes are then
+	used outside the lock through the refcount. Expired entries are dropped when looked up,
+	the least recently used ones when a shard is over its share of maxBytes.
+	Compressible entries get a variant per content coding, built once on the WorkerPool
+	and stored next to them under the key plus the coding. */
+class ResponseCache : public std::enable_shared_from_this<ResponseCache> {
+public:
+	explicit ResponseCache(size_t maxBytes = 64 << 20, size_t maxEntryBytes = 1 << 20, std::vector<std::string> varyHeaders = {}, size_t shards = 16);
+	ResponseCache(const ResponseCache&) = delete;
+	ResponseCache& operator=(const ResponseCache&) = delete;
+
+	void key(const HttpRequest& req, std::string& out) const;													// 	Into a caller owned string, so a lookup does not allocate
+	std::shared_ptr<const CachedResponse> get(const std::string& key, int64_t nowMs);							// 	nullptr on a miss or an expired entry
+	std::shared_ptr<const CachedResponse> put(const std::string& key, const HttpResponse& res, int64_t nowMs);	// 	Serializes res, nullptr when it is not cacheable or too big
+	std::shared_ptr<const CachedResponse> variant(const std::string& key, const std::shared_ptr<const CachedResponse>& identity, int encoding, int64_t nowMs);	// 	nullptr until built, the first call starts it
+	size_t size() const;
+	size_t bytes() const;
+
+	static bool etagMatches(std::string_view ifNoneMatch, std::string_view etag);								// 	Weak comparison against a list of tags or "*"
+
+private:
+	struct Entry {
+		std::string key;
+		std::shared_ptr<const CachedResponse> response;
+		size_t bytes;
+	};
+
+	struct Shard {
+		mutable std::mutex lock;
+		std::list<Entry> lru;																					// 	Front is the most recently used
+		std::unordered_map<std::string_view, std::list<Entry>::iterator> index;								// 	Views into the keys of lru, list nodes never move
+		size_t bytes = 0;
+	};
+
+	Shard& shardFor(const std::string& key);
+	static void erase(Shard& shard, std::list<Entry>::iterator it);
+	std::shared_ptr<const CachedResponse> lookup(const std::string& key, int64_t nowMs, const CachedResponse* identity);	// 	identity: drop a variant compressed from another one
+	void insert(const std::string& key, std::shared_ptr<const CachedResponse> response, size_t bytes);
+	void buildVariant(const std::string& key, const std::shared_ptr<const CachedResponse>& identity, int encoding);
+
+	size_t shard_bytes_;
+	size_t max_entry_bytes_;
+	std::vector<std::string> vary_;
+	std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+#endif // RESPONSECACHE_HPP
@@ -0,0 +1,195 @@
+#include "router.hpp"
+
+static const char* const K_METHOD_NAMES[METHOD_COUNT] = {
+	"GET", "HEAD", "POST", "PUT", "DELETE", "PATCH", "OPTIONS"
+};
+
+int http_method_index(std::string_view method) {
+	for (int i = 0; i < METHOD_COUNT; i++) {																	// 	Methods are case-sensitive (RFC 9110 9.1)
+		if (method == K_METHOD_NAMES[i]) { return i; }
+	}
+	return -1;
+}
+
+const char* http_method_name(int method) {
+	return method >= 0 && method < METHOD_COUNT ? K_METHOD_NAMES[method] : "";
+}
+
+struct Router::Node {
+	std::string prefix;																							// 	Static bytes on the edge that leads to this node
+	uint16_t index[256] = {};																					// 	First byte of a child prefix -> 1 + position in children, up to 256 of them
+	std::vector<std::unique_ptr<Node>> children;
+	std::unique_ptr<Node> param;
+	std::string param_name;
+	std::unique_ptr<Node> wildcard;
+	std::string wildcard_name;
+	RouteHandler handlers[METHOD_COUNT];
+	BodyHandler body_handlers[METHOD_COUNT];
+	AsyncHandler async_handlers[METHOD_COUNT];
+	unsigned blocking = 0;																						// 	Bit per HttpMethod whose handler runs on the WorkerPool
+	unsigned allowed = 0;
+};
+
+Router::Router() : root_(new Node()) {
+}
+
+Router::~Router() {
+}
+
+// Walk/extend the compressed edges for a run of static bytes, splitting an edge when s diverges inside it
+static Router::Node* insert_static(Router::Node* n, std::string_view s);
+
+bool Router::add(std::string_view method, std::string_view pattern, RouteHandler handler, BodyHandler bodyHandler, bool blocking) {
+	int m = http_method_index(method);
+	if (m < 0 || !handler || (blocking && bodyHandler)) { return false; }										// 	A streamed body would be consumed on the reactor
+	Node* n = insertPattern(pattern);
+	if (!n || (n->allowed & (1u << m))) { return false; }														// 	Invalid, or already registered
+	n->handlers[m] = std::move(handler);
+	n->body_handlers[m] = std::move(bodyHandler);
+	if (blocking) { n->blocking |= 1u << m; }
+	n->allowed |= 1u << m;
+	routes_++;
+	return true;
+}
+
+bool Router::addAsync(std::string_view method, std::string_view pattern, AsyncHandler handler) {
+	int m = http_method_index(method);
+	if (m < 0 || !handler) { return false; }
+	Node* n = insertPattern(pattern);
+	if (!n || (n->allowed & (1u << m))) { return false; }
+	n->async_handlers[m] = std::move(handler);
+	n->allowed |= 1u << m;
+	routes_++;
+	return true;
+}
+
+Router::Node* Router::insertPattern(std::string_view pattern) {
+	if (pattern.empty() || pattern[0] != '/') { return nullptr; }
+
+	Node* n = root_.get();
+	size_t i = 0;
+	while (i < pattern.size()) {
+		size_t j = i;
+		while (j < pattern.size() && !((pattern[j] == ':' || pattern[j] == '*') && pattern[j - 1] == '/')) { j++; }
+		if (j > i) { n = insert_static(n, pattern.substr(i, j - i)); }
+		if (j == pattern.size()) { break; }
+
+		if (pattern[j] == ':') {
+			size_t k = pattern.find('/', j);
+			if (k == std::string_view::npos) { k = pattern.size(); }
+			std::string_view name = pattern.substr(j + 1, k - j - 1);
+			if (name.empty()) { return nullptr; }
+			if (!n->param) {
+				n->param.reset(new Node());
+				n->param_name = std::string(name);
+			} else if (n->param_name != name) {
+				return nullptr;																					// 	"/u/:id" and "/u/:name" would be ambiguous
+			}
+			n = n->param.get();
+			i = k;
+		} else {
+			std::string_view name = pattern.substr(j + 1);
+			if (name.empty() || name.find('/') != std::string_view::npos) { return nullptr; }					// 	The wildcard must be the last segment
+			if (!n->wildcard) {
+				n->wildcard.reset(new Node());
+				n->wildcard_name = std::string(name);
+			} else if (n->wildcard_name != name) {
+				return nullptr;
+			}
+			n = n->wildcard.get();
+			i = pattern.size();
+		}
+	}
+	return n;
+}
+
+static Router::Node* insert_static(Router::Node* n, std::string_view s) {
+	while (!s.empty()) {
+		uint16_t slot = n->index[(uint8_t)s[0]];
+		if (!slot) {
+			Router::Node* child = new Router::Node();
+			child->prefix = std::string(s);
+			n->children.emplace_back(child);
+			n->index[(uint8_t)s[0]] = (uint16_t)n->children.size();
+			return child;
+		}
+		std::unique_ptr<Router::Node>& edge = n->children[slot - 1];
+		size_t common = 0;
+		while (common < edge->prefix.size() && common < s.size() && edge->prefix[common] == s[common]) { common++; }
+		if (common < edge->prefix.size()) {																		// 	Split "users" into "u" -> "sers" when inserting "uploads"
+			std::unique_ptr<Router::Node> mid(new Router::Node());
+			mid->prefix = edge->prefix.substr(0, common);
+			edge->prefix.erase(0, common);
+			mid->index[(uint8_t)edge->prefix[0]] = 1;
+			mid->children.push_back(std::move(edge));
+			edge = std::move(mid);
+		}
+		n = edge.get();
+		s.remove_prefix(common);
+	}
+	return n;
+}
+
+// Depth-first with backtracking: a static edge that leads to a dead end falls back to the parameter
+static const Router::Node* match_node(const Router::Node* n, std::string_view path, HttpRequest* req) {
+	if (path.empty()) {
+		if (n->allowed) { return n; }
+		if (n->wildcard && n->wildcard->allowed && req->num_params < K_MAX_PARAMS) {					// 	"/static/*file" also matches "/static/"
+			req->params[req->num_params++] = HttpParam{n->wildcard_name, path};
+			return n->wildcard.get();
+		}
+		return nullptr;
+	}
+	uint16_t slot = n->index[(uint8_t)path[0]];
+	if (slot) {
+		const Router::Node* child = n->children[slot - 1].get();
+		if (path.compare(0, child->prefix.size(), child->prefix) == 0) {
+			const Router::Node* found = match_node(child, path.substr(child->prefix.size()), req);
+			if (found) { return found; }
+		}
+	}
+	if (req->num_params == K_MAX_PARAMS) { return nullptr; }
+	if (n->param) {
+		size_t end = path.find('/');
+		if (end == std::string_view::npos) { end = path.size(); }
+		if (end > 0) {
+			size_t saved = req->num_params;
+			req->params[req->num_params++] = HttpParam{n->param_name, path.substr(0, end)};
+			const Router::Node* found = match_node(n->param.get(), path.substr(end), req);
+			if (found) { return found; }
+			req->num_params = saved;
+		}
+	}
+	if (n->wildcard && n->wildcard->allowed) {
+		req->params[req->num_params++] = HttpParam{n->wildcard_name, path};
+		return n->wildcard.get();
+	}
+	return nullptr;
+}
+
+RouteMatch Router::match(HttpRequest* req) const {
+	RouteMatch result;
+	req->num_params = 0;
+	const Node* n = match_node(root_.get(), req->path, req);
+	if (!n) { return result; }
+	result.allowed = n->allowed;
+	int m = http_method_index(req->method);
+	if (m == METHOD_HEAD && !(n->allowed & (1u << METHOD_HEAD))) { m = METHOD_GET; }						// 	HEAD is served by the GET handler, the server drops the body
+	if (m < 0 || !(n->allowed & (1u << m))) {
+		result.status = 405;
+		return result;
+	}
+	result.status = 200;
+	if (n->async_handlers[m]) {
+		result.async_handler = &n->async_handlers[m];
+		return result;
+	}
+	result.handler = &n->handlers[m];
+	result.body_handler = n->body_handlers[m] ? &n->body_handlers[m] : nullptr;
+	result.blocking = (n->blocking >> m) & 1;
+	return result;
+}
+
+bool Router::empty() const {
+	return routes_ == 0;
+}
@@ -0,0 +1,71 @@
+#ifndef ROUTER_HPP
+#define ROUTER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "coro.hpp"
+#include "httpparser.hpp"
+#include "httpresponse.hpp"
+
+enum HttpMethod {
+	METHOD_GET,
+	METHOD_HEAD,
+	METHOD_POST,
+	METHOD_PUT,
+	METHOD_DELETE,
+	METHOD_PATCH,
+	METHOD_OPTIONS,
+	METHOD_COUNT
+};
+
+int http_method_index(std::string_view method);																// 	-1 for methods the router does not know
+const char* http_method_name(int method);
+
+// Handlers get a view of the request (valid only during the call) and fill the response
+typedef std::function<void(const HttpRequest& req, HttpResponse& res)> RouteHandler;
+// Streaming request body consumer: called for each piece as it is decoded, then once with last = true
+typedef std::function<void(const HttpRequest& req, std::string_view data, bool last)> BodyHandler;
+// Coroutine handler: req and res stay valid until the Task ends, the response is sent then
+typedef std::function<Task<>(const HttpRequest& req, HttpResponse& res)> AsyncHandler;
+
+struct RouteMatch {
+	int status = 404;																							// 	200 when a handler is set, 404 or 405 otherwise
+	const RouteHandler* handler = nullptr;
+	const AsyncHandler* async_handler = nullptr;																// 	Set instead of handler for addAsync routes, the body is buffered
+	const BodyHandler* body_handler = nullptr;																	// 	nullptr: the body is buffered into req.body
+	bool blocking = false;																						// 	handler must run off the reactor
+	unsigned allowed = 0;																						// 	Bit per HttpMethod registered on the path, for the 405 Allow header
+};
+
+/* 	Radix trie keyed by path. Static segments share compressed edges, ":name" matches one
+	segment and "*name" (last only) matches the rest of the path. Lookup walks the path once,
+	so its cost depends on the path length and not on how many routes are registered.
+	Static edges win over parameters, parameters over wildcards. */
+class Router {
+public:
+	Router();
+	~Router();
+	Router(const Router&) = delete;
+	Router& operator=(const Router&) = delete;
+
+	bool add(std::string_view method, std::string_view pattern, RouteHandler handler, BodyHandler bodyHandler = nullptr, bool blocking = false);	// 	false on an invalid or conflicting pattern
+	bool addAsync(std::string_view method, std::string_view pattern, AsyncHandler handler);
+	RouteMatch match(HttpRequest* req) const;																	// 	Fills req->params
+
+	bool empty() const;
+
+	struct Node;																								// 	Defined in router.cpp
+
+private:
+	Node* insertPattern(std::string_view pattern);																// 	Node the pattern ends on, created as needed, nullptr if invalid
+
+	std::unique_ptr<Node> root_;
+	size_t routes_ = 0;
+};
+
+#endif // ROUTER_HPP
@@ -0,0 +1,245 @@
+#include <cstring>
+#include <ctime>
+#include <chrono>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "staticfiles.hpp"
+#include "compression.hpp"
+
+const size_t K_FILE_CACHE_SIZE = 1024;
+const int K_FILE_REVALIDATE_MS = 1000;
+
+static int64_t now_ms() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int64_t mtime_ns(const struct stat& st) {
+	return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+static const char* content_type_for(const std::string& path) {
+	static const struct { const char* ext; const char* type; } K_TYPES[] = {
+		{".html", "text/html; charset=utf-8"}, {".htm", "text/html; charset=utf-8"},
+		{".css", "text/css"}, {".js", "text/javascript"}, {".json", "application/json"},
+		{".txt", "text/plain; charset=utf-8"}, {".xml", "application/xml"}, {".svg", "image/svg+xml"},
+		{".png", "image/png"}, {".jpg", "image/jpeg"}, {".jpeg", "image/jpeg"}, {".gif", "image/gif"},
+		{".webp", "image/webp"}, {".ico", "image/x-icon"}, {".wasm", "application/wasm"},
+		{".pdf", "application/pdf"}, {".zip", "application/zip"}, {".gz", "application/gzip"},
+		{".mp4", "video/mp4"}, {".woff2", "font/woff2"},
+	};
+	size_t dot = path.rfind('.');
+	if (dot == std::string::npos || path.find('/', dot) != std::string::npos) { return "application/octet-stream"; }
+	std::string_view ext(path.data() + dot, path.size() - dot);
+	for (const auto& t : K_TYPES) {
+		if (http_iequals(ext, t.ext)) { return t.type; }
+	}
+	return "application/octet-stream";
+}
+
+OpenFile::~OpenFile() {
+	if (fd >= 0) { (void)close(fd); }
+}
+
+FileCache::FileCache(size_t capacity, int revalidateMs)
+	: capacity_(capacity > 0 ? capacity : 1), revalidate_ms_(revalidateMs) {
+}
+
+static std::shared_ptr<const OpenFile> open_file(const std::string& path) {
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) { return nullptr; }
+	std::shared_ptr<OpenFile> file(new OpenFile());
+	file->fd = fd;
+	struct stat st;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode)) { return nullptr; }										// 	Directories, devices and fifos are not served
+	file->size = st.st_size;
+	file->dev = st.st_dev;
+	file->ino = st.st_ino;
+	file->mtime_ns = mtime_ns(st);
+	file->content_type = content_type_for(path);
+	char date[64];
+	struct tm tm;
+	gmtime_r(&st.st_mtim.tv_sec, &tm);
+	size_t n = strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	file->last_modified.assign(date, n);
+	return file;
+}
+
+std::shared_ptr<const OpenFile> FileCache::open(const std::string& path) {
+	int64_t now = now_ms();
+	auto it = entries_.find(path);
+	if (it != entries_.end()) {
+		Entry& e = it->second;
+		if (now - e.checked_ms < revalidate_ms_) {
+			lru_.splice(lru_.begin(), lru_, e.lru);
+			return e.file;
+		}
+		struct stat st;																							// 	Stale: still the same inode, size and mtime?
+		if (stat(path.c_str(), &st) == 0 && st.st_ino == e.file->ino && st.st_dev == e.file->dev
+			&& st.st_size == e.file->size && mtime_ns(st) == e.file->mtime_ns) {
+			e.checked_ms = now;
+			lru_.splice(lru_.begin(), lru_, e.lru);
+			return e.file;
+		}
+		lru_.erase(e.lru);																						// 	Responses still sending the old file keep their reference
+		entries_.erase(it);
+	}
+	std::shared_ptr<const OpenFile> file = open_file(path);
+	if (!file) { return nullptr; }
+	if (entries_.size() >= capacity_) {
+		entries_.erase(lru_.back());
+		lru_.pop_back();
+	}
+	lru_.push_front(path);
+	entries_[path] = Entry{file, now, lru_.begin()};
+	return file;
+}
+
+size_t FileCache::size() const {
+	return entries_.size();
+}
+
+StaticFiles::StaticFiles(std::string root, std::string param)
+	: root_(std::move(root)), param_(std::move(param)) {
+	while (root_.size() > 1 && root_.back() == '/') { root_.pop_back(); }
+}
+
+// Reject anything that could leave root: ".." segments, NUL bytes, backslashes
+static bool safe_relative_path(std::string_view path) {
+	if (path.find('\0') != std::string_view::npos || path.find('\\') != std::string_view::npos) { return false; }
+	size_t i = 0;
+	while (i <= path.size()) {
+		size_t slash = path.find('/', i);
+		if (slash == std::string_view::npos) { slash = path.size(); }
+		if (path.substr(i, slash - i) == "..") { return false; }
+		i = slash + 1;
+	}
+	return true;
+}
+
+enum {
+	RANGE_IGNORED,																								// 	Not a single byte range we understand: the whole file, as without one (RFC 9110 14.2)
+	RANGE_OK,
+	RANGE_UNSATISFIABLE																							// 	A valid byte range outside the file: 416
+};
+
+// Parse a single "bytes=first-last" range against size
+static int parse_range(std::string_view value, off_t size, off_t* first, off_t* last) {
+	if (value.substr(0, 6) != "bytes=") { return RANGE_IGNORED; }
+	value.remove_prefix(6);
+	size_t dash = value.find('-');
+	if (dash == std::string_view::npos) { return RANGE_IGNORED; }
+	std::string_view a = value.substr(0, dash), b = value.substr(dash + 1);
+	auto to_num = [](std::string_view s, off_t* out) {
+		if (s.empty() || s.size() > 18) { return false; }
+		off_t n = 0;
+		for (char c : s) {
+			if (c < '0' || c > '9') { return false; }
+			n = n * 10 + (c - '0');
+		}
+		*out = n;
+		return true;
+	};
+	off_t x = 0, y = 0;
+	if (a.empty()) {																							// 	"bytes=-500": the last 500 bytes
+		if (!to_num(b, &y)) { return RANGE_IGNORED; }
+		if (y == 0 || size == 0) { return RANGE_UNSATISFIABLE; }
+		*first = y >= size ? 0 : size - y;
+		*last = size - 1;
+		return RANGE_OK;
+	}
+	if (!to_num(a, &x)) { return RANGE_IGNORED; }
+	if (b.empty()) {
+		y = size - 1;
+	} else if (!to_num(b, &y) || y < x) {
+		return RANGE_IGNORED;
+	}
+	if (x >= size) { return RANGE_UNSATISFIABLE; }
+	*first = x;
+	*last = y >= size ? size - 1 : y;
+	return RANGE_OK;
+}
+
+static std::shared_ptr<const std::string> compress_file(const std::shared_ptr<const OpenFile>& file, int encoding) {
+	std::string raw((size_t)file->size, '\0');
+	off_t done = 0;
+	while (done < file->size) {
+		ssize_t rv = pread(file->fd, &raw[done], (size_t)(file->size - done), done);							// 	Positional, the fd is shared with the reactor's sendfile()s
+		if (rv <= 0) { return nullptr; }
+		done += rv;
+	}
+	std::shared_ptr<std::string> out = std::make_shared<std::string>();
+	if (!http_compress(raw, encoding, *out) || out->size() >= raw.size()) { return nullptr; }
+	return out;
+}
+
+/* 	A compressible file is compressed once per coding on the WorkerPool, keyed by
+	device, inode and mtime so an edited file gets a new variant. Until it is ready, and for
+	everything else, the file goes out with sendfile(). */
+static bool send_variant(const HttpRequest& req, HttpResponse& res, const std::shared_ptr<const OpenFile>& file) {
+	static thread_local std::string key;
+	if (file->size < (off_t)K_COMPRESS_MIN_SIZE || file->size > (off_t)K_COMPRESS_MAX_FILE || !http_compressible(file->content_type)) { return false; }
+	res.setHeader("Vary", "Accept-Encoding");
+	int encoding = http_negotiate_encoding(req.header("Accept-Encoding"));
+	if (encoding == ENCODING_IDENTITY) { return false; }
+	char id[96];
+	snprintf(id, sizeof(id), "%llu:%llu:%lld:%s", (unsigned long long)file->dev, (unsigned long long)file->ino, (long long)file->mtime_ns, http_encoding_name(encoding));
+	key.assign(id);
+	Compressor& compressor = Compressor::shared();
+	std::shared_ptr<const std::string> body = compressor.variant(key);
+	if (!body) {
+		compressor.prepare(key, [file, encoding]() { return compress_file(file, encoding); });
+		return false;
+	}
+	res.setHeader("Content-Encoding", http_encoding_name(encoding));
+	res.setSharedBody(std::move(body));
+	return true;
+}
+
+void StaticFiles::operator()(const HttpRequest& req, HttpResponse& res) const {
+	static thread_local FileCache cache(K_FILE_CACHE_SIZE, K_FILE_REVALIDATE_MS);
+	static thread_local std::string path;																		// 	Reused, building the path does not allocate once warm
+
+	std::string_view rel = req.param(param_);
+	while (!rel.empty() && rel.front() == '/') { rel.remove_prefix(1); }
+	if (!safe_relative_path(rel)) {
+		res.setStatus(403);
+		return;
+	}
+	path.assign(root_);
+	path.push_back('/');
+	path.append(rel);
+	if (rel.empty() || rel.back() == '/') { path.append("index.html"); }
+
+	std::shared_ptr<const OpenFile> file = cache.open(path);
+	if (!file) {
+		res.setStatus(404);
+		return;
+	}
+	res.setHeader("Content-Type", file->content_type);
+	res.setHeader("Last-Modified", file->last_modified);
+	res.setHeader("Accept-Ranges", "bytes");
+
+	std::string_view range = req.header("Range");
+	off_t first = 0, last = 0;
+	int kind = range.empty() || range.find(',') != std::string_view::npos										// 	Multipart ranges are answered with the whole file
+		? RANGE_IGNORED : parse_range(range, file->size, &first, &last);
+	if (kind == RANGE_IGNORED) {
+		if (send_variant(req, res, file)) { return; }
+		res.sendFile(file, 0, (size_t)file->size);
+		return;
+	}
+	char content_range[96];
+	if (kind == RANGE_UNSATISFIABLE) {
+		snprintf(content_range, sizeof(content_range), "bytes */%lld", (long long)file->size);
+		res.setStatus(416);
+		res.setHeader("Content-Range", content_range);
+		return;
+	}
+	snprintf(content_range, sizeof(content_range), "bytes %lld-%lld/%lld", (long long)first, (long long)last, (long long)file->size);
+	res.setStatus(206);
+	res.setHeader("Content-Range", content_range);
+	res.sendFile(file, first, (size_t)(last - first + 1));
+}
@@ -0,0 +1,66 @@
+#ifndef STATICFILES_HPP
+#define STATICFILES_HPP
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+#include "httpparser.hpp"
+#include "httpresponse.hpp"
+
+// An open file and its stat result, the fd is closed when the last response using it is done
+struct OpenFile {
+	int fd = -1;
+	off_t size = 0;
+	dev_t dev = 0;
+	ino_t ino = 0;
+	int64_t mtime_ns = 0;
+	std::string last_modified;																					// 	Preformatted HTTP date
+	const char* content_type = "application/octet-stream";
+
+	~OpenFile();
+};
+
+/* 	Bounded LRU of open files keyed by path. A hit costs no open() and no fstat(); entries
+	older than revalidateMs are checked again with stat() so a replaced file is picked up.
+	One cache per reactor thread, so it is never locked. */
+class FileCache {
+public:
+	explicit FileCache(size_t capacity = 1024, int revalidateMs = 1000);
+
+	std::shared_ptr<const OpenFile> open(const std::string& path);												// 	nullptr when missing or not a regular file
+	size_t size() const;
+
+private:
+	struct Entry {
+		std::shared_ptr<const OpenFile> file;
+		int64_t checked_ms;
+		std::list<std::string>::iterator lru;
+	};
+
+	size_t capacity_;
+	int revalidate_ms_;
+	std::list<std::string> lru_;																				// 	Front is the most recently used path
+	std::unordered_map<std::string, Entry> entries_;
+};
+
+// Route handler that serves files below root with sendfile(), the bytes never pass through
+// user space. Register it on a wildcard route, the wildcard names the file:
+// 	server.addRoute("GET", "/static/*path", StaticFiles("./public"));
+// Supports single "Range: bytes=" requests (206/416).
+class StaticFiles {
+public:
+	explicit StaticFiles(std::string root, std::string param = "path");
+
+	void operator()(const HttpRequest& req, HttpResponse& res) const;
+
+private:
+	std::string root_;
+	std::string param_;
+};
+
+#endif // STATICFILES_HPP
@@ -0,0 +1,295 @@
+#include <cerrno>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "uringserver.hpp"
+
+UringServer::UringServer(int maxEvents) : EpollServer(maxEvents) {
+}
+
+UringServer::~UringServer() {
+	ring_.reset();																								// 	Closing the ring cancels what is in flight, EpollServer then closes the fds
+}
+
+void UringServer::setupServer(int port, int timeoutMs) {
+	if (!Uring::supported()) {
+		LOG_WARN("io_uring not supported by this kernel, using epoll");
+	} else {
+		ring_.reset(new Uring());
+		if (!ring_->init() || !ring_->setupBuffers(K_URING_BUFS, K_URING_BUF_SIZE)) {
+			LOG_WARN("io_uring setup failed (%s), using epoll", strerror(errno));
+			ring_.reset();
+		}
+	}
+	if (!ring_) {
+		EpollServer::setupServer(port, timeoutMs);
+		return;
+	}
+	port_ = port;
+	timeout_ms_ = timeoutMs;
+	now_ms_ = monotonic_ms();
+	timers_.start(now_ms_);
+	openListener();
+	wake_fd_ = mailbox_->wake_fd;																				// 	stop() and post() write here, a pending READ on it ends the wait
+}
+
+bool UringServer::usingUring() const {
+	return ring_ != nullptr;
+}
+
+uint64_t UringServer::userData(int op, int fd) {
+	return (uint64_t)op << 32 | (uint32_t)fd;
+}
+
+/* 	One io_uring_enter() per turn: it submits everything the previous turn queued (recv
+	re-arms, sends, cancels) and sleeps until a completion or the next connection deadline. */
+int UringServer::pollOnce(int timeoutMs) {
+	if (!ring_) { return EpollServer::pollOnce(timeoutMs); }
+	if (!armed_) {																								// 	Armed from the reactor's own thread, in its first turn
+		ring_->prepAcceptMultishot(listen_fd_, userData(OP_ACCEPT, listen_fd_));
+		ring_->prepRead(wake_fd_, &wake_value_, sizeof(wake_value_), userData(OP_WAKE, wake_fd_));
+		armed_ = true;
+	}
+	int wait = nextWaitMs(timeoutMs);
+	int rv = ring_->submitAndWait(wait < 0 ? -1 : (int64_t)wait * 1000000);
+	if (rv < 0 && rv != -ETIME && rv != -EINTR && rv != -EBUSY) {
+		errno = -rv;
+		die("io_uring_enter");
+	}
+	now_ms_ = monotonic_ms();
+	unsigned n = ring_->drain([this](const struct io_uring_cqe& cqe) { onCompletion(cqe); });
+	if (n > 0) { Metrics::local().record(H_READY_EVENTS, n); }
+	runPosted();
+	timers_.advance(now_ms_, [this](TimerNode* timer) {
+		Conn* conn = (Conn*)timer->data;
+		LOG_DEBUG("Timeout (%i) on %i", conn->timeout_kind, conn->fd);
+		Metrics::local().add(M_TIMEOUTS);
+		closeRing(conn);
+	});
+	expireSleepers();
+	return (int)n;
+}
+
+void UringServer::onCompletion(const struct io_uring_cqe& cqe) {
+	int op = (int)(cqe.user_data >> 32);
+	int fd = (int)(uint32_t)cqe.user_data;
+	if (op == OP_ACCEPT) {
+		onAccept(cqe);
+		return;
+	}
+	if (op == OP_ACCEPT_POLL) {
+		accept_paused_ = false;
+		ring_->prepAcceptMultishot(listen_fd_, userData(OP_ACCEPT, listen_fd_));
+		return;
+	}
+	if (op == OP_WAKE) {
+		ring_->prepRead(wake_fd_, &wake_value_, sizeof(wake_value_), userData(OP_WAKE, wake_fd_));
+		return;
+	}
+	if (op == OP_CANCEL) { return; }																			// 	The cancelled operation completes on its own
+	if (op == OP_WATCH) {
+		if (cqe.res == -ECANCELED || (size_t)fd >= watchers_.size() || !watchers_[fd]) { return; }			// 	Its waiter timed out
+		wakeWatcher(fd, cqe.res < 0 ? EPOLLERR : (uint32_t)cqe.res);											// 	POLLIN/POLLOUT/POLLERR have the EPOLL* values
+		return;
+	}
+	Conn* conn = (size_t)fd < conns_.size() ? conns_[fd] : NULL;
+	if (!conn) {
+		if (cqe.flags & IORING_CQE_F_BUFFER) { ring_->recycle((uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT)); }
+		return;
+	}
+	if (op == OP_RECV) {
+		onRecv(conn, cqe);
+	} else {
+		onSend(conn, op == OP_SEND ? cqe.res : 0);
+	}
+}
+
+void UringServer::onAccept(const struct io_uring_cqe& cqe) {
+	if (cqe.res >= 0 && overloaded()) {
+		reject(cqe.res);
+	} else if (cqe.res >= 0) {
+		int fd = cqe.res;																						// 	Already non-blocking (accept_flags), sendfile() relies on it
+		LOG_DEBUG("Accepted connection, fd: %i", fd);
+		if (ring_conns_.size() <= (size_t)fd) {
+			ring_conns_.resize(fd + 1);
+		}
+		Conn* conn = openConn(fd);
+		armRecv(conn);
+	} else if (cqe.res == -EMFILE || cqe.res == -ENFILE) {
+		errno = -cqe.res;
+		if (!acceptOverflow()) {																					// 	The listener is non-blocking, this never waits
+			if (cqe.flags & IORING_CQE_F_MORE) {
+				ring_->prepCancel(userData(OP_ACCEPT, listen_fd_), userData(OP_CANCEL, listen_fd_));
+			}
+			accept_paused_ = true;
+			ring_->prepPollAdd(listen_fd_, POLLIN, userData(OP_ACCEPT_POLL, listen_fd_));						// 	The fd is allocated before looking at the queue: accepting again now would fail at once, forever
+			return;
+		}
+	} else if (cqe.res != -ECANCELED) {
+		LOG_WARN("accept: %s", strerror(-cqe.res));
+	}
+	if (!(cqe.flags & IORING_CQE_F_MORE) && !accept_paused_) {													// 	The multishot accept ended (error), start another
+		ring_->prepAcceptMultishot(listen_fd_, userData(OP_ACCEPT, listen_fd_));
+	}
+}
+
+void UringServer::onRecv(Conn* conn, const struct io_uring_cqe& cqe) {
+	UringConn& uc = ring_conns_[conn->fd];
+	if (!(cqe.flags & IORING_CQE_F_MORE)) {
+		uc.recv_armed = false;
+		uc.recv_cancelled = false;
+	}
+	if (cqe.res > 0) {
+		uint16_t bid = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+		if (!uc.closing) { handle_recv(conn, ring_->buffer(bid), (size_t)cqe.res); }						// 	The only copy: from the provided buffer to the contiguous read_buf the parser wants
+		ring_->recycle(bid);
+	} else if (cqe.res == 0) {
+		LOG_TRACE("EOF on %i", conn->fd);
+		uc.eof = true;																							// 	Half-closed peer: still answer what it pipelined
+	} else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {												// 	Out of buffers: re-armed below once they are back
+		LOG_DEBUG("Read error on %i: %s", conn->fd, strerror(-cqe.res));
+		conn->state = STATE_CLOSE;
+	}
+	if (uc.closing) {
+		finishClose(conn);
+		return;
+	}
+	drive(conn);
+}
+
+void UringServer::onSend(Conn* conn, int res) {
+	UringConn& uc = ring_conns_[conn->fd];
+	uc.sends--;
+	if (uc.closing) {
+		finishClose(conn);
+		return;
+	}
+	if (res > 0) {
+		conn->out.consume((size_t)res);
+		Metrics::local().add(M_BYTES_OUT, (uint64_t)res);
+	} else if (res < 0 && res != -ECANCELED) {																	// 	ECANCELED: a link before it fell short, resent below
+		LOG_DEBUG("Write error on %i: %s", conn->fd, strerror(-res));
+		uc.send_failed = true;
+	}
+	if (uc.sends > 0) { return; }																				// 	Rest of the chain still in flight
+	if (uc.send_failed) {
+		conn->state = STATE_CLOSE;
+	} else if (conn->out.empty()) {
+		conn->state = conn->close_after_write ? STATE_CLOSE : STATE_READ;
+	}
+	drive(conn);
+}
+
+/* 	Same sequence as EpollServer::serviceConn, except that a send completes later: answer the
+	buffered requests, queue their responses, and come back when the send completes. Nothing is
+	appended to conn->out while a send is in flight, the kernel holds iovecs into it. */
+void UringServer::drive(Conn* conn) {
+	UringConn& uc = ring_conns_[conn->fd];
+	bool progress = true;
+	while (progress && conn->state != STATE_CLOSE && uc.sends == 0) {
+		progress = false;
+		if (conn->state == STATE_READ) {
+			processRequests(conn);
+			if (!conn->out.empty() && conn->state != STATE_CLOSE) { conn->state = STATE_WRITE; }
+		}
+		if (conn->state == STATE_WRITE) { progress = startSend(conn); }
+	}
+	if (conn->state == STATE_READ && uc.eof && !conn->pending_job) { conn->state = STATE_CLOSE; }			// 	Everything the peer sent is answered
+	if (conn->state == STATE_CLOSE) {
+		closeRing(conn);
+		return;
+	}
+	if (conn->read_size == 0) { conn->read_buf.release(); }														// 	Idle: the connection holds no read memory
+	size_t unparsed = conn->read_size - conn->read_pos;
+	if (!uc.recv_armed && !uc.eof && (conn->state == STATE_READ || unparsed < K_WRITE_HIGH_WATER)) {
+		armRecv(conn);
+	} else if (uc.recv_armed && !uc.recv_cancelled && conn->state == STATE_WRITE && unparsed >= K_WRITE_HIGH_WATER) {
+		ring_->prepCancel(userData(OP_RECV, conn->fd), userData(OP_CANCEL, conn->fd));							// 	The peer pipelines faster than it reads the answers: stop receiving until they drain
+		uc.recv_cancelled = true;
+	}
+	armTimer(conn);
+	charge(conn);
+}
+
+// Queue the memory slices of conn->out as linked SENDMSGs, true when the queue was flushed synchronously instead
+bool UringServer::startSend(Conn* conn) {
+	UringConn& uc = ring_conns_[conn->fd];
+	int n = conn->out.gather(uc.iov, K_URING_SEND_LINKS * K_URING_SEND_IOV);
+	if (n == 0) {																								// 	A file comes first: io_uring has no sendfile, use it on the non-blocking socket
+		handle_write(conn);
+		if (conn->state != STATE_WRITE) { return true; }
+		ring_->prepPollAdd(conn->fd, POLLOUT, userData(OP_POLL_OUT, conn->fd));								// 	Socket full, retry once it drains
+		uc.sends = 1;
+		return false;
+	}
+	int msgs = 0;
+	for (int i = 0; i < n; i += K_URING_SEND_IOV) {
+		struct msghdr& msg = uc.msg[msgs++];
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = uc.iov + i;
+		msg.msg_iovlen = n - i < K_URING_SEND_IOV ? n - i : K_URING_SEND_IOV;
+	}
+	ring_->reserve(msgs);
+	for (int m = 0; m < msgs; m++) {
+		ring_->prepSendmsg(conn->fd, &uc.msg[m], m + 1 < msgs, userData(OP_SEND, conn->fd));				// 	Linked: sent in order, one after the other, in the same submit
+	}
+	uc.sends = msgs;
+	uc.send_failed = false;
+	Metrics::local().add(M_WRITES);
+	return false;
+}
+
+void UringServer::resumeConn(Conn* conn) {
+	drive(conn);																								// 	Queues the deferred response once no send is in flight
+}
+
+bool UringServer::watchFd(int fd, uint32_t events) {
+	if (!ring_) { return EpollServer::watchFd(fd, events); }
+	ring_->prepPollAdd(fd, events, userData(OP_WATCH, fd));
+	return true;
+}
+
+void UringServer::unwatchFd(int fd) {
+	if (!ring_) {
+		EpollServer::unwatchFd(fd);
+		return;
+	}
+	ring_->prepCancel(userData(OP_WATCH, fd), userData(OP_CANCEL, fd));
+}
+
+void UringServer::armRecv(Conn* conn) {
+	ring_conns_[conn->fd].recv_armed = true;
+	ring_->prepRecvMultishot(conn->fd, userData(OP_RECV, conn->fd));
+}
+
+// Stop using the connection now, free it once the kernel completed everything it holds
+void UringServer::closeRing(Conn* conn) {
+	UringConn& uc = ring_conns_[conn->fd];
+	if (uc.closing) { return; }
+	LOG_DEBUG("Closed on %i", conn->fd);
+	Metrics::local().add(M_CLOSES);
+	timers_.cancel(&conn->timer);
+	conn->state = STATE_CLOSE;
+	uc.closing = true;
+	if (uc.recv_armed && !uc.recv_cancelled) {
+		ring_->prepCancel(userData(OP_RECV, conn->fd), userData(OP_CANCEL, conn->fd));
+		uc.recv_cancelled = true;
+	}
+	if (uc.sends > 0) { (void)shutdown(conn->fd, SHUT_RDWR); }												// 	A stalled send would otherwise wait for the peer forever
+	finishClose(conn);
+}
+
+void UringServer::finishClose(Conn* conn) {
+	UringConn& uc = ring_conns_[conn->fd];
+	if (uc.recv_armed || uc.sends > 0) { return; }																// 	Closing the fd earlier could hand its number to a new connection under their feet
+	int fd = conn->fd;
+	(void)close(fd);
+	conns_[fd] = NULL;
+	open_conns_--;
+	buffered_bytes_ -= conn->charged;
+	uc = UringConn();
+	conn_free(conn);
+}
@@ -0,0 +1,72 @@
+#ifndef URINGSERVER_HPP
+#define URINGSERVER_HPP
+
+#include <deque>
+#include <memory>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "epollserver.hpp"
+#include "uring.hpp"
+
+const int K_URING_SEND_LINKS = 4;																				// 	Linked SENDMSGs per flush
+const int K_URING_SEND_IOV = 16;																				// 	iovecs per SENDMSG
+const unsigned K_URING_BUFS = 256;																				// 	Provided recv buffers per reactor
+const unsigned K_URING_BUF_SIZE = 16 << 10;
+
+/* 	io_uring implementation of IServer, same parsing, routing, timers and responses as
+	EpollServer, only the I/O differs. The listener has one multishot accept and every
+	connection one multishot recv fed from a ring of provided buffers, so the kernel keeps
+	receiving without being asked again; the responses of a batch go out as SENDMSGs
+	(linked when there are more slices than one can carry). All of it is submitted and
+	reaped by the single io_uring_enter() of each loop turn, instead of an epoll_wait plus
+	a read and a write per connection.
+	Falls back to EpollServer at setupServer when the kernel does not support it. */
+class UringServer : public EpollServer {
+public:
+	explicit UringServer(int maxEvents = 1024);
+	~UringServer() override;
+
+	void setupServer(int port, int timeoutMs) override;
+	bool usingUring() const;																					// 	false after a fallback to epoll
+
+protected:
+	int pollOnce(int timeoutMs) override;
+	void resumeConn(Conn* conn) override;
+	bool watchFd(int fd, uint32_t events) override;																// 	A POLL_ADD, cancelled by unwatchFd
+	void unwatchFd(int fd) override;
+
+private:
+	enum { OP_ACCEPT, OP_ACCEPT_POLL, OP_WAKE, OP_RECV, OP_SEND, OP_POLL_OUT, OP_CANCEL, OP_WATCH };
+
+	struct UringConn {																							// 	Operations in flight on one fd, next to conns_
+		bool recv_armed = false;
+		bool recv_cancelled = false;
+		bool eof = false;
+		bool closing = false;																					// 	Closed for us, the Conn is freed once the kernel let go of it
+		int sends = 0;																							// 	SENDMSG or POLL_ADD still to complete
+		bool send_failed = false;
+		struct msghdr msg[K_URING_SEND_LINKS];
+		struct iovec iov[K_URING_SEND_LINKS * K_URING_SEND_IOV];
+	};
+
+	static uint64_t userData(int op, int fd);
+	void onCompletion(const struct io_uring_cqe& cqe);
+	void onAccept(const struct io_uring_cqe& cqe);
+	void onRecv(Conn* conn, const struct io_uring_cqe& cqe);
+	void onSend(Conn* conn, int res);
+	void drive(Conn* conn);
+	bool startSend(Conn* conn);
+	void armRecv(Conn* conn);
+	void closeRing(Conn* conn);
+	void finishClose(Conn* conn);
+
+	std::unique_ptr<Uring> ring_;
+	bool armed_ = false;
+	bool accept_paused_ = false;																				// 	Out of fds, waiting for the listener to be readable
+	uint64_t wake_value_ = 0;
+	std::deque<UringConn> ring_conns_;																			// 	Indexed by fd like conns_, a deque so growing never moves a msghdr the kernel holds
+};
+
+#endif // URINGSERVER_HPP
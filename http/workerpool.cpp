@@ -0,0 +1,111 @@
+#include <unistd.h>
+
+#include "workerpool.hpp"
+
+static thread_local WorkerPool* t_pool = nullptr;																// 	Pool and deque of the calling worker thread
+static thread_local size_t t_worker = 0;
+
+WorkerPool::WorkerPool(int threads, size_t maxQueued) {
+	if (threads <= 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = cpus > 4 ? (int)cpus / 2 : 2;
+	}
+	max_queued_ = maxQueued ? maxQueued : (size_t)threads * 1024;
+	for (int i = 0; i < threads; i++) {
+		workers_.emplace_back(new Worker());
+	}
+	for (int i = 0; i < threads; i++) {
+		threads_.emplace_back(&WorkerPool::run, this, (size_t)i);
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard<std::mutex> guard(sleep_lock_);
+		stopping_ = true;
+	}
+	ready_.notify_all();
+	for (std::thread& t : threads_) {
+		t.join();
+	}
+}
+
+WorkerPool& WorkerPool::shared() {
+	static WorkerPool pool;
+	return pool;
+}
+
+void WorkerPool::submit(std::function<void()> job) {
+	queued_.fetch_add(1);
+	push(std::move(job));
+}
+
+bool WorkerPool::trySubmit(std::function<void()> job) {
+	if (queued_.fetch_add(1) >= max_queued_) {
+		queued_.fetch_sub(1);
+		return false;
+	}
+	push(std::move(job));
+	return true;
+}
+
+size_t WorkerPool::size() const {
+	return threads_.size();
+}
+
+size_t WorkerPool::queued() const {
+	return queued_.load(std::memory_order_relaxed);
+}
+
+/* 	queued_ is raised before the push and idle_ read after it, a worker raises idle_ before
+	reading queued_: one of the two always sees the other, so no job sleeps unnoticed. The
+	empty lock/unlock makes sure the worker is inside wait() before it is notified. */
+void WorkerPool::push(std::function<void()> job) {
+	size_t target = t_pool == this ? t_worker : next_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+	Worker& worker = *workers_[target];
+	{
+		std::lock_guard<std::mutex> guard(worker.lock);
+		worker.jobs.push_back(std::move(job));
+	}
+	if (idle_.load() > 0) {
+		{ std::lock_guard<std::mutex> guard(sleep_lock_); }
+		ready_.notify_one();
+	}
+}
+
+// Own deque from the back, then the others' from the front
+bool WorkerPool::take(size_t self, std::function<void()>& job) {
+	size_t n = workers_.size();
+	for (size_t i = 0; i < n; i++) {
+		Worker& worker = *workers_[(self + i) % n];
+		std::lock_guard<std::mutex> guard(worker.lock);
+		if (worker.jobs.empty()) { continue; }
+		if (i == 0) {
+			job = std::move(worker.jobs.back());
+			worker.jobs.pop_back();
+		} else {
+			job = std::move(worker.jobs.front());
+			worker.jobs.pop_front();
+		}
+		queued_.fetch_sub(1);
+		return true;
+	}
+	return false;
+}
+
+void WorkerPool::run(size_t self) {
+	t_pool = this;
+	t_worker = self;
+	while (true) {
+		std::function<void()> job;
+		if (take(self, job)) {
+			job();
+			continue;
+		}
+		std::unique_lock<std::mutex> guard(sleep_lock_);
+		idle_.fetch_add(1);
+		ready_.wait(guard, [this] { return stopping_ || queued_.load() > 0; });
+		idle_.fetch_sub(1);
+		if (stopping_ && queued_.load() == 0) { return; }														// 	Stopping, and nothing left to do
+	}
+}
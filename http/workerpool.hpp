@@ -0,0 +1,57 @@
+#ifndef WORKERPOOL_HPP
+#define WORKERPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* 	Background threads for work that must not run on a reactor: compression, blocking route
+	handlers, calls made from coroutine handlers. A job that has a result for a reactor hands
+	it back through the reactor's mailbox (EpollServer::post).
+	Every worker has its own deque. Submissions from outside are spread over them round robin,
+	a job submitted by a job goes to the back of its worker's deque; a worker takes from the
+	back of its own (LIFO, the data is still in its cache) and, once empty, steals from the
+	front of the others' before sleeping. Each deque has its own lock, held for a push or a
+	pop, so submitters and workers seldom meet on the same one. */
+class WorkerPool {
+public:
+	explicit WorkerPool(int threads = 0, size_t maxQueued = 0);												// 	threads <= 0: half the online CPUs, at least 2; maxQueued 0: 1024 per thread
+	~WorkerPool();																								// 	Runs what is queued, then joins
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	static WorkerPool& shared();																				// 	Process wide, started on first use
+
+	void submit(std::function<void()> job);																		// 	Always queued, for work that must not be lost
+	bool trySubmit(std::function<void()> job);																	// 	false when maxQueued jobs are already waiting: shed it
+	size_t size() const;
+	size_t queued() const;
+
+private:
+	struct alignas(64) Worker {
+		std::mutex lock;
+		std::deque<std::function<void()>> jobs;
+	};
+
+	void push(std::function<void()> job);
+	bool take(size_t self, std::function<void()>& job);
+	void run(size_t self);
+
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::vector<std::thread> threads_;
+	size_t max_queued_;
+	std::atomic<size_t> queued_{0};
+	std::atomic<size_t> next_{0};																				// 	Round robin for outside submitters
+	std::atomic<int> idle_{0};																					// 	Workers asleep (or about to be) on ready_
+	std::atomic<bool> stopping_{false};
+	std::mutex sleep_lock_;
+	std::condition_variable ready_;
+};
+
+#endif // WORKERPOOL_HPP
@@ -9,6 +9,7 @@
 #include <cstring>
 #include <cassert>
 #include <vector>
+#include "../../common/log.hpp"								// LOG_*, compiled out below LOG_LEVEL
 #include <poll.h>																/*	Poll is used to wait for some event on a file descriptor structure:
 				 															 		int poll(struct pollfd fds[], nfds_t nfds, int timeout)
 				 															 		fds[] - array of pollfd structures, nfds - number of structures in the array, timeout - time to wait in milliseconds
@@ -40,8 +41,8 @@ Conn* handle_accept(int fd) {
 	struct sockaddr_in addr = {};
 	socklen_t addrlen = sizeof(addr);
 	int client_fd = accept(fd, (struct sockaddr*)&addr, &addrlen);
-	printf("Accepted connection from %s:%d, fd: %i\n", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port), client_fd);
 	if (client_fd < 0) { die("accept"); }
+	LOG_DEBUG("Accepted connection from %s:%d, fd: %i", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port), client_fd);
 	set_nonblock(client_fd);
 
 	Conn* conn = new Conn();
@@ -59,10 +60,8 @@ void buffer_append(std::vector<uint8_t>* buf, const uint8_t* buff, ssize_t len)
 }
 
 void buf_consume(std::vector<uint8_t>& buf, ssize_t len) {
-	printf("Buffer size: %i\n", (int)buf.size());
-	printf("Consuming %i bytes\n", (int)len);
+	LOG_TRACE("Consuming %zd of %zu bytes", len, buf.size());
 	buf.erase(buf.begin(), buf.begin() + len);
-	printf("New buffer size: %i\n", (int)buf.size());
 }
 
 bool parse_request (Conn* conn){
@@ -72,8 +71,7 @@ bool parse_request (Conn* conn){
 												// Could also use uint32_t len = *(uint32_t*)conn->read_buf.data(); (uint32_t size is 4 bytes)
 	if (conn->read_buf.size() < 4 + len) { return false; }	// If the buffer is smaller than 4 + len, we don't have a complete message
 	const uint8_t* data = conn->read_buf.data() + 4;		// data points to the start of the message (without the length)
-	printf("Received of length: %i\n", (int)len);		// Print the length of the message and print part of the message;
-	printf("Message: %.*s\n", (int)len < 10 ? (int)len : 10, (const char*)data);	// %.*s is a format specifier that takes two arguments, the first is the length of the string and the second is the string
+	LOG_TRACE("Received of length: %u, message: %.*s", len, (int)len < 10 ? (int)len : 10, (const char*)data);	// %.*s is a format specifier that takes two arguments, the first is the length of the string and the second is the string
 																					// if the length is less than 10, print the whole string, otherwise print the first 10 characters
 															
 	
@@ -86,7 +84,7 @@ bool parse_request (Conn* conn){
 }
 
 void handle_write(Conn* conn) {
-	printf("Writing %i bytes\n", (int)conn->write_buf.size());
+	LOG_TRACE("Writing %zu bytes", conn->write_buf.size());
 	assert(conn->write_buf.size() > 0);				// assert is used to check if a condition is true, if it is not, the program will terminate
 	ssize_t rv = write(conn->fd, conn->write_buf.data(), conn->write_buf.size());
 	if (rv < 0 && errno != EAGAIN) {				// EAGAIN means that the write would block, so we should try again later
@@ -94,7 +92,7 @@ void handle_write(Conn* conn) {
 		return;
 	}
 	if (rv < 0) { conn->want_close = true; return; }
-	printf("Wrote %i bytes\n", (int)rv);
+	LOG_TRACE("Wrote %zd bytes", rv);
 	buf_consume(conn->write_buf, rv);				// Remove the written data from the write buffer
 	if (conn->write_buf.size() == 0) {
 		conn->want_write = false;
@@ -186,7 +184,7 @@ int main () {
 				handle_write(conn);
 			}
 			if (ready & POLLERR || conn->want_close ) {
-				printf("Closed on %i\n", conn->fd);
+				LOG_DEBUG("Closed on %i", conn->fd);
 				(void)close(conn->fd);
 				conns[conn->fd] = NULL;
 				delete conn;
@@ -0,0 +1,98 @@
+#ifndef EXPIREHEAP_HPP
+#define EXPIREHEAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* 	Deadlines of the keys that have a TTL, soonest first. The heap holds pointers to Expiry
+	records that keep their own position in it, so the owner of one (the key's entry in the
+	keyspace) can change or drop its deadline in O(log n) without searching. An Expiry also
+	carries the key, which is how an expiry found at the top leads back to the entry. */
+
+struct Expiry {
+	int64_t at;																									// 	Monotonic ms at which the key goes
+	size_t pos;																									// 	Index in the heap, kept up to date by ExpireHeap
+	std::string key;
+};
+
+class ExpireHeap {
+public:
+	bool empty() const {
+		return heap_.empty();
+	}
+
+	size_t size() const {
+		return heap_.size();
+	}
+
+	Expiry* top() const {
+		return heap_[0];
+	}
+
+	void push(Expiry* e) {
+		e->pos = heap_.size();
+		heap_.push_back(e);
+		up(e->pos);
+	}
+
+	// The caller owns e, it is only taken out of the heap
+	void remove(Expiry* e) {
+		size_t pos = e->pos;
+		Expiry* last = heap_.back();
+		heap_.pop_back();
+		if (last == e) { return; }
+		heap_[pos] = last;
+		last->pos = pos;
+		fix(pos);
+	}
+
+	void update(Expiry* e, int64_t at) {
+		e->at = at;
+		fix(e->pos);
+	}
+
+private:
+	void fix(size_t pos) {
+		if (pos > 0 && heap_[pos]->at < heap_[(pos - 1) / 2]->at) {
+			up(pos);
+		} else {
+			down(pos);
+		}
+	}
+
+	void up(size_t pos) {
+		Expiry* e = heap_[pos];
+		while (pos > 0) {
+			size_t parent = (pos - 1) / 2;
+			if (heap_[parent]->at <= e->at) { break; }
+			place(pos, heap_[parent]);
+			pos = parent;
+		}
+		place(pos, e);
+	}
+
+	void down(size_t pos) {
+		Expiry* e = heap_[pos];
+		size_t n = heap_.size();
+		while (true) {
+			size_t child = 2 * pos + 1;
+			if (child >= n) { break; }
+			if (child + 1 < n && heap_[child + 1]->at < heap_[child]->at) { child++; }
+			if (e->at <= heap_[child]->at) { break; }
+			place(pos, heap_[child]);
+			pos = child;
+		}
+		place(pos, e);
+	}
+
+	void place(size_t pos, Expiry* e) {
+		heap_[pos] = e;
+		e->pos = pos;
+	}
+
+	std::vector<Expiry*> heap_;
+};
+
+#endif // EXPIREHEAP_HPP
@@ -0,0 +1,323 @@
+#ifndef HASHTABLE_HPP
+#define HASHTABLE_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* 	Open addressing hash table for the keyspace, header only like ../common/timerwheel.hpp.
+	Slots are grouped by 16. Every slot has a control byte, kept in its own array: EMPTY,
+	DELETED, or the 7 low bits of the key's hash with the top bit set. A lookup loads the 16
+	control bytes of a group at once (SSE2, one compare and a movemask) and only looks at
+	the keys whose fingerprint matches, about 1 in 128 of the others. The full hash is kept
+	in the slot, so a mismatch rarely reaches a string compare and a rehash never hashes a
+	key again. Groups are probed triangularly (+1, +2, +3...), which visits every group of
+	a power of two table.
+
+	Growing is incremental, like Redis' dict: past 7/8 full a table twice as big becomes the
+	target of inserts and every operation moves K_REHASH_STEP slots of the old one over
+	(rehashStep() lets the event loop move more while idle). Lookups check both tables
+	meanwhile. Big tables are mmap'ed: the zero pages are the EMPTY control bytes, so even a
+	table of 100M slots is allocated at once and its pages are only touched as they are
+	filled, and the old table is unmapped a chunk at a time behind the rehash. No single
+	operation walks the whole table, whatever its size. Small ones come from malloc instead:
+	two whole pages would dwarf a table of a few keys, and a process may hold many of them.
+	Values move when they are rehashed: a pointer from find()/insert() is only good until
+	the next call on the table. */
+
+const size_t K_GROUP = 16;
+const size_t K_REHASH_STEP = 64;																				// 	Old slots moved by each find/insert/erase while rehashing
+const size_t K_RELEASE_CHUNK = 2 << 20;																		// 	Old slot memory unmapped this much at a time behind the rehash
+const size_t K_MMAP_MIN = 64 << 10;																				// 	Tables this big (control bytes and slots) are mmap'ed, smaller ones malloc'ed
+
+// 8 bytes at a time, murmur3's finalizer at the end; seeded per process so keys can't be chosen to collide
+inline uint64_t hash_bytes(const void* data, size_t len, uint64_t seed) {
+	const uint8_t* p = (const uint8_t*)data;
+	uint64_t h = seed ^ (len * 0x9e3779b97f4a7c15ull);
+	while (len >= 8) {
+		uint64_t k;
+		memcpy(&k, p, 8);
+		k *= 0xbf58476d1ce4e5b9ull;
+		k ^= k >> 31;
+		h = (h ^ k) * 0x94d049bb133111ebull;
+		h = (h << 27) | (h >> 37);
+		p += 8;
+		len -= 8;
+	}
+	uint64_t k = 0;
+	memcpy(&k, p, len);
+	h ^= k * 0xbf58476d1ce4e5b9ull;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+// Drawn once, every table mixes in its own address
+inline uint64_t hash_process_seed() {
+	static const uint64_t seed = []() {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		return hash_bytes(&ts, sizeof(ts), (uint64_t)getpid());
+	}();
+	return seed;
+}
+
+template <class V>
+class HashTable {
+public:
+	HashTable() {
+		uint64_t self = (uint64_t)(uintptr_t)this;
+		seed_ = hash_bytes(&self, sizeof(self), hash_process_seed());
+	}
+	~HashTable() {
+		release(tables_[0]);
+		release(tables_[1]);
+	}
+	HashTable(const HashTable&) = delete;
+	HashTable& operator=(const HashTable&) = delete;
+
+	V* find(std::string_view key) {
+		uint64_t hash = hash_bytes(key.data(), key.size(), seed_);
+		if (rehashing()) { rehashStep(K_REHASH_STEP); }
+		Slot* slot = lookup(tables_[0], key, hash);
+		if (!slot && rehashing()) { slot = lookup(tables_[1], key, hash); }
+		return slot ? &slot->value : nullptr;
+	}
+
+	// The value of key, default constructed when it is new (*created tells which)
+	V* insert(std::string_view key, bool* created = nullptr) {
+		uint64_t hash = hash_bytes(key.data(), key.size(), seed_);
+		if (rehashing()) { rehashStep(K_REHASH_STEP); }
+		Slot* slot = lookup(tables_[0], key, hash);
+		if (!slot && rehashing()) { slot = lookup(tables_[1], key, hash); }
+		if (created) { *created = !slot; }
+		if (slot) { return &slot->value; }
+		reserveOne();
+		slot = place(tables_[0], hash);
+		new (&slot->key) std::string(key);
+		new (&slot->value) V();
+		return &slot->value;
+	}
+
+	bool erase(std::string_view key) {
+		uint64_t hash = hash_bytes(key.data(), key.size(), seed_);
+		if (rehashing()) { rehashStep(K_REHASH_STEP); }
+		for (int t = 0; t < (rehashing() ? 2 : 1); t++) {
+			Slot* slot = lookup(tables_[t], key, hash);
+			if (!slot) { continue; }
+			remove(tables_[t], (size_t)(slot - tables_[t].slots));
+			return true;
+		}
+		return false;
+	}
+
+	size_t size() const {
+		return tables_[0].used + tables_[1].used;
+	}
+
+	size_t capacity() const {
+		return tables_[0].cap;
+	}
+
+	bool rehashing() const {
+		return tables_[1].cap != 0;
+	}
+
+	// Move up to slots positions of the old table, false once there is nothing left to move
+	bool rehashStep(size_t slots) {
+		Table& old = tables_[1];
+		if (!old.cap) { return false; }
+		size_t end = rehash_pos_ + slots < old.cap ? rehash_pos_ + slots : old.cap;
+		for (; rehash_pos_ < end && old.used; rehash_pos_++) {
+			if (!(old.ctrl[rehash_pos_] & K_FULL)) { continue; }
+			Slot& from = old.slots[rehash_pos_];
+			Slot* to = place(tables_[0], from.hash);
+			new (&to->key) std::string(std::move(from.key));
+			new (&to->value) V(std::move(from.value));
+			remove(old, rehash_pos_);
+		}
+		if (!old.used) {
+			release(old);
+			rehash_pos_ = 0;
+			return false;
+		}
+		size_t done = rehash_pos_ * sizeof(Slot) / K_RELEASE_CHUNK * K_RELEASE_CHUNK;						// 	Nothing before rehash_pos_ is read again, only control bytes
+		if (old.mapped && done > old.released) {
+			(void)munmap((char*)old.slots + old.released, done - old.released);
+			old.released = done;
+		}
+		return true;
+	}
+
+private:
+	static const uint8_t K_EMPTY = 0x00;																		// 	Zero pages are empty groups
+	static const uint8_t K_DELETED = 0x01;																		// 	Tombstone: probes go on past it
+	static const uint8_t K_FULL = 0x80;																			// 	| 7 bits of hash
+
+	struct Slot {
+		uint64_t hash;
+		std::string key;
+		V value;
+	};
+
+	struct Table {
+		uint8_t* ctrl = nullptr;
+		Slot* slots = nullptr;
+		size_t cap = 0;																							// 	Slots, a power of two, at least K_GROUP
+		size_t used = 0;
+		size_t tombstones = 0;
+		size_t released = 0;																					// 	Bytes at the start of slots already unmapped
+		bool mapped = false;																					// 	mmap'ed, else ctrl and slots are one malloc'ed block
+	};
+
+	// Bit i set when byte i of the group equals b
+	static uint32_t match(const uint8_t* group, uint8_t b) {
+#ifdef __SSE2__
+		__m128i ctrl = _mm_load_si128((const __m128i*)group);
+		return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)b)));
+#else
+		uint32_t bits = 0;
+		for (size_t i = 0; i < K_GROUP; i++) { bits |= (uint32_t)(group[i] == b) << i; }
+		return bits;
+#endif
+	}
+
+	// Bit i set when slot i of the group is free (empty or deleted): its control byte has no top bit
+	static uint32_t matchFree(const uint8_t* group) {
+#ifdef __SSE2__
+		return ~(uint32_t)_mm_movemask_epi8(_mm_load_si128((const __m128i*)group)) & 0xffff;
+#else
+		uint32_t bits = 0;
+		for (size_t i = 0; i < K_GROUP; i++) { bits |= (uint32_t)!(group[i] & K_FULL) << i; }
+		return bits;
+#endif
+	}
+
+	static uint8_t fingerprint(uint64_t hash) {
+		return K_FULL | (uint8_t)(hash & 0x7f);
+	}
+
+	Slot* lookup(Table& t, std::string_view key, uint64_t hash) {
+		if (!t.cap) { return nullptr; }
+		size_t mask = t.cap / K_GROUP - 1;
+		size_t g = (hash >> 7) & mask;
+		uint8_t fp = fingerprint(hash);
+		for (size_t i = 1; i <= mask + 1; i++) {
+			const uint8_t* group = t.ctrl + g * K_GROUP;
+			for (uint32_t bits = match(group, fp); bits; bits &= bits - 1) {
+				Slot& slot = t.slots[g * K_GROUP + __builtin_ctz(bits)];
+				if (slot.hash == hash && slot.key == key) { return &slot; }
+			}
+			if (match(group, K_EMPTY)) { return nullptr; }														// 	The key would have gone here
+			g = (g + i) & mask;
+		}
+		return nullptr;
+	}
+
+	// First free slot on the probe path of hash, marked full; the caller constructs key and value
+	Slot* place(Table& t, uint64_t hash) {
+		size_t mask = t.cap / K_GROUP - 1;
+		size_t g = (hash >> 7) & mask;
+		for (size_t i = 1; ; i++) {
+			uint32_t bits = matchFree(t.ctrl + g * K_GROUP);
+			if (bits) {
+				size_t idx = g * K_GROUP + __builtin_ctz(bits);
+				if (t.ctrl[idx] == K_DELETED) { t.tombstones--; }
+				t.ctrl[idx] = fingerprint(hash);
+				t.used++;
+				t.slots[idx].hash = hash;
+				return &t.slots[idx];
+			}
+			g = (g + i) & mask;
+		}
+	}
+
+	/* 	A slot whose group still has an EMPTY can go back to EMPTY: no probe ever went past
+		that group, so no chain runs through it. Otherwise it becomes a tombstone. */
+	void remove(Table& t, size_t idx) {
+		Slot& slot = t.slots[idx];
+		slot.key.~basic_string();
+		slot.value.~V();
+		const uint8_t* group = t.ctrl + idx / K_GROUP * K_GROUP;
+		if (match(group, K_EMPTY)) {
+			t.ctrl[idx] = K_EMPTY;
+		} else {
+			t.ctrl[idx] = K_DELETED;
+			t.tombstones++;
+		}
+		t.used--;
+	}
+
+	// Room for one more key in tables_[0], starting a rehash when it is 7/8 full
+	void reserveOne() {
+		Table& t = tables_[0];
+		if (t.cap && (t.used + t.tombstones + 1) * 8 <= t.cap * 7) { return; }
+		while (rehashing()) { rehashStep(t.cap); }																// 	Inserts outran the rehash (not with a doubling): finish it first
+		if (t.cap && (t.used + t.tombstones + 1) * 8 <= t.cap * 7) { return; }
+		size_t cap = t.cap ? t.cap : K_GROUP;
+		if ((t.used + 1) * 16 > t.cap * 7) { cap *= 2; }															// 	Mostly tombstones: same size, they are dropped on the way
+		tables_[1] = t;
+		tables_[0] = allocate(cap);
+		rehash_pos_ = 0;
+		if (!tables_[1].used) { release(tables_[1]); }															// 	First table, or only tombstones: nothing to move
+	}
+
+	static Table allocate(size_t cap) {
+		Table t;
+		t.cap = cap;
+		if (cap + cap * sizeof(Slot) < K_MMAP_MIN) {
+			void* block = aligned_alloc(K_GROUP, cap + cap * sizeof(Slot));								// 	Groups aligned for SSE loads; cap is a multiple of 16, so are the slots after them
+			if (!block) { throw std::bad_alloc(); }
+			memset(block, K_EMPTY, cap);
+			t.ctrl = (uint8_t*)block;
+			t.slots = (Slot*)(t.ctrl + cap);
+			return t;
+		}
+		t.mapped = true;
+		void* ctrl = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);			// 	Zero filled and page aligned: empty, and good for aligned SSE loads
+		void* slots = mmap(NULL, cap * sizeof(Slot), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ctrl == MAP_FAILED || slots == MAP_FAILED) { throw std::bad_alloc(); }
+		t.ctrl = (uint8_t*)ctrl;
+		t.slots = (Slot*)slots;
+		return t;
+	}
+
+	void release(Table& t) {
+		if (!t.cap) { return; }
+		for (size_t i = 0; i < t.cap && t.used; i++) {
+			if (!(t.ctrl[i] & K_FULL)) { continue; }
+			t.slots[i].key.~basic_string();
+			t.slots[i].value.~V();
+			t.used--;
+		}
+		if (t.mapped) {
+			(void)munmap(t.ctrl, t.cap);
+			(void)munmap((char*)t.slots + t.released, t.cap * sizeof(Slot) - t.released);
+		} else {
+			free(t.ctrl);
+		}
+		t = Table();
+	}
+
+	Table tables_[2];																							// 	[0] takes the inserts, [1] is the old table while rehashing
+	size_t rehash_pos_ = 0;																						// 	Next slot of tables_[1] to move
+	uint64_t seed_;
+};
+
+#endif // HASHTABLE_HPP
@@ -0,0 +1,545 @@
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "../common/metrics.hpp"															// 	Same HDR style histogram as the server's stats command
+
+/* 	kvbench: redis-benchmark style load generator for the KV server.
+	g++ -std=c++17 -O2 -pthread kvbench.cpp -o kvbench
+	Every thread runs an edge-triggered epoll loop over its share of the connections and keeps
+	--pipeline commands in flight on each of them (closed loop). Commands are drawn from the
+	get/set/del ratios, keys from a uniform or Zipfian distribution over --keys keys and set
+	values are --value bytes (or a random size in a min-max range). Each command type has its
+	own latency histogram, measured from the moment the command was queued. */
+
+enum { CMD_GET, CMD_SET, CMD_DEL, CMD_COUNT };
+static const char* const K_CMD_NAMES[CMD_COUNT] = {"get", "set", "del"};
+
+enum {																						// 	Result codes of the server (RES_*)
+	RES_OK,
+	RES_ERR,
+	RES_NX
+};
+
+struct KvBenchConfig {
+	std::string host = "127.0.0.1";
+	int port = 1234;
+	int connections = 50;
+	int threads = 2;
+	int pipeline = 1;
+	double duration_s = 10;
+	uint64_t requests = 0;																	// 	Stop after this many commands instead of after duration_s
+	int ratios[CMD_COUNT] = {80, 20, 0};													// 	get/set/del weights
+	uint64_t keys = 100000;
+	double zipf = 0;																		// 	Skew, 0 means uniform, 0.99 is the YCSB default
+	size_t value_min = 64;
+	size_t value_max = 64;
+	bool preload = false;																	// 	Set every key once before measuring
+	int timeout_ms = 2000;
+};
+
+/* 	Zipfian ranks in [0, n) with skew theta (Gray et al., "Quickly generating billion-record
+	synthetic databases", as used by YCSB). zeta(n) is computed once, a draw is O(1). */
+class ZipfGenerator {
+public:
+	ZipfGenerator(uint64_t n, double theta) : n_(n), theta_(theta) {
+		if (theta_ <= 0) { return; }
+		double zeta2 = 0;
+		for (uint64_t i = 1; i <= n_; i++) {
+			double term = 1.0 / std::pow((double)i, theta_);
+			zetan_ += term;
+			if (i == 2) { zeta2 = zetan_; }
+		}
+		alpha_ = 1.0 / (1.0 - theta_);
+		eta_ = (1.0 - std::pow(2.0 / (double)n_, 1.0 - theta_)) / (1.0 - zeta2 / zetan_);
+	}
+
+	template <class Rng>
+	uint64_t next(Rng& rng) const {
+		if (theta_ <= 0) { return std::uniform_int_distribution<uint64_t>(0, n_ - 1)(rng); }
+		double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+		double uz = u * zetan_;
+		if (uz < 1.0) { return 0; }
+		if (uz < 1.0 + std::pow(0.5, theta_)) { return n_ > 1 ? 1 : 0; }
+		uint64_t rank = (uint64_t)((double)n_ * std::pow(eta_ * u - eta_ + 1.0, alpha_));
+		return rank < n_ ? rank : n_ - 1;
+	}
+
+private:
+	uint64_t n_;
+	double theta_;
+	double zetan_ = 0;
+	double alpha_ = 0;
+	double eta_ = 0;
+};
+
+struct KvConn {
+	int fd = -1;
+	std::string out;
+	size_t out_pos = 0;
+	std::string in;
+	struct Pending {
+		uint64_t sent_ns;
+		uint8_t cmd;
+	};
+	std::deque<Pending> sent;																// 	Commands in flight, answered in order
+};
+
+struct KvStats {
+	std::vector<uint64_t> buckets[CMD_COUNT];
+	uint64_t count[CMD_COUNT] = {};
+	uint64_t sum[CMD_COUNT] = {};
+	uint64_t max[CMD_COUNT] = {};
+	uint64_t results[3] = {};																// 	By result code
+	uint64_t errors = 0;																	// 	Connection errors, commands lost with them
+
+	KvStats() {
+		for (int c = 0; c < CMD_COUNT; c++) {
+			buckets[c].resize(K_HIST_BUCKETS);
+		}
+	}
+
+	void record(int cmd, uint64_t ns) {
+		buckets[cmd][hist_bucket(ns)]++;
+		count[cmd]++;
+		sum[cmd] += ns;
+		if (ns > max[cmd]) { max[cmd] = ns; }
+	}
+};
+
+static std::atomic<bool> g_stop{false};
+static std::atomic<int64_t> g_remaining{0};
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void usage(const char* argv0) {
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -h, --host H          server address (127.0.0.1)\n"
+		"  -p, --port N          server port (1234)\n"
+		"  -c, --connections N   open connections (50)\n"
+		"  -t, --threads N       client threads (2)\n"
+		"  -P, --pipeline N      commands in flight per connection (1)\n"
+		"  -d, --duration S      test length in seconds (10)\n"
+		"  -n, --requests N      stop after N commands instead of a duration\n"
+		"  -r, --ratio G:S:D     get:set:del weights (80:20:0)\n"
+		"  -k, --keys N          key space (100000)\n"
+		"  -z, --zipf THETA      Zipfian key skew, 0 for uniform (0)\n"
+		"  -v, --value N[-M]     value size in bytes, or a random size in N..M (64)\n"
+		"  -l, --preload         set every key once before the test\n", argv0);
+	exit(1);
+}
+
+static void append_u32(std::string* out, uint32_t v) {
+	out->append((const char*)&v, 4);														// 	The protocol is little endian, like the server
+}
+
+// [len][nstr][len][str]... as real_request() expects it
+static void append_command(std::string* out, const char* name, const std::string& key, const char* value, size_t value_len) {
+	uint32_t nstr = value ? 3 : 2;
+	uint32_t len = 4 + 4 + (uint32_t)strlen(name) + 4 + (uint32_t)key.size() + (value ? 4 + (uint32_t)value_len : 0);
+	append_u32(out, len);
+	append_u32(out, nstr);
+	append_u32(out, (uint32_t)strlen(name));
+	out->append(name);
+	append_u32(out, (uint32_t)key.size());
+	out->append(key);
+	if (value) {
+		append_u32(out, (uint32_t)value_len);
+		out->append(value, value_len);
+	}
+}
+
+static int connect_to(const struct sockaddr_in& addr) {
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) { return -1; }
+	if (connect(fd, (const struct sockaddr*)&addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	return fd;
+}
+
+class KvBenchThread {
+public:
+	KvBenchThread(const KvBenchConfig& cfg, const ZipfGenerator& zipf, const std::string& values, const struct sockaddr_in& addr, int connections, unsigned seed)
+		: cfg_(cfg), zipf_(zipf), values_(values), addr_(addr), conns_(connections), rng_(seed) {
+		for (int c = 0; c < CMD_COUNT; c++) {
+			ratio_total_ += cfg_.ratios[c];
+		}
+	}
+
+	void run(uint64_t start_ns) {
+		epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+		for (KvConn& conn : conns_) {
+			open(&conn);
+		}
+		std::vector<struct epoll_event> events(256);
+		uint64_t deadline = start_ns + (uint64_t)(cfg_.duration_s * 1e9);
+		uint64_t stop_at = 0;
+		while (true) {
+			uint64_t now = now_ns();
+			if (cfg_.requests == 0 && now >= deadline) { g_stop = true; }
+			if (g_stop) {
+				if (stop_at == 0) { stop_at = now + (uint64_t)cfg_.timeout_ms * 1000000; }
+				if (inflight() == 0 || now >= stop_at) { break; }
+			}
+			for (KvConn& conn : conns_) {
+				fill(&conn);
+			}
+			int n = epoll_wait(epoll_fd_, events.data(), (int)events.size(), 10);
+			for (int i = 0; i < n; i++) {
+				KvConn* conn = &conns_[events[i].data.u32];
+				if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) { receive(conn); }
+				if (conn->fd >= 0 && (events[i].events & EPOLLOUT)) { flush(conn); }
+			}
+		}
+		for (KvConn& conn : conns_) {
+			stats_.errors += conn.sent.size();
+			if (conn.fd >= 0) { close(conn.fd); }
+		}
+		close(epoll_fd_);
+	}
+
+	// One set per key in [first, last), pipelined on a single connection, before the clock starts
+	bool preload(uint64_t first, uint64_t last) {
+		int fd = connect_to(addr_);
+		if (fd < 0) { return false; }
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+		const uint64_t K_BATCH = 256;
+		for (uint64_t key = first; key < last; key += K_BATCH) {
+			std::string out;
+			uint64_t end = key + K_BATCH < last ? key + K_BATCH : last;
+			for (uint64_t k = key; k < end; k++) {
+				size_t len = value_size();
+				append_command(&out, "set", key_name(k), values_.data(), len);
+			}
+			if (!write_all(fd, out.data(), out.size())) { close(fd); return false; }
+			for (uint64_t k = key; k < end; k++) {
+				uint32_t len;
+				std::string body;
+				if (!read_all(fd, (char*)&len, 4)) { close(fd); return false; }
+				body.resize(len);
+				if (!read_all(fd, &body[0], len)) { close(fd); return false; }
+			}
+		}
+		close(fd);
+		return true;
+	}
+
+	const KvStats& stats() const { return stats_; }
+
+private:
+	static bool write_all(int fd, const char* buf, size_t n) {
+		while (n > 0) {
+			ssize_t rv = write(fd, buf, n);
+			if (rv <= 0) { return false; }
+			buf += rv;
+			n -= (size_t)rv;
+		}
+		return true;
+	}
+
+	static bool read_all(int fd, char* buf, size_t n) {
+		while (n > 0) {
+			ssize_t rv = read(fd, buf, n);
+			if (rv <= 0) { return false; }
+			buf += rv;
+			n -= (size_t)rv;
+		}
+		return true;
+	}
+
+	static std::string key_name(uint64_t k) {
+		char buf[32];
+		int n = snprintf(buf, sizeof(buf), "key:%llu", (unsigned long long)k);
+		return std::string(buf, (size_t)n);
+	}
+
+	size_t value_size() {
+		if (cfg_.value_min == cfg_.value_max) { return cfg_.value_min; }
+		return std::uniform_int_distribution<size_t>(cfg_.value_min, cfg_.value_max)(rng_);
+	}
+
+	uint64_t inflight() const {
+		uint64_t n = 0;
+		for (const KvConn& conn : conns_) {
+			n += conn.sent.size();
+		}
+		return n;
+	}
+
+	void open(KvConn* conn) {
+		conn->fd = connect_to(addr_);
+		if (conn->fd < 0) {
+			stats_.errors++;
+			return;
+		}
+		struct epoll_event ev = {};
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.u32 = (uint32_t)(conn - conns_.data());
+		epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, conn->fd, &ev);
+	}
+
+	void reopen(KvConn* conn) {
+		stats_.errors += conn->sent.size();
+		close(conn->fd);
+		conn->fd = -1;
+		conn->sent.clear();
+		conn->out.clear();
+		conn->out_pos = 0;
+		conn->in.clear();
+		if (!g_stop) { open(conn); }
+	}
+
+	bool take_request() {
+		if (g_stop) { return false; }
+		if (cfg_.requests == 0) { return true; }
+		if (g_remaining.fetch_sub(1, std::memory_order_relaxed) > 0) { return true; }
+		g_stop = true;
+		return false;
+	}
+
+	int pick_command() {
+		int r = std::uniform_int_distribution<int>(0, ratio_total_ - 1)(rng_);
+		for (int c = 0; c < CMD_COUNT; c++) {
+			if (r < cfg_.ratios[c]) { return c; }
+			r -= cfg_.ratios[c];
+		}
+		return CMD_GET;
+	}
+
+	// Top the pipeline up to --pipeline commands in flight
+	void fill(KvConn* conn) {
+		if (conn->fd < 0) {
+			if (!g_stop) { open(conn); }
+			if (conn->fd < 0) { return; }
+		}
+		bool queued = false;
+		uint64_t now = now_ns();
+		while ((int)conn->sent.size() < cfg_.pipeline && take_request()) {
+			int cmd = pick_command();
+			std::string key = key_name(zipf_.next(rng_));
+			if (cmd == CMD_SET) {
+				append_command(&conn->out, "set", key, values_.data(), value_size());
+			} else {
+				append_command(&conn->out, K_CMD_NAMES[cmd], key, NULL, 0);
+			}
+			conn->sent.push_back(KvConn::Pending{now, (uint8_t)cmd});
+			queued = true;
+		}
+		if (queued) { flush(conn); }
+	}
+
+	void flush(KvConn* conn) {
+		while (conn->out_pos < conn->out.size()) {
+			ssize_t rv = write(conn->fd, conn->out.data() + conn->out_pos, conn->out.size() - conn->out_pos);
+			if (rv < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK) { return; }
+				if (errno == EINTR) { continue; }
+				reopen(conn);
+				return;
+			}
+			conn->out_pos += (size_t)rv;
+		}
+		conn->out.clear();
+		conn->out_pos = 0;
+	}
+
+	void receive(KvConn* conn) {
+		char buf[64 << 10];
+		while (conn->fd >= 0) {
+			ssize_t rv = read(conn->fd, buf, sizeof(buf));
+			if (rv < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK) { return; }
+				if (errno == EINTR) { continue; }
+				reopen(conn);
+				return;
+			}
+			if (rv == 0) {
+				reopen(conn);
+				return;
+			}
+			conn->in.append(buf, (size_t)rv);
+			size_t pos = 0;
+			uint64_t now = now_ns();
+			while (conn->in.size() - pos >= 4) {												// 	[len][rescode][data]
+				uint32_t len;
+				memcpy(&len, conn->in.data() + pos, 4);
+				if (conn->in.size() - pos - 4 < len) { break; }
+				if (len < 4 || conn->sent.empty()) {
+					reopen(conn);
+					return;
+				}
+				uint32_t rescode;
+				memcpy(&rescode, conn->in.data() + pos + 4, 4);
+				stats_.results[rescode < 3 ? rescode : (uint32_t)RES_ERR]++;
+				stats_.record(conn->sent.front().cmd, now - conn->sent.front().sent_ns);
+				conn->sent.pop_front();
+				pos += 4 + len;
+			}
+			conn->in.erase(0, pos);
+			fill(conn);																	// 	Closed loop: refill right away
+		}
+	}
+
+	const KvBenchConfig& cfg_;
+	const ZipfGenerator& zipf_;
+	const std::string& values_;
+	struct sockaddr_in addr_;
+	std::vector<KvConn> conns_;
+	std::mt19937_64 rng_;
+	int ratio_total_ = 0;
+	int epoll_fd_ = -1;
+	KvStats stats_;
+};
+
+static std::string format_ns(double ns) {
+	char buf[32];
+	if (ns < 1e3) { snprintf(buf, sizeof(buf), "%.0fns", ns); }
+	else if (ns < 1e6) { snprintf(buf, sizeof(buf), "%.2fus", ns / 1e3); }
+	else if (ns < 1e9) { snprintf(buf, sizeof(buf), "%.2fms", ns / 1e6); }
+	else { snprintf(buf, sizeof(buf), "%.2fs", ns / 1e9); }
+	return buf;
+}
+
+int main(int argc, char** argv) {
+	KvBenchConfig cfg;
+	static const struct option K_OPTIONS[] = {
+		{"host", required_argument, NULL, 'h'}, {"port", required_argument, NULL, 'p'},
+		{"connections", required_argument, NULL, 'c'}, {"threads", required_argument, NULL, 't'},
+		{"pipeline", required_argument, NULL, 'P'}, {"duration", required_argument, NULL, 'd'},
+		{"requests", required_argument, NULL, 'n'}, {"ratio", required_argument, NULL, 'r'},
+		{"keys", required_argument, NULL, 'k'}, {"zipf", required_argument, NULL, 'z'},
+		{"value", required_argument, NULL, 'v'}, {"preload", no_argument, NULL, 'l'},
+		{NULL, 0, NULL, 0}
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "h:p:c:t:P:d:n:r:k:z:v:l", K_OPTIONS, NULL)) != -1) {
+		switch (opt) {
+			case 'h': cfg.host = optarg; break;
+			case 'p': cfg.port = atoi(optarg); break;
+			case 'c': cfg.connections = atoi(optarg); break;
+			case 't': cfg.threads = atoi(optarg); break;
+			case 'P': cfg.pipeline = atoi(optarg); break;
+			case 'd': cfg.duration_s = atof(optarg); break;
+			case 'n': cfg.requests = strtoull(optarg, NULL, 10); break;
+			case 'r':
+				if (sscanf(optarg, "%d:%d:%d", &cfg.ratios[CMD_GET], &cfg.ratios[CMD_SET], &cfg.ratios[CMD_DEL]) != 3) { usage(argv[0]); }
+				break;
+			case 'k': cfg.keys = strtoull(optarg, NULL, 10); break;
+			case 'z': cfg.zipf = atof(optarg); break;
+			case 'v': {
+				char* end = NULL;
+				cfg.value_min = cfg.value_max = strtoull(optarg, &end, 10);
+				if (end && *end == '-') { cfg.value_max = strtoull(end + 1, NULL, 10); }
+				break;
+			}
+			case 'l': cfg.preload = true; break;
+			default: usage(argv[0]);
+		}
+	}
+	if (optind != argc || cfg.connections <= 0 || cfg.threads <= 0 || cfg.pipeline <= 0 || cfg.keys == 0) { usage(argv[0]); }
+	if (cfg.ratios[CMD_GET] < 0 || cfg.ratios[CMD_SET] < 0 || cfg.ratios[CMD_DEL] < 0
+		|| cfg.ratios[CMD_GET] + cfg.ratios[CMD_SET] + cfg.ratios[CMD_DEL] <= 0) { usage(argv[0]); }
+	if (cfg.value_max < cfg.value_min || cfg.zipf >= 1.0) { usage(argv[0]); }
+	if (cfg.threads > cfg.connections) { cfg.threads = cfg.connections; }
+
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(cfg.port);
+	if (inet_pton(AF_INET, cfg.host.c_str(), &addr.sin_addr) != 1) {
+		fprintf(stderr, "bad address %s\n", cfg.host.c_str());
+		return 1;
+	}
+
+	ZipfGenerator zipf(cfg.keys, cfg.zipf);
+	std::string values(cfg.value_max, 'x');													// 	Every value is a prefix of this one
+	std::vector<std::unique_ptr<KvBenchThread>> workers;
+	for (int i = 0; i < cfg.threads; i++) {
+		int share = cfg.connections / cfg.threads + (i < cfg.connections % cfg.threads ? 1 : 0);
+		workers.emplace_back(new KvBenchThread(cfg, zipf, values, addr, share, 0x5eed + i));
+	}
+	if (cfg.preload) {
+		printf("Preloading %llu keys\n", (unsigned long long)cfg.keys);
+		if (!workers[0]->preload(0, cfg.keys)) {
+			fprintf(stderr, "preload failed\n");
+			return 1;
+		}
+	}
+
+	g_remaining = (int64_t)cfg.requests;
+	printf("%d threads, %d connections, pipeline %d, get:set:del %d:%d:%d, %llu keys %s, values %zu-%zu bytes\n",
+		cfg.threads, cfg.connections, cfg.pipeline, cfg.ratios[CMD_GET], cfg.ratios[CMD_SET], cfg.ratios[CMD_DEL],
+		(unsigned long long)cfg.keys, cfg.zipf > 0 ? "zipfian" : "uniform", cfg.value_min, cfg.value_max);
+	uint64_t start = now_ns();
+	std::vector<std::thread> threads;
+	for (auto& worker : workers) {
+		KvBenchThread* w = worker.get();
+		threads.emplace_back([w, start] { w->run(start); });
+	}
+	for (std::thread& t : threads) {
+		t.join();
+	}
+	double elapsed = (double)(now_ns() - start) / 1e9;
+
+	HistogramSnapshot hist[CMD_COUNT];
+	uint64_t results[3] = {};
+	uint64_t errors = 0;
+	uint64_t total = 0;
+	for (auto& worker : workers) {
+		const KvStats& s = worker->stats();
+		for (int c = 0; c < CMD_COUNT; c++) {
+			for (size_t i = 0; i < K_HIST_BUCKETS; i++) {
+				hist[c].buckets[i] += s.buckets[c][i];
+			}
+			hist[c].count += s.count[c];
+			hist[c].sum += s.sum[c];
+			if (s.max[c] > hist[c].max) { hist[c].max = s.max[c]; }
+			total += s.count[c];
+		}
+		for (int r = 0; r < 3; r++) {
+			results[r] += s.results[r];
+		}
+		errors += s.errors;
+	}
+
+	printf("  %llu commands in %.2fs, %.2f ops/sec\n", (unsigned long long)total, elapsed, total / elapsed);
+	printf("  results: ok %llu, nx %llu, err %llu, connection errors %llu\n", (unsigned long long)results[RES_OK],
+		(unsigned long long)results[RES_NX], (unsigned long long)results[RES_ERR], (unsigned long long)errors);
+	printf("  %-4s %10s %12s %10s %10s %10s %10s %10s %10s\n", "cmd", "count", "ops/sec", "mean", "p50", "p90", "p99", "p99.9", "max");
+	for (int c = 0; c < CMD_COUNT; c++) {
+		const HistogramSnapshot& h = hist[c];
+		if (h.count == 0) { continue; }
+		printf("  %-4s %10llu %12.2f %10s %10s %10s %10s %10s %10s\n", K_CMD_NAMES[c], (unsigned long long)h.count, h.count / elapsed,
+			format_ns((double)h.sum / h.count).c_str(), format_ns((double)h.percentile(50)).c_str(), format_ns((double)h.percentile(90)).c_str(),
+			format_ns((double)h.percentile(99)).c_str(), format_ns((double)h.percentile(99.9)).c_str(), format_ns((double)h.max).c_str());
+	}
+	return 0;
+}
@@ -1,15 +1,21 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <iostream>
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <strings.h>
 #include <cassert>
 #include <vector>
-#include <map>
+#include <string_view>
+#include <charconv>
+#include <time.h>
+#include <csignal>
+#include <fcntl.h>
 #include <poll.h>																/*	Poll is used to wait for some event on a file descriptor structure:
 				 															 		int poll(struct pollfd fds[], nfds_t nfds, int timeout)
 				 															 		fds[] - array of pollfd structures, nfds - number of structures in the array, timeout - time to wait in milliseconds
@@ -26,6 +32,14 @@
  																					so the read is guaranteed not to block, but for a disk file, no such buffer exists in 
 																					the kernel, so the readiness for a disk file is undefined. */
 #include "utils.hpp"
+#include "hashtable.hpp"
+#include "expireheap.hpp"
+#include "zset.hpp"
+#include "../common/bufferpool.hpp"
+#include "../common/timerwheel.hpp"
+#include "../common/metrics.hpp"
+#include "../common/uring.hpp"
+#include "../common/log.hpp"											// 	LOG_*, compiled out below LOG_LEVEL (g++ -DLOG_LEVEL=LOG_LEVEL_TRACE ...)
 
 enum {
 	STATE_READ,
@@ -41,51 +55,249 @@ enum {
 
 const size_t MAX_BUF_SIZE = 32 << 20; 												// 32 MB
 const size_t K_MAX_STRINGS = 1024;
+const uint32_t K_IDLE_TIMEOUT_MS = 60000;																		// 	Connection without a pending message or response
+const uint32_t K_IO_TIMEOUT_MS = 5000;																			// 	Half received message or unsent response without progress
+const size_t K_WRITE_HIGH_WATER = 256 << 10;																	// 	Unsent response bytes at which a connection stops decoding until they are out
+const size_t K_READ_BUF_INITIAL = 4 << 10;																	// 	First read buffer, doubled while full (up to 4+MAX_BUF_SIZE)
 
 struct Conn{
 		int fd = -1;
 		uint8_t state = STATE_READ;
 		size_t read_size = 0;
-		uint8_t read_buf[4+MAX_BUF_SIZE];
+		Buffer read_buf;																						// 	Pooled and growable, released whenever it drains
 		size_t write_size = 0;
-		uint8_t write_buf[4+MAX_BUF_SIZE];
+		size_t write_pos = 0;																					// 	Bytes of write_buf already sent
+		Buffer write_buf;
+		TimerNode timer;																						// 	Idle / IO deadline in g_timers
+		bool recv_armed = false;																				// 	io_uring mode: multishot recv in flight
+		bool recv_cancelled = false;
+		bool closing = false;																					// 	Closed, freed once the kernel completed what it holds
+		bool sending = false;																					// 	The SENDMSG below is in flight, write_buf must not move
+		struct iovec send_iov;
+		struct msghdr send_hdr;
+		size_t charged = 0;																						// 	Buffer bytes of this connection counted in g_buffered_bytes
 };
 
-/* Conn struct buffers could be allocated in heap when is constructed using:
-struct Conn{
-	int fd = -1;
-	uint8_t state = STATE_READ;
-	size_t read_size = 0;
-	uint8_t* read_buf;
-	size_t write_size = 0;
-	uint8_t* write_buf;
-	Conn() {
-		read_buf = new uint8_t[4+MAX_BUF_SIZE];
-		write_buf = new uint8_t[4+MAX_BUF_SIZE];
-	}
-	~Conn() {
-		delete[] read_buf;
-		delete[] write_buf;
-	}
-}; but sizeof(read_buf) and sizeof(write_buf) will be 8 bytes (size of a pointer) */
-
-Conn* handle_accept(int fd) {
-	struct sockaddr_in addr = {};
-	socklen_t addrlen = sizeof(addr);
-	int client_fd = accept(fd, (struct sockaddr*)&addr, &addrlen);
-	printf("Accepted connection from %s:%d, fd: %i\n", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port), client_fd);
-	if (client_fd < 0) { die("accept"); }
-	set_nonblock(client_fd);
-
-	Conn* conn = new Conn();																					/* 	Sometimes this is necessary to allocate memory in the heap, 
-																													also when we exit the scope of the function, the memory is not deallocated so
-																													releasing the memory is our responsibility, and we can return the pointer to the memory */
+/* 	The buffers used to be inline arrays (uint8_t read_buf[4+MAX_BUF_SIZE], 64 MB per Conn),
+	now they come from the thread's BufferPool (../common/bufferpool.hpp): a connection starts
+	with no buffer memory, takes 4 KB on its first read, grows while a message does not fit and
+	gives the memory back when everything is consumed. The Conn itself comes from ObjectPool. */
+
+static Conn* new_conn(int client_fd) {
+	Metrics::local().add(M_ACCEPTS);
+	Conn* conn = ObjectPool<Conn>::create();																	/* 	Popped from a per-thread free list of Conn slots, released with ObjectPool<Conn>::destroy(),
+																													freeing the Conn is still our responsibility */
 	conn->fd = client_fd;
 	conn->state = STATE_READ;
+	int one = 1;
+	setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));									// 	Responses are already batched per read, Nagle would only hold back the last one of a batch
 	return conn;
 }
 
-static std::map<std::string, std::string> g_map; 																// 	Map is a key-value pair, in this case, the key and value are both strings
+static TimerWheel g_timers;																						// 	One timer per connection, poll() sleeps until the nearest one
+static Uring* g_ring = NULL;																						// 	Set when running on io_uring ("./server uring"), NULL for poll()
+
+// Admission control, set from the command line, 0 is unlimited
+static size_t g_max_conns = 0;
+static size_t g_max_buffered = 0;																				// 	Read and write buffer bytes of all connections before commands are refused
+static size_t g_open_conns = 0;
+static size_t g_buffered_bytes = 0;
+static int g_reserve_fd = -1;																					// 	Spare fd given up to accept (and refuse) a connection on EMFILE
+const int K_ACCEPT_BATCH = 64;																					// 	Connections accepted per wakeup, poll() reports the rest again
+
+static int64_t now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Re-armed after every event: a connection is reaped only after a full timeout without progress
+static void arm_timer(Conn* conn, int64_t now) {
+	bool busy = conn->read_size > 0 || conn->write_size > conn->write_pos;
+	g_timers.arm(&conn->timer, now, busy ? K_IO_TIMEOUT_MS : K_IDLE_TIMEOUT_MS);
+}
+
+static void free_conn(std::vector<Conn*>& conns, Conn* conn) {
+	(void)close(conn->fd);
+	conns[conn->fd] = NULL;
+	g_open_conns--;
+	g_buffered_bytes -= conn->charged;
+	ObjectPool<Conn>::destroy(conn);
+}
+
+static void close_conn(std::vector<Conn*>& conns, Conn* conn) {
+	LOG_DEBUG("Closed on %i", conn->fd);
+	Metrics::local().add(M_CLOSES);
+	g_timers.cancel(&conn->timer);
+	free_conn(conns, conn);
+}
+
+// Keep g_buffered_bytes in step with the buffers the connection holds after an event
+static void charge(Conn* conn) {
+	size_t now = conn->read_buf.capacity() + conn->write_buf.capacity();
+	g_buffered_bytes += now - conn->charged;
+	conn->charged = now;
+}
+
+static bool overloaded() {
+	return (g_max_conns && g_open_conns >= g_max_conns) || (g_max_buffered && g_buffered_bytes >= g_max_buffered);
+}
+
+static void add_conn(std::vector<Conn*>& conns, Conn* conn, int64_t now) {
+	if (conns.size() <= (size_t)conn->fd) {																	// 	If the total size of the vector is less than the file descriptor of the new connection, resize the vector
+		conns.resize(conn->fd + 1);																			// 	to at least have the size of the file descriptor of the new connection example= conns[5] means we have 6 connections
+	}
+	conns[conn->fd] = conn;																					// 	Add the new connection to conns vector at the index of the file descriptor
+	g_open_conns++;
+	conn->timer.data = conn;
+	arm_timer(conn, now);
+}
+
+// Refuse a connection before it costs anything: a single error response ("server busy") and close
+static void reject(int fd) {
+	static const char K_BUSY[] = "server busy";
+	uint8_t frame[8 + sizeof(K_BUSY) - 1];
+	uint32_t len = 4 + sizeof(K_BUSY) - 1;
+	uint32_t rescode = RES_ERR;
+	memcpy(frame, &len, 4);
+	memcpy(frame + 4, &rescode, 4);
+	memcpy(frame + 8, K_BUSY, sizeof(K_BUSY) - 1);
+	ssize_t rv = send(fd, frame, sizeof(frame), MSG_NOSIGNAL | MSG_DONTWAIT);									// 	The socket buffer is empty, it can't block
+	(void)rv;
+	(void)close(fd);
+	Metrics::local().add(M_REJECTS);
+}
+
+/* 	Out of fds: the connection would stay in the backlog and the listener keep waking us up.
+	Free the spare fd, take the connection with it, refuse it and take the spare back. */
+static bool accept_overflow(int listen_fd) {
+	LOG_DEBUG("accept: %s, refusing a connection", strerror(errno));
+	if (g_reserve_fd >= 0) {
+		(void)close(g_reserve_fd);
+		g_reserve_fd = -1;
+	}
+	int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd >= 0) { reject(fd); }
+	g_reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	return fd >= 0;
+}
+
+/* 	Used to be a single accept() per wakeup that died on any error, so running out of fds in a
+	connection storm took the whole server down. Now it takes up to K_ACCEPT_BATCH connections
+	and no error is fatal: EMFILE goes through the reserve fd, the limits refuse with an error. */
+static void accept_all(int fd, std::vector<Conn*>& conns, int64_t now) {
+	for (int accepted = 0; accepted < K_ACCEPT_BATCH; accepted++) {
+		struct sockaddr_in addr = {};
+		socklen_t addrlen = sizeof(addr);
+		int client_fd = accept4(fd, (struct sockaddr*)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (client_fd < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) { return; }
+			if (errno == EINTR || errno == ECONNABORTED) { continue; }
+			if ((errno == EMFILE || errno == ENFILE) && accept_overflow(fd)) { continue; }
+			LOG_WARN("accept: %s", strerror(errno));
+			return;
+		}
+		if (overloaded()) {
+			reject(client_fd);
+			continue;
+		}
+		LOG_DEBUG("Accepted connection from %s:%d, fd: %i", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port), client_fd);
+		add_conn(conns, new_conn(client_fd), now);
+	}
+}
+
+// A key's value, a string or (zset set) a sorted set, and its deadline when it has a TTL (both owned by the entry, the Expiry is also in g_expires)
+struct Entry {
+	std::string value;
+	ZSet* zset = NULL;
+	Expiry* expiry = NULL;																						// 	Plain pointers: the table moves entries while rehashing
+};
+
+static HashTable<Entry> g_map; 																					// 	The keyspace, keys are strings (hashtable.hpp)
+static ExpireHeap g_expires;																					// 	The entries of g_map that have a TTL, soonest first (expireheap.hpp)
+static uint64_t g_expired_keys = 0;
+
+static void persist_entry(Entry* e) {
+	if (!e->expiry) { return; }
+	g_expires.remove(e->expiry);
+	delete e->expiry;
+	e->expiry = NULL;
+}
+
+static void expire_entry(std::string_view key, Entry* e, int64_t at) {
+	if (e->expiry) {
+		g_expires.update(e->expiry, at);
+		return;
+	}
+	e->expiry = new Expiry{at, 0, std::string(key)};
+	g_expires.push(e->expiry);
+}
+
+// Frees what e owns and removes it from g_map, key may point into its Expiry
+static void erase_entry(std::string_view key, Entry* e) {
+	Expiry* expiry = e->expiry;
+	if (expiry) { g_expires.remove(expiry); }
+	delete e->zset;
+	g_map.erase(key);
+	delete expiry;
+}
+
+static bool delete_key(std::string_view key) {
+	Entry* e = g_map.find(key);
+	if (!e) { return false; }
+	erase_entry(key, e);
+	return true;
+}
+
+// The entry of key, NULL when there is none or its TTL ran out: the key is deleted then (lazy expiry)
+static Entry* lookup_key(std::string_view key) {
+	Entry* e = g_map.find(key);
+	if (!e || !e->expiry || e->expiry->at > now_ms()) { return e; }
+	erase_entry(key, e);
+	g_expired_keys++;
+	return NULL;
+}
+
+/* 	Between two turns of the event loop, work that would otherwise fall on commands runs for a
+	bounded time: deleting the keys whose TTL passed (soonest first, straight from the top of
+	g_expires, no sampling or scan needed) so an expired key does not hold memory until someone
+	asks for it, then moving the slots of a rehash. */
+const uint64_t K_BACKGROUND_BUDGET_NS = 1000000;																// 	Per idle turn, a tenth when connections are waiting
+const size_t K_REHASH_IDLE_STEP = 1024;
+const int K_REHASH_TICK_MS = 10;																				// 	Longest sleep while there is rehashing left
+const int64_t K_MAX_WAIT_MS = 1 << 30;
+
+static int next_wait_ms(int64_t now) {
+	int wait = g_timers.nextTimeoutMs(now);
+	if (g_map.rehashing() && (wait < 0 || wait > K_REHASH_TICK_MS)) { wait = K_REHASH_TICK_MS; }
+	if (!g_expires.empty()) {
+		int64_t until = g_expires.top()->at - now;															// 	Up when the next key expires
+		if (until < 0) { until = 0; }
+		if (until > K_MAX_WAIT_MS) { until = K_MAX_WAIT_MS; }
+		if (wait < 0 || until < wait) { wait = (int)until; }
+	}
+	return wait;
+}
+
+// false when the budget ran out with expired keys left
+static bool expire_cycle(uint64_t start, uint64_t budget) {
+	int64_t now = now_ms();
+	for (size_t n = 1; !g_expires.empty() && g_expires.top()->at <= now; n++) {
+		Expiry* expiry = g_expires.top();
+		erase_entry(expiry->key, g_map.find(expiry->key));
+		g_expired_keys++;
+		if (n % 32 == 0 && metrics_now_ns() - start >= budget) { return false; }
+	}
+	return true;
+}
+
+static void background_work(bool idle) {
+	if (!g_map.rehashing() && g_expires.empty()) { return; }
+	uint64_t start = metrics_now_ns();
+	uint64_t budget = idle ? K_BACKGROUND_BUDGET_NS : K_BACKGROUND_BUDGET_NS / 10;						// 	Connections are waiting: a slice only
+	if (!expire_cycle(start, budget)) { return; }
+	while (g_map.rehashStep(K_REHASH_IDLE_STEP) && metrics_now_ns() - start < budget) { }
+}
 
 // Request format:
 // +------+-----+------+-----+------+-----+-----+------+
@@ -96,133 +308,539 @@ static std::map<std::string, std::string> g_map; 																// 	Map is a ke
 // | status | data... |
 // +--------+---------+
 
-int32_t real_request(const uint8_t* data, uint32_t len, uint8_t* wdata, uint32_t* rescode, uint32_t* wlen) {
+// Where a command writes its response: data at woff in out, which grows to fit it
+struct Reply {
+	Buffer& out;
+	size_t woff;
+	uint32_t* rescode;
+	uint32_t* wlen;
+};
+
+static int32_t reply(Reply& r, uint32_t code, const void* data = NULL, size_t len = 0) {
+	*r.rescode = code;
+	*r.wlen = (uint32_t)len;
+	if (!len) { return 0; }
+	if (!r.out.reserve(r.woff + len, r.woff)) { return -1; }
+	memcpy(r.out.data() + r.woff, data, len);
+	return 0;
+}
+
+static int32_t reply_error(Reply& r, const char* msg) {
+	return reply(r, RES_ERR, msg, strlen(msg));
+}
+
+static int32_t reply_int(Reply& r, long long n) {
+	char text[24];
+	int len = snprintf(text, sizeof(text), "%lld", n);
+	return reply(r, RES_OK, text, (size_t)len);
+}
+
+static const char* const K_WRONGTYPE = "WRONGTYPE Operation against a key holding the wrong kind of value";
+
+enum {
+	CMD_READ = 1 << 0,																							// 	Reads the keyspace
+	CMD_WRITE = 1 << 1,																							// 	Changes the keyspace
+	CMD_ADMIN = 1 << 2																							// 	Still answered while commands are shed (overloaded)
+};
+
+// args[0] is the command name, args point into the connection's read buffer and only live during the call
+typedef int32_t (*CommandFn)(const std::string_view* args, size_t nargs, Reply& r);
+
+struct Command {
+	const char* name;
+	int arity;																									// 	Arguments with the name, -N: at least N
+	uint32_t flags;
+	CommandFn fn;
+	uint64_t calls;
+	uint64_t ns;																								// 	Cumulative time in fn
+};
+
+static std::string command_stats();
+
+static bool arg_is(std::string_view arg, const char* word) {
+	return arg.size() == strlen(word) && strncasecmp(arg.data(), word, arg.size()) == 0;
+}
+
+static bool parse_int(std::string_view arg, int64_t* out) {
+	const char* end = arg.data() + arg.size();
+	std::from_chars_result res = std::from_chars(arg.data(), end, *out);
+	return res.ec == std::errc() && res.ptr == end;
+}
+
+// A TTL argument in ms: seconds * scale, false if it does not fit
+static bool parse_ttl(std::string_view arg, int64_t scale, int64_t* ms) {
+	const int64_t K_MAX_TTL_MS = (int64_t)1 << 50;															// 	About 35000 years, far from overflowing now + ttl
+	if (!parse_int(arg, ms) || *ms > K_MAX_TTL_MS / scale || *ms < -K_MAX_TTL_MS / scale) { return false; }
+	*ms *= scale;
+	return true;
+}
+
+/* 	Keys with a TTL:
+		set key value [px ms | ex seconds]		a plain set clears the key's TTL
+		pexpire key ms, expire key seconds		RES_NX without the key, a TTL <= 0 deletes it
+		ttl key									RES_NX without the key, else the seconds left (rounded), -1 for no TTL
+		persist key								RES_NX without the key, else "1" if it had a TTL, "0" if not
+	Numbers in responses are decimal text. */
+static int32_t cmd_get(const std::string_view* args, size_t, Reply& r) {
+	Entry* e = lookup_key(args[1]);																			// 	Pointer into the table, only valid until the next g_map call
+	if (!e) { return reply(r, RES_NX); }
+	if (e->zset) { return reply_error(r, K_WRONGTYPE); }
+	return reply(r, RES_OK, e->value.data(), e->value.size());
+}
+
+static int32_t cmd_set(const std::string_view* args, size_t nargs, Reply& r) {
+	int64_t ttl = 0;
+	if (nargs == 5) {
+		int64_t scale = arg_is(args[3], "px") ? 1 : arg_is(args[3], "ex") ? 1000 : 0;
+		if (!scale) { return reply_error(r, "syntax error"); }
+		if (!parse_ttl(args[4], scale, &ttl) || ttl <= 0) { return reply_error(r, "invalid expire time"); }
+	} else if (nargs != 3) {
+		return reply_error(r, "wrong number of arguments");
+	}
+	Entry* e = g_map.insert(args[1]);
+	delete e->zset;																								// 	Whatever the key held, it is a string now
+	e->zset = NULL;
+	e->value.assign(args[2].data(), args[2].size());														// 	An overwrite reuses the old value's memory when it fits
+	if (ttl) {
+		expire_entry(args[1], e, now_ms() + ttl);
+	} else {
+		persist_entry(e);
+	}
+	return reply(r, RES_OK);
+}
+
+static int32_t cmd_del(const std::string_view* args, size_t, Reply& r) {
+	delete_key(args[1]);
+	return reply(r, RES_OK);
+}
+
+static int32_t expire_generic(const std::string_view* args, int64_t scale, Reply& r) {
+	int64_t ttl = 0;
+	if (!parse_ttl(args[2], scale, &ttl)) { return reply_error(r, "invalid expire time"); }
+	Entry* e = lookup_key(args[1]);
+	if (!e) { return reply(r, RES_NX); }
+	if (ttl <= 0) {
+		delete_key(args[1]);
+	} else {
+		expire_entry(args[1], e, now_ms() + ttl);
+	}
+	return reply(r, RES_OK);
+}
+
+static int32_t cmd_expire(const std::string_view* args, size_t, Reply& r) {
+	return expire_generic(args, 1000, r);
+}
+
+static int32_t cmd_pexpire(const std::string_view* args, size_t, Reply& r) {
+	return expire_generic(args, 1, r);
+}
+
+static int32_t cmd_ttl(const std::string_view* args, size_t, Reply& r) {
+	Entry* e = lookup_key(args[1]);
+	if (!e) { return reply(r, RES_NX); }
+	return reply_int(r, e->expiry ? (long long)((e->expiry->at - now_ms() + 500) / 1000) : -1LL);
+}
+
+static int32_t cmd_persist(const std::string_view* args, size_t, Reply& r) {
+	Entry* e = lookup_key(args[1]);
+	if (!e) { return reply(r, RES_NX); }
+	bool had = e->expiry != NULL;
+	persist_entry(e);
+	return reply(r, RES_OK, had ? "1" : "0", 1);
+}
+
+/* 	Sorted sets (zset.hpp), ranks start at 0 with the lowest score:
+		zadd key score member [score member ...]		the number of new members, existing ones get the new score
+		zrem key member [member ...]					the number removed, the key goes with its last member
+		zscore key member, zrank key member				RES_NX without the key or the member
+		zrange key start stop [withscores]				by rank, inclusive, negative counts from the end
+		zrangebyscore key min max [withscores] [limit offset count]
+														"(" before a bound excludes it, -inf and +inf work
+	A list of members (and scores after each with withscores) is framed like a request:
+	[n][len][str][len][str]... A string key gets "WRONGTYPE" from them, and a sorted set from
+	get. */
+static bool parse_score(std::string_view arg, double* score) {
+	if (!arg.empty() && arg[0] == '+') { arg.remove_prefix(1); }											// 	from_chars takes "-inf" but not "+inf"
+	const char* end = arg.data() + arg.size();
+	std::from_chars_result res = std::from_chars(arg.data(), end, *score);
+	return res.ec == std::errc() && res.ptr == end && *score == *score;										// 	NaN is no score
+}
+
+static bool parse_bound(std::string_view arg, double* score, bool* exclusive) {
+	*exclusive = !arg.empty() && arg[0] == '(';
+	if (*exclusive) { arg.remove_prefix(1); }
+	return parse_score(arg, score);
+}
+
+static size_t format_score(double score, char* text, size_t size) {
+	return (size_t)(std::to_chars(text, text + size, score).ptr - text);									// 	Shortest text that reads back as the same double
+}
+
+// Response data built as a list of strings, see above
+struct ListReply {
+	Reply& r;
+	size_t len = 4;																								// 	The count comes first
+	uint32_t count = 0;
+
+	bool add(const char* data, size_t size) {
+		if (!r.out.reserve(r.woff + len + 4 + size, r.woff + len)) { return false; }
+		uint32_t size32 = (uint32_t)size;
+		memcpy(r.out.data() + r.woff + len, &size32, 4);
+		memcpy(r.out.data() + r.woff + len + 4, data, size);
+		len += 4 + size;
+		count++;
+		return true;
+	}
+
+	bool addNode(const ZNode* node, bool withScores) {
+		if (!add(node->member.data(), node->member.size())) { return false; }
+		if (!withScores) { return true; }
+		char text[32];
+		return add(text, format_score(node->score, text, sizeof(text)));
+	}
+
+	int32_t finish() {
+		if (!r.out.reserve(r.woff + len, r.woff + len)) { return -1; }
+		memcpy(r.out.data() + r.woff, &count, 4);
+		*r.rescode = RES_OK;
+		*r.wlen = (uint32_t)len;
+		return 0;
+	}
+};
+
+static int32_t cmd_zadd(const std::string_view* args, size_t nargs, Reply& r) {
+	if (nargs % 2) { return reply_error(r, "wrong number of arguments"); }
+	for (size_t i = 2; i < nargs; i += 2) {
+		double score;
+		if (!parse_score(args[i], &score)) { return reply_error(r, "value is not a valid float"); }		// 	All checked before anything changes
+	}
+	Entry* e = lookup_key(args[1]);
+	if (e && !e->zset) { return reply_error(r, K_WRONGTYPE); }
+	if (!e) {
+		e = g_map.insert(args[1]);
+		e->zset = new ZSet();
+	}
+	long long added = 0;
+	for (size_t i = 2; i < nargs; i += 2) {
+		double score = 0;
+		parse_score(args[i], &score);
+		added += e->zset->add(args[i + 1], score);
+	}
+	return reply_int(r, added);
+}
+
+static int32_t cmd_zrem(const std::string_view* args, size_t nargs, Reply& r) {
+	Entry* e = lookup_key(args[1]);
+	if (!e) { return reply(r, RES_NX); }
+	if (!e->zset) { return reply_error(r, K_WRONGTYPE); }
+	long long removed = 0;
+	for (size_t i = 2; i < nargs; i++) { removed += e->zset->remove(args[i]); }
+	if (!e->zset->size()) { erase_entry(args[1], e); }
+	return reply_int(r, removed);
+}
+
+static int32_t cmd_zscore(const std::string_view* args, size_t, Reply& r) {
+	Entry* e = lookup_key(args[1]);
+	if (!e) { return reply(r, RES_NX); }
+	if (!e->zset) { return reply_error(r, K_WRONGTYPE); }
+	double score;
+	if (!e->zset->score(args[2], &score)) { return reply(r, RES_NX); }
+	char text[32];
+	return reply(r, RES_OK, text, format_score(score, text, sizeof(text)));
+}
+
+static int32_t cmd_zrank(const std::string_view* args, size_t, Reply& r) {
+	Entry* e = lookup_key(args[1]);
+	if (!e) { return reply(r, RES_NX); }
+	if (!e->zset) { return reply_error(r, K_WRONGTYPE); }
+	size_t rank;
+	if (!e->zset->rank(args[2], &rank)) { return reply(r, RES_NX); }
+	return reply_int(r, (long long)rank);
+}
+
+static int32_t cmd_zrange(const std::string_view* args, size_t nargs, Reply& r) {
+	int64_t start, stop;
+	if (!parse_int(args[2], &start) || !parse_int(args[3], &stop)) { return reply_error(r, "value is not an integer"); }
+	bool withScores = nargs == 5 && arg_is(args[4], "withscores");
+	if (nargs > 5 || (nargs == 5 && !withScores)) { return reply_error(r, "syntax error"); }
+	Entry* e = lookup_key(args[1]);
+	if (e && !e->zset) { return reply_error(r, K_WRONGTYPE); }
+	ListReply list = {r};
+	int64_t size = e ? (int64_t)e->zset->size() : 0;
+	if (start < 0) { start += size; }
+	if (stop < 0) { stop += size; }
+	if (start < 0) { start = 0; }
+	if (stop >= size) { stop = size - 1; }
+	if (start > stop) { return list.finish(); }
+	ZSet::Iter it = e->zset->seekRank((size_t)start);
+	for (int64_t n = stop - start + 1; n > 0 && it.node(); n--, it.next()) {
+		if (!list.addNode(it.node(), withScores)) { return -1; }
+	}
+	return list.finish();
+}
+
+static int32_t cmd_zrangebyscore(const std::string_view* args, size_t nargs, Reply& r) {
+	double min, max;
+	bool minExclusive, maxExclusive;
+	if (!parse_bound(args[2], &min, &minExclusive) || !parse_bound(args[3], &max, &maxExclusive)) { return reply_error(r, "min or max is not a float"); }
+	bool withScores = false;
+	int64_t offset = 0;
+	int64_t count = -1;																							// 	Negative: all
+	for (size_t i = 4; i < nargs; i++) {
+		if (arg_is(args[i], "withscores")) {
+			withScores = true;
+		} else if (arg_is(args[i], "limit") && i + 2 < nargs) {
+			if (!parse_int(args[i + 1], &offset) || !parse_int(args[i + 2], &count)) { return reply_error(r, "value is not an integer"); }
+			i += 2;
+		} else {
+			return reply_error(r, "syntax error");
+		}
+	}
+	Entry* e = lookup_key(args[1]);
+	if (e && !e->zset) { return reply_error(r, K_WRONGTYPE); }
+	ListReply list = {r};
+	if (!e || offset < 0) { return list.finish(); }
+	size_t rank;
+	ZSet::Iter it = e->zset->seekScore(min, minExclusive, &rank);
+	if (offset) { it = e->zset->seekRank(rank + (size_t)offset); }										// 	Skipped by counts, not by walking
+	for (; count != 0 && it.node(); count--, it.next()) {
+		double score = it.node()->score;
+		if (maxExclusive ? score >= max : score > max) { break; }
+		if (!list.addNode(it.node(), withScores)) { return -1; }
+	}
+	return list.finish();
+}
+
+static int32_t cmd_stats(const std::string_view*, size_t, Reply& r) {
+	std::string stats = Metrics::scrape().render("kv") + command_stats();								// 	Same counters and quantiles as the HTTP /metrics endpoint, then the commands
+	return reply(r, RES_OK, stats.data(), stats.size());
+}
+
+static Command g_commands[] = {
+	{"get", 2, CMD_READ, cmd_get, 0, 0},
+	{"set", -3, CMD_WRITE, cmd_set, 0, 0},
+	{"del", 2, CMD_WRITE, cmd_del, 0, 0},
+	{"expire", 3, CMD_WRITE, cmd_expire, 0, 0},
+	{"pexpire", 3, CMD_WRITE, cmd_pexpire, 0, 0},
+	{"ttl", 2, CMD_READ, cmd_ttl, 0, 0},
+	{"persist", 2, CMD_WRITE, cmd_persist, 0, 0},
+	{"zadd", -4, CMD_WRITE, cmd_zadd, 0, 0},
+	{"zrem", -3, CMD_WRITE, cmd_zrem, 0, 0},
+	{"zscore", 3, CMD_READ, cmd_zscore, 0, 0},
+	{"zrank", 3, CMD_READ, cmd_zrank, 0, 0},
+	{"zrange", -4, CMD_READ, cmd_zrange, 0, 0},
+	{"zrangebyscore", -4, CMD_READ, cmd_zrangebyscore, 0, 0},
+	{"stats", 1, CMD_ADMIN, cmd_stats, 0, 0},
+};
+
+/* 	Command lookup is a perfect hash: init_commands() picks a seed under which every name of
+	g_commands lands in its own slot of g_command_slots, so finding a command is one hash of
+	the name, one load and one compare, whatever the number of commands. */
+const size_t K_COMMAND_SLOTS = 64;																				// 	A power of two, a few times the number of commands
+static Command* g_command_slots[K_COMMAND_SLOTS];
+static uint64_t g_command_seed = 0;
+
+static void init_commands() {
+	const size_t count = sizeof(g_commands) / sizeof(g_commands[0]);
+	static_assert(sizeof(g_commands) / sizeof(g_commands[0]) <= K_COMMAND_SLOTS, "more commands than slots");
+	for (uint64_t seed = 0; seed < 100000; seed++) {
+		memset(g_command_slots, 0, sizeof(g_command_slots));
+		size_t i = 0;
+		for (; i < count; i++) {
+			Command& cmd = g_commands[i];
+			Command*& slot = g_command_slots[hash_bytes(cmd.name, strlen(cmd.name), seed) & (K_COMMAND_SLOTS - 1)];
+			if (slot) { break; }
+			slot = &cmd;
+		}
+		if (i == count) {
+			g_command_seed = seed;
+			return;
+		}
+	}
+	die("no perfect hash for the command table");
+}
+
+static Command* find_command(std::string_view name) {
+	Command* cmd = g_command_slots[hash_bytes(name.data(), name.size(), g_command_seed) & (K_COMMAND_SLOTS - 1)];
+	if (!cmd || strlen(cmd->name) != name.size() || memcmp(cmd->name, name.data(), name.size()) != 0) { return NULL; }
+	return cmd;
+}
+
+// Calls and time of every command and the size of the keyspace, in the format of Metrics::render
+static std::string command_stats() {
+	std::string out = "# TYPE kv_command_calls_total counter\n";
+	char line[256];
+	for (const Command& cmd : g_commands) {
+		snprintf(line, sizeof(line), "kv_command_calls_total{cmd=\"%s\"} %llu\n", cmd.name, (unsigned long long)cmd.calls);
+		out += line;
+	}
+	out += "# TYPE kv_command_seconds_total counter\n";
+	for (const Command& cmd : g_commands) {
+		snprintf(line, sizeof(line), "kv_command_seconds_total{cmd=\"%s\"} %.9g\n", cmd.name, (double)cmd.ns * 1e-9);
+		out += line;
+	}
+	snprintf(line, sizeof(line), "# TYPE kv_keys gauge\nkv_keys %zu\n# TYPE kv_expiring_keys gauge\nkv_expiring_keys %zu\n"
+		"# TYPE kv_expired_keys_total counter\nkv_expired_keys_total %llu\n", g_map.size(), g_expires.size(), (unsigned long long)g_expired_keys);
+	out += line;
+	return out;
+}
+
+static std::string_view g_args[K_MAX_STRINGS];																	// 	Arguments of the command being decoded, views into its connection's read buffer
+
+static int32_t busy_response(Reply& r) {
+	return reply_error(r, "server busy");
+}
+
+// Decodes the message in place (no copy, no allocation) and runs its command; shed: only CMD_ADMIN commands run
+int32_t real_request(const uint8_t* data, uint32_t len, Buffer& out, size_t woff, uint32_t* rescode, uint32_t* wlen, bool shed) {
 	// first 4 bytes are the number of strings in the request, each string is prefixed with a 4 byte length
+	uint64_t start = metrics_now_ns();
+	Metrics& metrics = Metrics::local();
 	uint32_t n = 0;
+	if (len < 4) { LOG_WARN("bad request"); metrics.add(M_ERRORS); return -1; }
 	memcpy(&n, data, 4);
-	if (n > K_MAX_STRINGS) { printf("too many strings\n"); return -1; } 
-	std::vector<std::string> reqs;
+	if (n > K_MAX_STRINGS) { LOG_WARN("too many strings"); metrics.add(M_ERRORS); return -1; } 
 	uint32_t offset = 4;
-	while (n--) { 																								// 	Iterate over the strings in the request
+	for (uint32_t i = 0; i < n; i++) { 																			// 	Iterate over the strings in the request
 		uint32_t slen = 0;
+		if (len - offset < 4) { LOG_WARN("bad request"); metrics.add(M_ERRORS); return -1; }
 		memcpy(&slen, data + offset, 4);																		// 	Copy 4 bytes from the data buffer to slen (length of the string)
-		if (offset + 4 + slen > len) { printf("bad request\n"); return -1; } 									// 	Check if the length of the string is valid
 		offset += 4;
-		reqs.emplace_back((const char*)data + offset, slen);													// 	What emplace_back does is to construct the object in place, 
-																												// 	so it doesn't have to be copied or moved, it is constructed in the vector
+		if (slen > len - offset) { LOG_WARN("bad request"); metrics.add(M_ERRORS); return -1; } 				// 	Check if the length of the string is valid
+		g_args[i] = std::string_view((const char*)data + offset, slen);
 		offset += slen;
 	}
-	printf("Request: ");
-	for (const std::string& s : reqs) {
-		printf("%s ", s.c_str());
+	uint64_t decoded = metrics_now_ns();
+	metrics.record(H_PARSE_NS, decoded - start);
+	Reply r = {out, woff, rescode, wlen};
+	Command* cmd = n ? find_command(g_args[0]) : NULL;
+	LOG_TRACE("Request: %.*s, %u args", n ? (int)g_args[0].size() : 0, n ? g_args[0].data() : "", n);		// 	Only the command, values may be megabytes
+	if (!cmd) { return reply_error(r, "cmd not found"); }
+	if (cmd->arity >= 0 ? n != (uint32_t)cmd->arity : n < (uint32_t)-cmd->arity) { return reply_error(r, "wrong number of arguments"); }
+	if (shed && !(cmd->flags & CMD_ADMIN)) {
+		metrics.add(M_REJECTS);
+		return busy_response(r);																				// 	Shed the command without running it, the client may retry
 	}
-	// process the request
-	if (reqs.size() == 2 && reqs[0] == "get") {
-		auto it = g_map.find(reqs[1]); 																			//	it is an iterator to the element in the map, it->first is the key, it->second is the value
-		if (it == g_map.end()) {
-			*rescode = RES_NX;
-			return 0;
-		}
-		// copy the value to the wdata buffer
-		std::string& val = it->second; 																			// 	Reference to the value in the map
-		*wlen = val.size();
-		memcpy(wdata, val.data(), val.size());
-		*rescode = RES_OK;
-		return 0;
-	} else if (reqs.size() == 3 && reqs[0] == "set") {
-		(void)wlen;																								// (void) is used to cast a variable to void, so the compiler doesn't complain about unused variables
-		g_map[reqs[1]] = reqs[2];
-		*rescode = RES_OK;
-		return 0;
-	} else if (reqs.size() == 2 && reqs[0] == "del") {
-		(void)wlen;
-		g_map.erase(reqs[1]);
-		*rescode = RES_OK;
-		return 0;
-	} else {
-		std::string msg = "cmd not found";
-		*wlen = msg.size();
-		memcpy(wdata, msg.data(), msg.size());
-		*rescode = RES_ERR;
-		return 0;
-	}
-	return 0;
+	int32_t err = cmd->fn(g_args, n, r);
+	cmd->calls++;
+	cmd->ns += metrics_now_ns() - decoded;
+	return err;
 }
 
 bool handle_write(Conn* conn) {
-	assert(conn->write_size > 0);																				// 	Assert is used to check if a condition is true, if it is not, the program will terminate
+	assert(conn->write_size > conn->write_pos);																// 	Assert is used to check if a condition is true, if it is not, the program will terminate
 	int32_t len;
-	memcpy(&len, &conn->write_buf[0], 4);																		// 	Copy 4 bytes from the write buffer to len
-	uint8_t* data = &conn->write_buf[4];																		// 	Data points to the start of the message (without the length)
-	printf("Len: %i Sending data: %.*s\n",len, (int)len < 10 ? (int)len : 10, (const char*)data);
+	memcpy(&len, conn->write_buf.data() + conn->write_pos, 4);													// 	Copy 4 bytes from the write buffer to len
+	uint8_t* data = conn->write_buf.data() + conn->write_pos + 4;													// 	Data points to the start of the message (without the length)
+	LOG_TRACE("Len: %i Sending data: %.*s", len, (int)len < 10 ? (int)len : 10, (const char*)data);
 	
-	ssize_t rv = write(conn->fd, &conn->write_buf[0], conn->write_size);
-	if (rv < 0 && errno == EAGAIN) {																			// 	EAGAIN means that the write would block, so we should try again later
-		printf("returning EAGAIN");																				// 	This is necessary because pipelined requests can cause the write buffer to fill up (and EAGAIN to be returned)
+	ssize_t rv = write(conn->fd, conn->write_buf.data() + conn->write_pos, conn->write_size - conn->write_pos);
+	Metrics& metrics = Metrics::local();
+	metrics.add(M_WRITES);
+	if (rv < 0 && errno == EAGAIN) {
+		metrics.add(M_WRITE_STALLS);																			// 	EAGAIN means that the write would block, so we should try again later
+		LOG_TRACE("Write would block on %i", conn->fd);																				// 	This is necessary because pipelined requests can cause the write buffer to fill up (and EAGAIN to be returned)
 		return false;
 	}
-	if (rv < 0) { conn->state = STATE_CLOSE; printf("rv < 0 Closing"); return false; }
-	printf("Wrote %i bytes, remaining (write buff): %i\n", (int)rv, (int)(conn->write_size - rv));
-	size_t remain = conn->write_size - rv;
-	if (remain > 0)	{
-	memmove(&conn->write_buf[0], &conn->write_buf[rv], remain);													// 	Move remaining data from write buffer [rv] position to the start of the buffer [0]
-	}
-	conn->write_size = remain;
-	if (conn->write_size == 0) {
+	if (rv < 0) { conn->state = STATE_CLOSE; LOG_DEBUG("Write error on %i: %s", conn->fd, strerror(errno)); return false; }
+	metrics.add(M_BYTES_OUT, (uint64_t)rv);
+	conn->write_pos += rv;																						// 	A partial write only advances the offset, the unsent bytes are not moved
+	LOG_TRACE("Wrote %zd bytes, remaining (write buff): %zu", rv, conn->write_size - conn->write_pos);
+	if (conn->write_pos == conn->write_size) {
+		conn->write_pos = 0;																					// 	Everything sent, rewind to the start of the buffer for free
+		conn->write_size = 0;
+		conn->write_buf.release();																				// 	Back to the pool until the next response
 		conn->state = STATE_READ;
-		printf("Switching to read ALL in writte buffer writted\n");
 		return false;
 	}
 	return true;
 }
 
-bool parse_request (Conn* conn){
-	if (conn->read_size < 4) { return false; }
+// Runs the message at *pos in read_buf and appends its response to write_buf, false when no complete message is there
+bool parse_request (Conn* conn, size_t* pos){
+	size_t avail = conn->read_size - *pos;
+	if (avail < 4) { return false; }
 	uint32_t len = 0;
-   	printf("Parsing request\n");	
-	memcpy(&len, &conn->read_buf[0], 4);																		// 	Copy 4 bytes from the read buffer to len
-	if (len > MAX_BUF_SIZE) { printf("msg too long\n"); conn->state = STATE_CLOSE; return false; }
+	memcpy(&len, conn->read_buf.data() + *pos, 4);																// 	Copy 4 bytes from the read buffer to len
+	if (len > MAX_BUF_SIZE) { LOG_WARN("msg too long on %i", conn->fd); conn->state = STATE_CLOSE; return false; }
 																												// 	Could also use uint32_t len = *(uint32_t*)conn->read_buf.data(); (uint32_t size is 4 bytes)
-	if (conn->read_size < 4 + len) { return false; }															// 	If the buffer is smaller than 4 + len, we don't have a complete message
-	const uint8_t* data = &conn->read_buf[4];																	// 	Data points to the start of the message (without the length)
+	if (avail < 4 + (size_t)len) { return false; }															// 	If the buffer is smaller than 4 + len, we don't have a complete message
+	const uint8_t* data = conn->read_buf.data() + *pos + 4;														// 	Data points to the start of the message (without the length)
 
-	printf("Received of length: %i\n", (int)len);																// 	Print the length of the message and print part of the message;
-	printf("Message: %.*s\n", (int)len < 10 ? (int)len : 10, (const char*)data);								// 	%.*s is a format specifier that takes two arguments, the first is the length of the string and the second is the string
-																												// 	if the length is less than 10, print the whole string, otherwise print the first 10 characters
+	LOG_TRACE("Received of length: %u, message: %.*s", len, (int)len < 10 ? (int)len : 10, (const char*)data);	// 	%.*s takes the length and the string: at most the first 10 characters
 	
 	uint32_t rescode = 0;
 	uint32_t wlen = 0;
-	uint8_t *wdata = conn->write_buf + 4 + 4;																	// 	Pointer to the start of the write buffer (without the length and the result code)
-	int32_t err = real_request(data, len, wdata, &rescode, &wlen);
+	size_t woff = conn->write_size + 4 + 4;																		// 	Offset of the data in the write buffer (after the unsent responses, the length and the result code)
+	if (!conn->write_buf.reserve(conn->write_size + 8, conn->write_size)) { conn->state = STATE_CLOSE; return false; }
+	uint64_t start = metrics_now_ns();
+	Metrics& metrics = Metrics::local();
+	bool shed = g_max_buffered && g_buffered_bytes >= g_max_buffered;
+	int32_t err = real_request(data, len, conn->write_buf, woff, &rescode, &wlen, shed);
+	metrics.add(M_REQUESTS);
+	metrics.record(H_HANDLER_NS, metrics_now_ns() - start);														// 	Whole command, argument decoding (H_PARSE_NS) included
 	if (err) { conn->state = STATE_CLOSE; return false; }
 
 	wlen += 4;																									// 	Increase the length of the message by 4 bytes (rescode)
-	memcpy(&conn->write_buf[conn->write_size], &wlen, 4);														// 	Copy the length of the message to the start of the write buffer
-	memcpy(&conn->write_buf[conn->write_size + 4], &rescode, 4);												// 	Copy the result code to the write buffer
-	conn->write_size = wlen + 8;																				// 	Set the write size to the length of the message + 8 bytes (4 bytes for the length and 4 bytes for the result code)
+	memcpy(conn->write_buf.data() + conn->write_size, &wlen, 4);														// 	Copy the length of the message to the start of the write buffer
+	memcpy(conn->write_buf.data() + conn->write_size + 4, &rescode, 4);												// 	Copy the result code to the write buffer
+	conn->write_size += wlen + 4;																				// 	Append the length prefix (4 bytes) + wlen (result code and data) to what is still unsent
+	*pos += 4 + len;																							// 	Consumed, the bytes stay until the batch is done
+	return true;
+}
+
+// Poll mode: send everything queued, false when the socket is full (STATE_WRITE until POLLOUT drains it)
+static bool flush_writes(Conn* conn) {
+	if (conn->write_size == conn->write_pos) { return true; }
+	conn->state = STATE_WRITE;
+	while (handle_write(conn)) { }																				// 	Write until we send all the data (or we get EAGAIN (kernel buffer full))
+	return conn->state == STATE_READ;
+}
 
-	printf("Message parsed, read size changed from %i to %i\n", (int)conn->read_size, (int)(conn->read_size - (4 + len)));
-	// Remove the message from the read buffer 
-	size_t remain = conn->read_size - (4 + len);
-	if (remain > 0)	{
-		memmove(&conn->read_buf[0], &conn->read_buf[4 + len], remain);
+/* 	Runs every complete message buffered, a pipelining client gets all the answers of what it
+	sent together: the responses are appended to write_buf and leave with one write (one SENDMSG
+	with io_uring) for the batch instead of one per command. The consumed bytes are moved out of
+	read_buf once at the end. Past K_WRITE_HIGH_WATER unsent bytes decoding pauses: poll mode
+	flushes and goes on if the socket took it all, otherwise (and always with io_uring, whose
+	send must complete first) the rest waits in read_buf until the responses are out. */
+static void process_requests(Conn* conn) {
+	size_t pos = 0;
+	while (conn->state != STATE_CLOSE && parse_request(conn, &pos)) {
+		if (conn->write_size - conn->write_pos < K_WRITE_HIGH_WATER) { continue; }
+		if (g_ring || !flush_writes(conn)) { break; }
 	}
+	size_t remain = conn->read_size - pos;
+	if (pos && remain) { memmove(conn->read_buf.data(), conn->read_buf.data() + pos, remain); }
 	conn->read_size = remain;
-	conn->state = STATE_WRITE;			
-	while (handle_write(conn)) { 
-	}																											// 	Write until we send all the data (or we get EAGAIN (kernel buffer full))
-	printf ("handle_write returned false\n");
-	return true;																								// 	Return true if a message was parsed (to continue parsing even if we didnt wrote the message)
+	if (conn->read_size == 0) { conn->read_buf.release(); }													// 	Nothing pending, the connection keeps no read memory while idle
+}
+
+// Poll mode: what is buffered runs, then one write for all of it
+static void handle_pending(Conn* conn) {
+	process_requests(conn);
+	if (conn->state != STATE_CLOSE) { flush_writes(conn); }
+}
+
+// Room for at least len more bytes in read_buf, false (STATE_CLOSE) past 4+MAX_BUF_SIZE
+static bool reserve_read(Conn* conn, size_t len) {
+	if (conn->read_buf.capacity() - conn->read_size < len) {												// 	Full (or released while idle): next size class, the pending bytes are kept
+		size_t need = conn->read_size ? 2 * conn->read_size : K_READ_BUF_INITIAL;
+		if (need < conn->read_size + len) { need = conn->read_size + len; }
+		if (need > 4 + MAX_BUF_SIZE && conn->read_size + len <= 4 + MAX_BUF_SIZE) { need = 4 + MAX_BUF_SIZE; }
+		if (need > 4 + MAX_BUF_SIZE || !conn->read_buf.reserve(need, conn->read_size)) {
+			LOG_WARN("Read buffer overflow on %i, closing connection", conn->fd);
+			conn->state = STATE_CLOSE;
+			return false;
+		}
+	}
+	return true;
 }
 
 bool handle_read(Conn* conn) {
-	printf("Readin from %i\n", conn->fd);
-	uint8_t* buf = new uint8_t[MAX_BUF_SIZE];																	// 	Not optimal, we used new to allocate memory for the buffer because it is too big to be allocated on the stack 
-																												// 	(max stack size is 8MB on linux) and heap size is much bigger
-	ssize_t rv = read(conn->fd, buf, (conn->read_size - sizeof(buf)));											// 	Read from the connection and store the data in buf
+	if (!reserve_read(conn, 1)) { return false; }
+	ssize_t rv = read(conn->fd, conn->read_buf.data() + conn->read_size, conn->read_buf.capacity() - conn->read_size);	// 	Read straight into the connection buffer, no temporary copy
 
 	if (rv < 0 && errno == EAGAIN) {
-		printf("returning EAGAIN (read)\n");
 		return false;
 	}																	
 	if (rv < 0) {
@@ -230,23 +848,196 @@ bool handle_read(Conn* conn) {
 		return false;
 	}
 	if (rv == 0) {
-		printf("EOF\n");
+		LOG_TRACE("EOF on %i", conn->fd);
 		conn->state = STATE_CLOSE;
 		return false;
 	}
-	printf("Read %i bytes\n", (int)rv);
-	mempcpy(&conn->read_buf[conn->read_size], buf, rv);															// 	Append the data to the read buffer
 	conn->read_size += rv;																						// 	Increase the size of the read buffer
-	printf("Read size: %i\n", (int)conn->read_size);
-	assert(conn->read_size <= sizeof(conn->read_buf));
-	while(parse_request(conn)){ }																				// 	See if we have a complete request (will stay in the loop until we don't have a complete request)
-	
-	delete[] buf;
+	Metrics::local().add(M_READS);
+	Metrics::local().add(M_BYTES_IN, (uint64_t)rv);
+	LOG_TRACE("Read %zd bytes on %i, %zu buffered", rv, conn->fd, conn->read_size);
+	assert(conn->read_size <= conn->read_buf.capacity());
+	handle_pending(conn);
 	return true;
 }
 
-int main () {
-	
+/* 	io_uring event loop, selected with "./server uring". The listener has one multishot accept,
+	each connection one multishot recv fed by the ring's provided buffers, and the responses of
+	everything a completion batch decoded leave with a single SENDMSG per connection: one
+	io_uring_enter() submits and reaps all of it. Messages are decoded by the same process_requests
+	as with poll. While a send is in flight the write buffer must not move, so new messages are
+	decoded once it completes (they pile up in read_buf meanwhile). */
+
+enum { OP_ACCEPT, OP_ACCEPT_POLL, OP_RECV, OP_SEND, OP_CANCEL };
+static bool g_accept_paused = false;																			// 	Out of fds, waiting for the listener to be readable
+const size_t K_RECV_HIGH_WATER = 1 << 20;																		// 	Undecoded bytes at which a connection stops receiving until its send completes
+const unsigned K_URING_BUFS = 256;
+const unsigned K_URING_BUF_SIZE = 16 << 10;
+
+static uint64_t uring_data(int op, int fd) {
+	return (uint64_t)op << 32 | (uint32_t)fd;
+}
+
+static void uring_arm_recv(Conn* conn) {
+	conn->recv_armed = true;
+	g_ring->prepRecvMultishot(conn->fd, uring_data(OP_RECV, conn->fd));
+}
+
+// Free the Conn once the kernel holds nothing of it, closing the fd earlier could hand its number to a new connection
+static void uring_finish_close(std::vector<Conn*>& conns, Conn* conn) {
+	if (conn->recv_armed || conn->sending) { return; }
+	free_conn(conns, conn);
+}
+
+static void uring_close(std::vector<Conn*>& conns, Conn* conn) {
+	if (conn->closing) { return; }
+	LOG_DEBUG("Closed on %i", conn->fd);
+	Metrics::local().add(M_CLOSES);
+	g_timers.cancel(&conn->timer);
+	conn->closing = true;
+	if (conn->recv_armed && !conn->recv_cancelled) {
+		g_ring->prepCancel(uring_data(OP_RECV, conn->fd), uring_data(OP_CANCEL, conn->fd));
+		conn->recv_cancelled = true;
+	}
+	if (conn->sending) { (void)shutdown(conn->fd, SHUT_RDWR); }												// 	A peer that stopped reading would keep the send pending forever
+	uring_finish_close(conns, conn);
+}
+
+// Decode what is buffered, queue one send for all the responses, re-arm or pause the recv
+static void uring_drive(std::vector<Conn*>& conns, Conn* conn, int64_t now) {
+	if (!conn->sending) {
+		process_requests(conn);
+	}
+	if (conn->state == STATE_CLOSE) {
+		uring_close(conns, conn);
+		return;
+	}
+	if (!conn->sending && conn->write_size > conn->write_pos) {
+		conn->send_iov.iov_base = conn->write_buf.data() + conn->write_pos;
+		conn->send_iov.iov_len = conn->write_size - conn->write_pos;
+		memset(&conn->send_hdr, 0, sizeof(conn->send_hdr));
+		conn->send_hdr.msg_iov = &conn->send_iov;
+		conn->send_hdr.msg_iovlen = 1;
+		g_ring->prepSendmsg(conn->fd, &conn->send_hdr, false, uring_data(OP_SEND, conn->fd));
+		conn->sending = true;
+		Metrics::local().add(M_WRITES);
+	}
+	if (!conn->recv_armed && conn->read_size < K_RECV_HIGH_WATER) {
+		uring_arm_recv(conn);
+	} else if (conn->recv_armed && !conn->recv_cancelled && conn->sending && conn->read_size >= K_RECV_HIGH_WATER) {
+		g_ring->prepCancel(uring_data(OP_RECV, conn->fd), uring_data(OP_CANCEL, conn->fd));					// 	The client pipelines faster than it reads the answers
+		conn->recv_cancelled = true;
+	}
+	arm_timer(conn, now);
+	charge(conn);
+}
+
+static void uring_completion(std::vector<Conn*>& conns, int listen_fd, const struct io_uring_cqe& cqe, int64_t now) {
+	int op = (int)(cqe.user_data >> 32);
+	int fd = (int)(uint32_t)cqe.user_data;
+	if (op == OP_ACCEPT) {
+		if (cqe.res >= 0 && overloaded()) {
+			reject(cqe.res);
+		} else if (cqe.res >= 0) {
+			LOG_DEBUG("Accepted connection, fd: %i", cqe.res);
+			Conn* conn = new_conn(cqe.res);																	// 	Non-blocking already (accept flags)
+			add_conn(conns, conn, now);
+			uring_arm_recv(conn);
+		} else if (cqe.res == -EMFILE || cqe.res == -ENFILE) {
+			errno = -cqe.res;
+			if (!accept_overflow(listen_fd)) {																// 	The fd is allocated before looking at the queue, accepting again now would fail at once
+				if (cqe.flags & IORING_CQE_F_MORE) { g_ring->prepCancel(uring_data(OP_ACCEPT, listen_fd), uring_data(OP_CANCEL, listen_fd)); }
+				g_ring->prepPollAdd(listen_fd, POLLIN, uring_data(OP_ACCEPT_POLL, listen_fd));
+				g_accept_paused = true;
+			}
+		} else if (cqe.res != -ECANCELED) {
+			LOG_WARN("accept: %s", strerror(-cqe.res));
+		}
+		if (!(cqe.flags & IORING_CQE_F_MORE) && !g_accept_paused) { g_ring->prepAcceptMultishot(listen_fd, uring_data(OP_ACCEPT, listen_fd)); }
+		return;
+	}
+	if (op == OP_ACCEPT_POLL) {
+		g_accept_paused = false;
+		g_ring->prepAcceptMultishot(listen_fd, uring_data(OP_ACCEPT, listen_fd));
+		return;
+	}
+	if (op == OP_CANCEL) { return; }
+	Conn* conn = (size_t)fd < conns.size() ? conns[fd] : NULL;
+	if (op == OP_RECV) {
+		bool more = cqe.flags & IORING_CQE_F_MORE;
+		if (cqe.res > 0) {
+			uint16_t bid = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+			if (conn && !conn->closing && reserve_read(conn, (size_t)cqe.res)) {
+				memcpy(conn->read_buf.data() + conn->read_size, g_ring->buffer(bid), (size_t)cqe.res);	// 	The one copy, from the provided buffer to the message buffer
+				conn->read_size += (size_t)cqe.res;
+				Metrics::local().add(M_READS);
+				Metrics::local().add(M_BYTES_IN, (uint64_t)cqe.res);
+			}
+			g_ring->recycle(bid);
+		}
+		if (!conn) { return; }
+		if (!more) {
+			conn->recv_armed = false;
+			conn->recv_cancelled = false;
+		}
+		if (cqe.res == 0) {
+			LOG_TRACE("EOF on %i", conn->fd);
+			conn->state = STATE_CLOSE;
+		} else if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+			conn->state = STATE_CLOSE;
+		}
+	} else {
+		if (!conn) { return; }
+		conn->sending = false;
+		if (!conn->closing && cqe.res > 0) {
+			Metrics::local().add(M_BYTES_OUT, (uint64_t)cqe.res);
+			conn->write_pos += (size_t)cqe.res;
+			if (conn->write_pos == conn->write_size) {
+				conn->write_pos = 0;
+				conn->write_size = 0;
+				conn->write_buf.release();
+			}
+		} else if (cqe.res <= 0) {
+			LOG_DEBUG("Write error on %i: %s", conn->fd, strerror(-cqe.res));
+			conn->state = STATE_CLOSE;
+		}
+	}
+	if (conn->closing) {
+		uring_finish_close(conns, conn);
+		return;
+	}
+	uring_drive(conns, conn, now);
+}
+
+static void run_uring(int listen_fd) {
+	std::vector<Conn*> conns;
+	g_ring->prepAcceptMultishot(listen_fd, uring_data(OP_ACCEPT, listen_fd));
+	while (true) {
+		int wait = next_wait_ms(now_ms());
+		int rv = g_ring->submitAndWait(wait < 0 ? -1 : (int64_t)wait * 1000000);							// 	Submits the previous turn's work and sleeps until a completion or the nearest deadline
+		if (rv < 0 && rv != -ETIME && rv != -EINTR && rv != -EBUSY) {
+			errno = -rv;
+			die("io_uring_enter");
+		}
+		int64_t now = now_ms();
+		unsigned n = g_ring->drain([&](const struct io_uring_cqe& cqe) { uring_completion(conns, listen_fd, cqe, now); });
+		if (n > 0) { Metrics::local().record(H_READY_EVENTS, n); }
+		g_timers.advance(now, [&conns](TimerNode* timer) {
+			Conn* conn = (Conn*)timer->data;
+			LOG_DEBUG("Timeout on %i", conn->fd);
+			Metrics::local().add(M_TIMEOUTS);
+			uring_close(conns, conn);
+		});
+		background_work(n == 0);
+	}
+}
+
+// ./server [uring|poll] [max_conns] [max_buffered_mb] [backlog]
+int main (int argc, char** argv) {
+	g_max_conns = argc > 2 ? strtoul(argv[2], NULL, 10) : 0;
+	g_max_buffered = argc > 3 ? strtoul(argv[3], NULL, 10) << 20 : 0;
+	int backlog = argc > 4 ? atoi(argv[4]) : SOMAXCONN;															// 	The kernel caps it at net.core.somaxconn
+
 	int fd = socket(AF_INET, SOCK_STREAM, 0);
 	int val = 1;
 	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val)); 	
@@ -260,8 +1051,24 @@ int main () {
 	int rv = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
 	if (rv) { die("bind"); } 			
 	
-	rv = listen(fd, 10); 			
+	rv = listen(fd, backlog > 0 ? backlog : SOMAXCONN);
 	if (rv) { die("listen"); }
+	g_reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	init_commands();
+	signal(SIGPIPE, SIG_IGN);																					// 	A peer that reset gives EPIPE instead of killing the server
+	if (argc > 1 && strcmp(argv[1], "uring") == 0) {
+		static Uring ring;
+		if (!Uring::supported()) {
+			LOG_WARN("io_uring not supported by this kernel, using poll");
+		} else if (!ring.init() || !ring.setupBuffers(K_URING_BUFS, K_URING_BUF_SIZE)) {
+			LOG_WARN("io_uring setup failed (%s), using poll", strerror(errno));
+		} else {
+			g_ring = &ring;
+			LOG_INFO("Listening on port 1234 (io_uring)");
+			run_uring(fd);
+		}
+	}
+	LOG_INFO("Listening on port 1234");
 
 	std::vector<Conn*> conns;
 	std::vector<pollfd> poll_args;
@@ -278,18 +1085,17 @@ int main () {
 			if (conn->state == STATE_WRITE) { pfd.events |= POLLOUT; }
 			poll_args.push_back(pfd);
 		}
-		int rv = poll(poll_args.data(), (nfds_t)poll_args.size(), -1); 
-		if (rv < 0) { die("poll"); }
+		int rv = poll(poll_args.data(), (nfds_t)poll_args.size(), next_wait_ms(now_ms()));				// 	Blocks until an event, the nearest connection deadline or the next rehash slice
+		if (rv < 0) {
+			if (errno == EINTR) { continue; }																	// 	A signal, not an error: poll again
+			die("poll");
+		}
+		int64_t now = now_ms();
+		if (rv > 0) { Metrics::local().record(H_READY_EVENTS, (uint64_t)rv); }
 
 		// if the server socket has an event, handle it, .revents is a bitmask of events that have occurred
 		if (poll_args[0].revents) {
-			if (Conn* conn = handle_accept(fd)) {															// 	If the handle_accept function returns a pointer to a Conn object, add it to the conns vector
-				if (conns.size() <= (size_t)conn->fd) {														// 	If the total size of the vector is less than the file descriptor of the new connection, resize the vector
-					conns.resize(conn->fd + 1);																// 	to at least have the size of the file descriptor of the new connection example= conns[5] means we have 6 connections
-																											// 	if the fd of the new connection is 5, we need to resize the vector to have at least 6 elements
-				}
-				conns[conn->fd] = conn;																		// 	Add the new connection to conns vector at the index of the file descriptor
-			}
+			accept_all(fd, conns, now);																		// 	Accepts and registers the new connections in conns (indexed by fd)
 		}
 
 		// For each connection in conns, handle read and write events
@@ -299,21 +1105,26 @@ int main () {
 			if (ready & POLLIN) { 																			/* 	The & operator can be used to check if a bit is set in a bitmask
 																 												example: ready = 00000011, POLLIN = 00000001, ready & POLLIN = 00000001 != 0 
 																												so we enter the if */
-				printf("Reading on %i\n", conn->fd);
 				handle_read(conn);																			// 	handle_read will read data from the connection and store it in the read buffer
-				printf("Exit handle_read, state: %i\n", conn->state);
 			}
 			if (ready & POLLOUT) {
-				printf("Writting on %i\n", conn->fd);
 				handle_write(conn);
+				if (conn->state == STATE_READ && conn->read_size) { handle_pending(conn); }				// 	Messages held back at the high-water mark
 			}
 			if (ready & POLLERR || conn->state == STATE_CLOSE) { 
-				printf("Closed on %i\n", conn->fd);
-				(void)close(conn->fd);
-				conns[conn->fd] = NULL;
-				delete conn;
+				close_conn(conns, conn);
+			} else if (ready) {
+				arm_timer(conn, now);
+				charge(conn);
 			}
 		}
+		g_timers.advance(now, [&conns](TimerNode* timer) {												// 	Reap the connections whose deadline passed, no scan of conns
+			Conn* conn = (Conn*)timer->data;
+			LOG_DEBUG("Timeout on %i", conn->fd);
+			Metrics::local().add(M_TIMEOUTS);
+			close_conn(conns, conn);
+		});
+		background_work(rv == 0);
 	}
 }
 
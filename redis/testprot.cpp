@@ -70,9 +70,7 @@ static int32_t send_req(int fd, const std::vector<std::string> &cmd) {
         memcpy(&wbuf[cur + 4], s.data(), s.size());
         cur += 4 + s.size();
     }
-	// duplicate wbuf
-	memcpy(&wbuf[cur], &wbuf[0], len + 4);
-    return write_all(fd, wbuf, 2*(4 + len));
+    return write_all(fd, wbuf, 4 + len);
 }
 
 static int32_t read_res(int fd) {
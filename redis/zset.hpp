@@ -0,0 +1,255 @@
+#ifndef ZSET_HPP
+#define ZSET_HPP
+
+#include <cstddef>
+#include <new>
+#include <string>
+#include <string_view>
+
+#include "hashtable.hpp"
+
+/* 	Sorted set: members with a score, ordered by (score, member). Two structures share the
+	nodes: a HashTable from member to node answers "is it there, what is its score" in O(1),
+	and an AVL tree whose nodes also count their subtree answers every question about order in
+	O(log n): the rank of a member is the sum of the left counts on its path, the node at rank
+	r is found by going down by counts, and the first score of a range by an ordinary search.
+	Ranges are then walked in order with an explicit stack, O(log n + k) for k results. */
+
+struct ZNode {
+	double score;
+	std::string member;
+	ZNode* left = nullptr;
+	ZNode* right = nullptr;
+	int height = 1;
+	size_t count = 1;																							// 	Nodes in this subtree, itself included
+};
+
+class ZSet {
+public:
+	static const int K_MAX_HEIGHT = 96;																			// 	An AVL tree of 2^64 nodes is less than 1.45 * 64 high
+
+	// In order iteration from the node it was positioned at, node() is NULL past the end
+	class Iter {
+	public:
+		ZNode* node() const {
+			return depth_ ? stack_[depth_ - 1] : nullptr;
+		}
+
+		void next() {
+			ZNode* n = stack_[--depth_];
+			for (n = n->right; n; n = n->left) { stack_[depth_++] = n; }
+		}
+
+	private:
+		friend class ZSet;
+		ZNode* stack_[K_MAX_HEIGHT];																			// 	The current node, then the ancestors still to visit
+		int depth_ = 0;
+	};
+
+	ZSet() = default;
+	~ZSet() {
+		destroy(root_);
+	}
+	ZSet(const ZSet&) = delete;
+	ZSet& operator=(const ZSet&) = delete;
+
+	size_t size() const {
+		return index_.size();
+	}
+
+	// true when member is new, an existing one only moves to its new score
+	bool add(std::string_view member, double score) {
+		bool created = false;
+		ZNode** slot = index_.insert(member, &created);
+		if (!created) {
+			ZNode* node = *slot;
+			if (node->score == score) { return false; }
+			root_ = detach(root_, node);																		// 	Found by its old score, then put back in place
+			node->score = score;
+			node->left = node->right = nullptr;
+			node->height = 1;
+			node->count = 1;
+			root_ = attach(root_, node);
+			return false;
+		}
+		ZNode* node = new ZNode{score, std::string(member)};
+		*slot = node;
+		root_ = attach(root_, node);
+		return true;
+	}
+
+	bool remove(std::string_view member) {
+		ZNode** slot = index_.find(member);
+		if (!slot) { return false; }
+		ZNode* node = *slot;
+		index_.erase(member);
+		root_ = detach(root_, node);
+		delete node;
+		return true;
+	}
+
+	bool score(std::string_view member, double* score) {
+		ZNode** slot = index_.find(member);
+		if (!slot) { return false; }
+		*score = (*slot)->score;
+		return true;
+	}
+
+	// 0 for the lowest score
+	bool rank(std::string_view member, size_t* rank) {
+		ZNode** slot = index_.find(member);
+		if (!slot) { return false; }
+		ZNode* node = *slot;
+		size_t r = 0;
+		for (ZNode* t = root_; t != node; ) {
+			if (less(node, t)) {
+				t = t->left;
+			} else {
+				r += count(t->left) + 1;
+				t = t->right;
+			}
+		}
+		*rank = r + count(node->left);
+		return true;
+	}
+
+	// At the node of rank r (past the end when r >= size())
+	Iter seekRank(size_t r) const {
+		Iter it;
+		for (ZNode* t = root_; t; ) {
+			size_t left = count(t->left);
+			if (r < left) {
+				it.stack_[it.depth_++] = t;
+				t = t->left;
+			} else if (r == left) {
+				it.stack_[it.depth_++] = t;
+				break;
+			} else {
+				r -= left + 1;
+				t = t->right;
+			}
+		}
+		return it;
+	}
+
+	// At the first node scoring at least min (more than min if exclusive), *rank is its rank
+	Iter seekScore(double min, bool exclusive, size_t* rank) const {
+		Iter it;
+		size_t r = 0;
+		for (ZNode* t = root_; t; ) {
+			if (exclusive ? t->score > min : t->score >= min) {
+				it.stack_[it.depth_++] = t;
+				t = t->left;
+			} else {
+				r += count(t->left) + 1;
+				t = t->right;
+			}
+		}
+		*rank = r;
+		return it;
+	}
+
+private:
+	static size_t count(const ZNode* t) {
+		return t ? t->count : 0;
+	}
+
+	static int height(const ZNode* t) {
+		return t ? t->height : 0;
+	}
+
+	static bool less(const ZNode* a, const ZNode* b) {
+		return a->score < b->score || (a->score == b->score && a->member < b->member);
+	}
+
+	static void update(ZNode* t) {
+		int l = height(t->left);
+		int r = height(t->right);
+		t->height = (l > r ? l : r) + 1;
+		t->count = count(t->left) + count(t->right) + 1;
+	}
+
+	static ZNode* rotateLeft(ZNode* t) {
+		ZNode* r = t->right;
+		t->right = r->left;
+		r->left = t;
+		update(t);
+		update(r);
+		return r;
+	}
+
+	static ZNode* rotateRight(ZNode* t) {
+		ZNode* l = t->left;
+		t->left = l->right;
+		l->right = t;
+		update(t);
+		update(l);
+		return l;
+	}
+
+	// t with fresh height and count, rotated if its sides differ by 2
+	static ZNode* balance(ZNode* t) {
+		update(t);
+		int diff = height(t->left) - height(t->right);
+		if (diff > 1) {
+			if (height(t->left->left) < height(t->left->right)) { t->left = rotateLeft(t->left); }
+			return rotateRight(t);
+		}
+		if (diff < -1) {
+			if (height(t->right->right) < height(t->right->left)) { t->right = rotateRight(t->right); }
+			return rotateLeft(t);
+		}
+		return t;
+	}
+
+	// The subtree t with n added, its new root
+	static ZNode* attach(ZNode* t, ZNode* n) {
+		if (!t) { return n; }
+		if (less(n, t)) {
+			t->left = attach(t->left, n);
+		} else {
+			t->right = attach(t->right, n);
+		}
+		return balance(t);
+	}
+
+	// The subtree t without n (which is in it), its new root
+	static ZNode* detach(ZNode* t, ZNode* n) {
+		if (t == n) {
+			if (!t->left) { return t->right; }
+			if (!t->right) { return t->left; }
+			ZNode* next = nullptr;
+			ZNode* right = takeMin(t->right, &next);															// 	The successor takes n's place
+			next->left = t->left;
+			next->right = right;
+			return balance(next);
+		}
+		if (less(n, t)) {
+			t->left = detach(t->left, n);
+		} else {
+			t->right = detach(t->right, n);
+		}
+		return balance(t);
+	}
+
+	static ZNode* takeMin(ZNode* t, ZNode** min) {
+		if (!t->left) {
+			*min = t;
+			return t->right;
+		}
+		t->left = takeMin(t->left, min);
+		return balance(t);
+	}
+
+	static void destroy(ZNode* t) {
+		if (!t) { return; }
+		destroy(t->left);
+		destroy(t->right);
+		delete t;
+	}
+
+	ZNode* root_ = nullptr;
+	HashTable<ZNode*> index_;																					// 	Member -> node, the tree owns the nodes
+};
+
+#endif // ZSET_HPP